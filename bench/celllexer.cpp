@@ -0,0 +1,145 @@
+// Benchmark of reading the cells of rows, comparing celllexer::lex() in
+// src/celllexer.h with parsing each row by rapidxml and looking up the
+// attributes and children of each cell by name, as xlsxsheet::parseRow() and
+// xlsxcell used to.  Not part of the package.  From the top directory:
+//
+//   g++ -O2 -std=c++11 -iquote src bench/celllexer.cpp src/celllexer.cpp -o lex
+//   ./lex
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "celllexer.h"
+
+// What xlsxsheet::parseRow() and xlsxcell did with each row before the lexer
+static size_t oldRow(char* row, rapidxml::xml_document<>& xml) {
+  xml.clear();
+  xml.parse<rapidxml::parse_strip_xml_namespaces>(row);
+  rapidxml::xml_node<>* node = xml.first_node();
+  size_t sum = node->first_attribute("r")->value_size();
+  rapidxml::xml_attribute<>* ht = node->first_attribute("ht");
+  if (ht != NULL)
+    sum += ht->value_size();
+  for (rapidxml::xml_node<>* c = node->first_node();
+      c; c = c->next_sibling()) {
+    sum += c->first_attribute("r")->value_size();
+    rapidxml::xml_attribute<>* s = c->first_attribute("s");
+    if (s != NULL)
+      sum += s->value_size();
+    rapidxml::xml_attribute<>* t = c->first_attribute("t");
+    if (t != NULL)
+      sum += std::string(t->value()).size();
+    rapidxml::xml_node<>* v = c->first_node("v");
+    if (v != NULL)
+      sum += v->value_size();
+    rapidxml::xml_node<>* f = c->first_node("f");
+    if (f != NULL) {
+      sum += f->value_size();
+      rapidxml::xml_attribute<>* si = f->first_attribute("si");
+      if (si != NULL)
+        sum += si->value_size();
+    }
+  }
+  return sum;
+}
+
+static size_t newRow(celllexer& lexer, char* row, size_t size) {
+  lexer.lex(row, row + size);
+  size_t sum = lexer.row_ + lexer.ht_size_;
+  for (size_t k = 0; k < lexer.size_; ++k) {
+    const cellxml& c = lexer.cells_[k];
+    sum += c.r_size_ + c.s_ + (int)c.t_ + c.v_size_ + c.f_size_ + c.si_;
+  }
+  return sum;
+}
+
+static std::string cell(const char* col, int row, const std::string& rest) {
+  return "<c r=\"" + std::string(col) + std::to_string(row) + "\"" + rest
+    + "</c>";
+}
+
+int main() {
+  // 200000 rows of numbers, shared strings, dates and shared formulas, as
+  // Excel writes them
+  const int n = 200000;
+  std::mt19937_64 random(42);
+  std::vector<std::string> rows;
+  for (int row = 1; row <= n; ++row) {
+    std::string x = "<row r=\"" + std::to_string(row)
+      + "\" spans=\"1:6\" x14ac:dyDescent=\"0.25\">";
+    x += cell("A", row, " s=\"3\"><v>" + std::to_string(random() % 100000)
+              + "." + std::to_string(random() % 100) + "</v>");
+    x += cell("B", row, " t=\"s\"><v>" + std::to_string(random() % 5000)
+              + "</v>");
+    x += cell("C", row, " s=\"5\"><v>" + std::to_string(36526 + random() % 9000)
+              + "</v>");
+    x += cell("D", row, " t=\"b\"><v>" + std::to_string(random() % 2)
+              + "</v>");
+    if (row == 1) {
+      x += cell("E", row, "><f t=\"shared\" ref=\"E1:E200000\" si=\"0\">"
+                "A1*2&amp;B1</f><v>2</v>");
+    } else {
+      x += cell("E", row, "><f t=\"shared\" si=\"0\"/><v>"
+                + std::to_string(random() % 1000) + "</v>");
+    }
+    x += cell("F", row, " s=\"2\" t=\"str\"><f>IF(A1&gt;0,\"yes\",\"no\")</f>"
+              "<v>yes</v>");
+    x += "</row>";
+    rows.push_back(x);
+  }
+
+  // The lexer must agree with rapidxml on every cell
+  celllexer lexer, parsed;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    std::string x = rows[i], y = rows[i];
+    rapidxml::xml_document<> xml;
+    parsed.parse(&y[0], &y[0] + y.size(), xml);
+    if (!lexer.lex(&x[0], &x[0] + x.size()) || lexer.size_ != parsed.size_) {
+      std::printf("Disagree on row %zu\n", i + 1);
+      return 1;
+    }
+    for (size_t k = 0; k < lexer.size_; ++k) {
+      const cellxml& a = lexer.cells_[k];
+      const cellxml& b = parsed.cells_[k];
+      if (a.t_ != b.t_ || a.s_ != b.s_ || a.si_ != b.si_
+          || a.v_size_ != b.v_size_ || memcmp(a.v_, b.v_, a.v_size_) != 0
+          || a.f_size_ != b.f_size_
+          || (a.f_size_ > 0 && memcmp(a.f_, b.f_, a.f_size_) != 0)) {
+        std::printf("Disagree on row %zu\n", i + 1);
+        return 1;
+      }
+    }
+  }
+
+  // Each is timed on fresh copies, because both modify the rows, and the
+  // quickest of five runs is reported
+  double old_time = 1e9, new_time = 1e9;
+  size_t old_checksum = 0, new_checksum = 0;
+  rapidxml::xml_document<> xml;
+  for (int repeat = 0; repeat < 5; ++repeat) {
+    std::vector<std::string> copies = rows;
+    old_checksum = 0;
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    for (size_t i = 0; i < copies.size(); ++i)
+      old_checksum += oldRow(&copies[i][0], xml);
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    old_time = std::min(old_time, elapsed.count());
+
+    copies = rows;
+    new_checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < copies.size(); ++i)
+      new_checksum += newRow(lexer, &copies[i][0], copies[i].size());
+    elapsed = std::chrono::steady_clock::now() - start;
+    new_time = std::min(new_time, elapsed.count());
+  }
+  std::printf("%d rows of 6 cells  old: %.3fs  new: %.3fs\n", n, old_time,
+              new_time);
+  return 0;
+}
@@ -0,0 +1,132 @@
+// Benchmark of parsing the values of cells, comparing parseNumber() and
+// parseInteger() in src/number.h with the strtod() and strtol() of a
+// std::string copy that xlsxcell::cacheValue() used to make.  Not part of the
+// package.  From the top directory:
+//
+//   g++ -O2 -std=c++11 -iquote src bench/number.cpp src/number.cpp -o number
+//   ./number
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "number.h"
+
+// What xlsxcell::cacheValue() did before parseNumber() replaced it
+static double oldParseNumber(const char* x, size_t n) {
+  std::string vvalue;
+  vvalue.assign(x, n);
+  return strtod(vvalue.c_str(), NULL);
+}
+
+static long oldParseInteger(const char* x, size_t n) {
+  std::string vvalue;
+  vvalue.assign(x, n);
+  return strtol(vvalue.c_str(), NULL, 10);
+}
+
+static std::string format(const char* fmt, double x) {
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), fmt, x);
+  return buffer;
+}
+
+// The shortest text that round-trips, as Excel writes most numbers
+static std::string shortest(double x) {
+  for (int digits = 1; digits <= 17; ++digits) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.*g", digits, x);
+    if (strtod(buffer, NULL) == x)
+      return buffer;
+  }
+  return format("%.17g", x);
+}
+
+template <typename T, typename Parse>
+static double time(const std::vector<std::string>& values, Parse parse,
+                   T& checksum) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int repeat = 0; repeat < 10; ++repeat) {
+    for (size_t i = 0; i < values.size(); ++i)
+      checksum += parse(values[i].data(), values[i].size());
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static bool compare(const char* name, const std::vector<std::string>& values) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    double x = oldParseNumber(values[i].data(), values[i].size());
+    double y = parseNumber(values[i].data(), values[i].size());
+    if (std::memcmp(&x, &y, sizeof(double)) != 0) {
+      std::printf("Disagree on %s\n", values[i].c_str());
+      return false;
+    }
+  }
+  double old_checksum = 0, new_checksum = 0;
+  double old_time = time(values, oldParseNumber, old_checksum);
+  double new_time = time(values, parseNumber, new_checksum);
+  std::printf("%-28s old: %.3fs  new: %.3fs\n", name, old_time, new_time);
+  // NaN != NaN, so the sums are compared bit by bit
+  return std::memcmp(&old_checksum, &new_checksum, sizeof(double)) == 0;
+}
+
+int main() {
+  // Columns of 1000000 cells of the kinds of numbers in real sheets
+  const size_t n = 1000000;
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<std::string> counts, money, dates, datetimes, measurements,
+                           results, edges, indices;
+  for (size_t i = 0; i < n; ++i) {
+    double u = uniform(random);
+    counts.push_back(format("%.0f", std::floor(u * 100000)));
+    money.push_back(shortest(std::round(u * 1e7) / 100));
+    dates.push_back(format("%.0f", 36526 + std::floor(u * 10000)));
+    // Times of day to the second, which mostly need 17 digits
+    double seconds = std::floor(uniform(random) * 86400);
+    datetimes.push_back(shortest(36526 + std::floor(u * 10000)
+                                 + seconds / 86400));
+    measurements.push_back(shortest(std::round(u * 1e6) / 1e3 - 200));
+    // The results of formulas, with all 17 digits
+    results.push_back(format("%.17g", u * std::pow(10, (int)(u * 20) - 10)));
+    indices.push_back(format("%.0f", std::floor(u * 50000)));
+  }
+  const char* awkward[] = {
+    "0", "-0", "1", "-1", "0.1", "1E-3", "1e+300", "1e-320",
+    "4.9406564584124654e-324", "1.7976931348623157e308", "1e309",
+    "9007199254740993", "9007199254740992",
+    "123456789012345678901234567890", "0.000000000000000000000000000001",
+    "1.", ".5", ".", "", "-", "1e", "1e+", "abc", " 12", "12 ", "0x10", "inf",
+    "nan", "1e22", "1e23", "3.0000000000000004", "2.2250738585072011e-308"};
+  for (size_t i = 0; i < sizeof(awkward) / sizeof(awkward[0]); ++i)
+    edges.push_back(awkward[i]);
+
+  std::printf("%zu values of each kind, 10 times\n", n);
+  bool ok = compare("edge cases", edges)
+    && compare("counts", counts)
+    && compare("money", money)
+    && compare("dates", dates)
+    && compare("datetimes", datetimes)
+    && compare("measurements", measurements)
+    && compare("results (17 digits)", results);
+
+  // Shared string indices
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (oldParseInteger(indices[i].data(), indices[i].size())
+        != parseInteger(indices[i].data(), indices[i].size())) {
+      std::printf("Disagree on %s\n", indices[i].c_str());
+      return 1;
+    }
+  }
+  long old_checksum = 0, new_checksum = 0;
+  double old_time = time(indices, oldParseInteger, old_checksum);
+  double new_time = time(indices, parseInteger, new_checksum);
+  std::printf("%-28s old: %.3fs  new: %.3fs\n", "shared string indices",
+              old_time, new_time);
+  return ok && old_checksum == new_checksum ? 0 : 1;
+}
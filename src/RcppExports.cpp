@@ -5,63 +5,218 @@
 
 using namespace Rcpp;
 
-// xlsx_cells_
-List xlsx_cells_(std::string path, CharacterVector sheet_paths, CharacterVector sheet_names, CharacterVector comments_paths);
-RcppExport SEXP _tidyxl_xlsx_cells_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP, SEXP comments_pathsSEXP) {
+// xlsx_file_
+SEXP xlsx_file_(std::string path);
+RcppExport SEXP _tidyxl_xlsx_file_(SEXP pathSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_file_(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_cells_
+List xlsx_cells_(SEXP file, CharacterVector sheet_paths, CharacterVector sheet_names, CharacterVector comments_paths, int threads, CharacterVector columns, bool factors, bool lazy_formulas, IntegerVector window);
+RcppExport SEXP _tidyxl_xlsx_cells_(SEXP fileSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP, SEXP comments_pathsSEXP, SEXP threadsSEXP, SEXP columnsSEXP, SEXP factorsSEXP, SEXP lazy_formulasSEXP, SEXP windowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type comments_paths(comments_pathsSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_cells_(path, sheet_paths, sheet_names, comments_paths));
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type columns(columnsSEXP);
+    Rcpp::traits::input_parameter< bool >::type factors(factorsSEXP);
+    Rcpp::traits::input_parameter< bool >::type lazy_formulas(lazy_formulasSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type window(windowSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_cells_(file, sheet_paths, sheet_names, comments_paths, threads, columns, factors, lazy_formulas, window));
+    return rcpp_result_gen;
+END_RCPP
+}
+// parse_range_
+IntegerVector parse_range_(std::string range);
+RcppExport SEXP _tidyxl_parse_range_(SEXP rangeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type range(rangeSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_range_(range));
+    return rcpp_result_gen;
+END_RCPP
+}
+// expand_formulas_
+CharacterVector expand_formulas_(CharacterVector formula, IntegerVector from_row, IntegerVector from_col, IntegerVector to_row, IntegerVector to_col);
+RcppExport SEXP _tidyxl_expand_formulas_(SEXP formulaSEXP, SEXP from_rowSEXP, SEXP from_colSEXP, SEXP to_rowSEXP, SEXP to_colSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type formula(formulaSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type from_row(from_rowSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type from_col(from_colSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type to_row(to_rowSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type to_col(to_colSEXP);
+    rcpp_result_gen = Rcpp::wrap(expand_formulas_(formula, from_row, from_col, to_row, to_col));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_formats_
-List xlsx_formats_(std::string path);
-RcppExport SEXP _tidyxl_xlsx_formats_(SEXP pathSEXP) {
+List xlsx_formats_(SEXP file);
+RcppExport SEXP _tidyxl_xlsx_formats_(SEXP fileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_formats_(path));
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_formats_(file));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_sheet_files_
-List xlsx_sheet_files_(std::string path);
-RcppExport SEXP _tidyxl_xlsx_sheet_files_(SEXP pathSEXP) {
+List xlsx_sheet_files_(SEXP file);
+RcppExport SEXP _tidyxl_xlsx_sheet_files_(SEXP fileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_sheet_files_(path));
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_sheet_files_(file));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_validation_
-List xlsx_validation_(std::string path, CharacterVector sheet_paths, CharacterVector sheet_names);
-RcppExport SEXP _tidyxl_xlsx_validation_(SEXP pathSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP) {
+List xlsx_validation_(SEXP file, CharacterVector sheet_paths, CharacterVector sheet_names);
+RcppExport SEXP _tidyxl_xlsx_validation_(SEXP fileSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_validation_(path, sheet_paths, sheet_names));
+    rcpp_result_gen = Rcpp::wrap(xlsx_validation_(file, sheet_paths, sheet_names));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_dimensions_
+List xlsx_dimensions_(SEXP file, CharacterVector sheet_paths, CharacterVector sheet_names);
+RcppExport SEXP _tidyxl_xlsx_dimensions_(SEXP fileSEXP, SEXP sheet_pathsSEXP, SEXP sheet_namesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_paths(sheet_pathsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_dimensions_(file, sheet_paths, sheet_names));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_dependencies_
+List xlsx_dependencies_(CharacterVector sheet_names, IntegerVector sheets, IntegerVector rows, IntegerVector cols, CharacterVector formulas, IntegerVector name_sheets, CharacterVector names, CharacterVector name_formulas, int threads);
+RcppExport SEXP _tidyxl_xlsx_dependencies_(SEXP sheet_namesSEXP, SEXP sheetsSEXP, SEXP rowsSEXP, SEXP colsSEXP, SEXP formulasSEXP, SEXP name_sheetsSEXP, SEXP namesSEXP, SEXP name_formulasSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type cols(colsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type formulas(formulasSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type name_sheets(name_sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type names(namesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type name_formulas(name_formulasSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_dependencies_(sheet_names, sheets, rows, cols, formulas, name_sheets, names, name_formulas, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_dependents_
+IntegerVector xlsx_dependents_(SEXP graph, CharacterVector sheets, CharacterVector refs, bool recursive);
+RcppExport SEXP _tidyxl_xlsx_dependents_(SEXP graphSEXP, SEXP sheetsSEXP, SEXP refsSEXP, SEXP recursiveSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type graph(graphSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type refs(refsSEXP);
+    Rcpp::traits::input_parameter< bool >::type recursive(recursiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_dependents_(graph, sheets, refs, recursive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_precedents_
+IntegerVector xlsx_precedents_(SEXP graph, CharacterVector sheets, CharacterVector refs, bool recursive);
+RcppExport SEXP _tidyxl_xlsx_precedents_(SEXP graphSEXP, SEXP sheetsSEXP, SEXP refsSEXP, SEXP recursiveSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type graph(graphSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type refs(refsSEXP);
+    Rcpp::traits::input_parameter< bool >::type recursive(recursiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_precedents_(graph, sheets, refs, recursive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_model_
+List xlsx_model_(SEXP file, CharacterVector sheet_names, List cells, List names, int threads);
+RcppExport SEXP _tidyxl_xlsx_model_(SEXP fileSEXP, SEXP sheet_namesSEXP, SEXP cellsSEXP, SEXP namesSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheet_names(sheet_namesSEXP);
+    Rcpp::traits::input_parameter< List >::type cells(cellsSEXP);
+    Rcpp::traits::input_parameter< List >::type names(namesSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_model_(file, sheet_names, cells, names, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_set_values_
+void xlsx_set_values_(SEXP model, CharacterVector sheets, CharacterVector addresses, SEXP values);
+RcppExport SEXP _tidyxl_xlsx_set_values_(SEXP modelSEXP, SEXP sheetsSEXP, SEXP addressesSEXP, SEXP valuesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type values(valuesSEXP);
+    xlsx_set_values_(model, sheets, addresses, values);
+    return R_NilValue;
+END_RCPP
+}
+// xlsx_recalculate_
+List xlsx_recalculate_(SEXP model, bool all);
+RcppExport SEXP _tidyxl_xlsx_recalculate_(SEXP modelSEXP, SEXP allSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< bool >::type all(allSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_recalculate_(model, all));
+    return rcpp_result_gen;
+END_RCPP
+}
+// xlsx_values_
+List xlsx_values_(SEXP model, CharacterVector sheets, CharacterVector addresses);
+RcppExport SEXP _tidyxl_xlsx_values_(SEXP modelSEXP, SEXP sheetsSEXP, SEXP addressesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sheets(sheetsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_values_(model, sheets, addresses));
     return rcpp_result_gen;
 END_RCPP
 }
 // xlsx_names_
-List xlsx_names_(std::string path);
-RcppExport SEXP _tidyxl_xlsx_names_(SEXP pathSEXP) {
+List xlsx_names_(SEXP file);
+RcppExport SEXP _tidyxl_xlsx_names_(SEXP fileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_names_(path));
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_names_(file));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -77,13 +232,13 @@ BEGIN_RCPP
 END_RCPP
 }
 // xlsx_color_theme_
-List xlsx_color_theme_(std::string path);
-RcppExport SEXP _tidyxl_xlsx_color_theme_(SEXP pathSEXP) {
+List xlsx_color_theme_(SEXP file);
+RcppExport SEXP _tidyxl_xlsx_color_theme_(SEXP fileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(xlsx_color_theme_(path));
+    Rcpp::traits::input_parameter< SEXP >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlsx_color_theme_(file));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -98,16 +253,68 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// xlex_all_
+List xlex_all_(CharacterVector x, int threads, bool factors, bool tree);
+RcppExport SEXP _tidyxl_xlex_all_(SEXP xSEXP, SEXP threadsSEXP, SEXP factorsSEXP, SEXP treeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type factors(factorsSEXP);
+    Rcpp::traits::input_parameter< bool >::type tree(treeSEXP);
+    rcpp_result_gen = Rcpp::wrap(xlex_all_(x, threads, factors, tree));
+    return rcpp_result_gen;
+END_RCPP
+}
+// zip_buffer_
+RawVector zip_buffer_(std::string zip_path, std::string file_path);
+RcppExport SEXP _tidyxl_zip_buffer_(SEXP zip_pathSEXP, SEXP file_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type zip_path(zip_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type file_path(file_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(zip_buffer_(zip_path, file_path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// zip_has_file_
+bool zip_has_file_(std::string zip_path, std::string file_path);
+RcppExport SEXP _tidyxl_zip_has_file_(SEXP zip_pathSEXP, SEXP file_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type zip_path(zip_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type file_path(file_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(zip_has_file_(zip_path, file_path));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_tidyxl_xlsx_cells_", (DL_FUNC) &_tidyxl_xlsx_cells_, 4},
+    {"_tidyxl_xlsx_file_", (DL_FUNC) &_tidyxl_xlsx_file_, 1},
+    {"_tidyxl_xlsx_cells_", (DL_FUNC) &_tidyxl_xlsx_cells_, 9},
+    {"_tidyxl_parse_range_", (DL_FUNC) &_tidyxl_parse_range_, 1},
+    {"_tidyxl_expand_formulas_", (DL_FUNC) &_tidyxl_expand_formulas_, 5},
     {"_tidyxl_xlsx_formats_", (DL_FUNC) &_tidyxl_xlsx_formats_, 1},
     {"_tidyxl_xlsx_sheet_files_", (DL_FUNC) &_tidyxl_xlsx_sheet_files_, 1},
     {"_tidyxl_xlsx_validation_", (DL_FUNC) &_tidyxl_xlsx_validation_, 3},
+    {"_tidyxl_xlsx_dimensions_", (DL_FUNC) &_tidyxl_xlsx_dimensions_, 3},
+    {"_tidyxl_xlsx_dependencies_", (DL_FUNC) &_tidyxl_xlsx_dependencies_, 9},
+    {"_tidyxl_xlsx_dependents_", (DL_FUNC) &_tidyxl_xlsx_dependents_, 4},
+    {"_tidyxl_xlsx_precedents_", (DL_FUNC) &_tidyxl_xlsx_precedents_, 4},
+    {"_tidyxl_xlsx_model_", (DL_FUNC) &_tidyxl_xlsx_model_, 5},
+    {"_tidyxl_xlsx_set_values_", (DL_FUNC) &_tidyxl_xlsx_set_values_, 4},
+    {"_tidyxl_xlsx_recalculate_", (DL_FUNC) &_tidyxl_xlsx_recalculate_, 2},
+    {"_tidyxl_xlsx_values_", (DL_FUNC) &_tidyxl_xlsx_values_, 3},
     {"_tidyxl_xlsx_names_", (DL_FUNC) &_tidyxl_xlsx_names_, 1},
     {"_tidyxl_is_date_format_", (DL_FUNC) &_tidyxl_is_date_format_, 1},
     {"_tidyxl_xlsx_color_theme_", (DL_FUNC) &_tidyxl_xlsx_color_theme_, 1},
     {"_tidyxl_xlex_", (DL_FUNC) &_tidyxl_xlex_, 1},
+    {"_tidyxl_xlex_all_", (DL_FUNC) &_tidyxl_xlex_all_, 4},
+    {"_tidyxl_zip_buffer_", (DL_FUNC) &_tidyxl_zip_buffer_, 2},
+    {"_tidyxl_zip_has_file_", (DL_FUNC) &_tidyxl_zip_has_file_, 2},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,125 @@
+#ifndef ADDRESS_
+#define ADDRESS_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Decoding of A1-style addresses, straight from the characters of an xml
+// attribute, without copying them into a std::string first.
+//
+// Columns are letters A to XFD (1 to 16384) and rows are numbers 1 to 1048576.
+// Both are one-based.  The parsers of parts of an address return the number of
+// characters that they consumed, or 0 if the part isn't there or is out of
+// range, so that a caller can go on to parse the rest of the address.
+
+const int MAX_COL = 16384;   // XFD
+const int MAX_ROW = 1048576;
+
+// One comparison each, by wrapping characters below 'A' or '0' round to large
+// unsigned numbers
+inline bool isColLetter(char x) { return (unsigned)(x - 'A') < 26u; }
+inline bool isRowDigit(char x) { return (unsigned)(x - '0') < 10u; }
+
+// Column letters at the start of x[0, n)
+inline size_t parseCol(const char* x, size_t n, int& col) {
+  size_t k = 0;
+  int out = 0;
+  for (; k < n && k < 3 && isColLetter(x[k]); ++k)
+    out = 26 * out + (x[k] - 'A' + 1);
+  if (k == 0 || out > MAX_COL || (k < n && isColLetter(x[k])))
+    return 0;
+  col = out;
+  return k;
+}
+
+// Row digits at the start of x[0, n)
+inline size_t parseRow(const char* x, size_t n, int& row) {
+  size_t k = 0;
+  int out = 0;
+  for (; k < n && k < 7 && isRowDigit(x[k]); ++k)
+    out = 10 * out + (x[k] - '0');
+  if (k == 0 || out == 0 || out > MAX_ROW || (k < n && isRowDigit(x[k])))
+    return 0;
+  row = out;
+  return k;
+}
+
+// The whole of x[0, n) as an address such as "AB12".  Returns false, leaving
+// row and col alone, if it isn't one.
+inline bool parseAddress(const char* x, size_t n, int& row, int& col) {
+  int r, c;
+  size_t k = parseCol(x, n, c);
+  if (k == 0 || k == n || parseRow(x + k, n - k, r) != n - k)
+    return false;
+  row = r;
+  col = c;
+  return true;
+}
+
+// The letters of every column, four bytes each (up to three letters and a
+// nul), made the first time they're needed
+inline std::vector<char> makeColLetters() {
+  std::vector<char> table(4 * (MAX_COL + 1), '\0');
+  for (int col = 1; col <= MAX_COL; ++col) {
+    char letters[3];
+    int n = 0;
+    for (int c = col; c > 0; c = (c - 1) / 26)
+      letters[n++] = 'A' + (c - 1) % 26;
+    for (int k = 0; k < n; ++k)
+      table[4 * col + k] = letters[n - 1 - k];
+  }
+  return table;
+}
+
+// Nul-terminated letters of column col, from 1 to MAX_COL
+inline const char* colLetters(int col) {
+  static const std::vector<char> table = makeColLetters();
+  return &table[4 * col];
+}
+
+// Appends the letters of column col to out.  Columns beyond XFD, which can
+// come from offsetting a formula, are spelled out the slow way, and columns
+// below 1 are left out.
+inline void appendCol(int col, std::string& out) {
+  if (col >= 1 && col <= MAX_COL) {
+    out += colLetters(col);
+  } else if (col > MAX_COL) {
+    std::string letters;
+    for (int c = col; c > 0; c = (c - 1) / 26)
+      letters.insert(letters.begin(), 'A' + (c - 1) % 26);
+    out += letters;
+  }
+}
+
+// Appends row number row to out
+inline void appendRow(int row, std::string& out) {
+  if (row <= 0) {
+    out += std::to_string(row); // only from offsetting a formula
+    return;
+  }
+  char digits[16];
+  char* p = digits + sizeof(digits);
+  do {
+    *--p = '0' + row % 10;
+    row /= 10;
+  } while (row > 0);
+  out.append(p, digits + sizeof(digits) - p);
+}
+
+// A1-style address from one-based row and column numbers
+inline std::string formatAddress(int row, int col) {
+  std::string out;
+  appendCol(col, out);
+  appendRow(row, out);
+  return out;
+}
+
+// Row and column in one number, which sorts in the order of the cells in a
+// sheet: by row, then by column
+inline uint64_t packAddress(int row, int col) {
+  return ((uint64_t)(uint32_t)row << 32) | (uint32_t)col;
+}
+
+#endif
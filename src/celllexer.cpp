@@ -0,0 +1,573 @@
+#include <cstring>
+#include "celllexer.h"
+#include "number.h"
+
+static inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// The first c in [p, end), or NULL.  The spans of a row are short, so a loop
+// is quicker than the call to memchr().
+static inline char* find(char* p, char* end, char c) {
+  for (; p < end; ++p) {
+    if (*p == c)
+      return p;
+  }
+  return NULL;
+}
+
+// Whether [p, end) starts with s, which is short enough that memcmp() is
+// done inline
+template <size_t N>
+static inline bool startsWith(const char* p, const char* end,
+                              const char (&s)[N]) {
+  return (size_t)(end - p) >= N - 1 && memcmp(p, s, N - 1) == 0;
+}
+
+// The name of the tag whose name starts at p, without any namespace prefix.
+// Leaves p after the name.  Like the other functions here, it works on a copy
+// of p, which the compiler can keep in a register.
+static inline void tagName(char*& p, char* end, const char*& name,
+                           size_t& size) {
+  char* q = p;
+  const char* local = q;
+  while (q < end && !isSpace(*q) && *q != '>' && *q != '/') {
+    if (*q == ':')
+      local = q + 1;
+    ++q;
+  }
+  name = local;
+  size = q - local;
+  p = q;
+}
+
+// Whether name[0, size) is the nul-terminated x, without calling strlen()
+static inline bool nameIs(const char* name, size_t size, const char* x) {
+  for (size_t k = 0; k < size; ++k) {
+    if (x[k] == '\0' || x[k] != name[k])
+      return false;
+  }
+  return x[size] == '\0';
+}
+
+// The next attribute of a tag, leaving p after it.  1 if there is one, 0 at
+// the end of the tag, leaving p at '>' or "/>", and -1 if the tag is invalid.
+static inline int nextAttribute(char*& p, char* end, const char*& name,
+                                size_t& name_size, char*& value,
+                                size_t& value_size) {
+  char* q = p;
+  while (q < end && isSpace(*q))
+    ++q;
+  p = q;
+  if (q == end)
+    return -1;
+  if (*q == '>' || *q == '/')
+    return 0;
+  if (end - q > 2 && q[1] == '=' && (q[2] == '"' || q[2] == '\'')) {
+    // Most attributes of cells are r="A1", s="1" or t="s"
+    name = q;
+    name_size = 1;
+    q += 2;
+  } else {
+    const char* local = q;
+    while (q < end && !isSpace(*q) && *q != '=' && *q != '>' && *q != '/') {
+      if (*q == ':')
+        local = q + 1;
+      ++q;
+    }
+    if (q == local)
+      return -1;
+    name = local;
+    name_size = q - local;
+    while (q < end && isSpace(*q))
+      ++q;
+    if (q == end || *q != '=')
+      return -1;
+    ++q;
+    while (q < end && isSpace(*q))
+      ++q;
+    if (q == end || (*q != '"' && *q != '\''))
+      return -1;
+  }
+  char quote = *q++;
+  value = q;
+  while (q < end && *q != quote && *q != '<')
+    ++q;
+  if (q == end || *q != quote)
+    return -1;
+  value_size = q - value;
+  p = q + 1;
+  return 1;
+}
+
+// The end of a start tag, at '>' or "/>".  Returns 1 if the element is empty,
+// 0 if it has content, -1 if the tag is invalid, and leaves p after the tag.
+static inline int tagEnd(char*& p, char* end) {
+  if (*p == '>') {
+    ++p;
+    return 0;
+  }
+  if (p + 1 < end && p[1] == '>') {
+    p += 2;
+    return 1;
+  }
+  return -1;
+}
+
+// Skips the attributes of a start tag.  As tagEnd().
+static inline int skipAttributes(char*& p, char* end) {
+  const char* name;
+  size_t name_size;
+  char* value;
+  size_t value_size;
+  int found;
+  while ((found = nextAttribute(p, end, name, name_size, value, value_size))
+         == 1) {}
+  return found == 0 ? tagEnd(p, end) : -1;
+}
+
+// Skips the end tag that starts at p, checking its name
+static inline bool skipEndTag(char*& p, char* end, const char* name) {
+  if (p + 1 >= end || p[0] != '<' || p[1] != '/')
+    return false;
+  char* q = p + 2;
+  const char* found;
+  size_t size;
+  tagName(q, end, found, size);
+  if (!nameIs(found, size, name))
+    return false;
+  while (q < end && isSpace(*q))
+    ++q;
+  if (q == end || *q != '>')
+    return false;
+  p = q + 1;
+  return true;
+}
+
+// The content of the element whose start tag was just read, up to its end
+// tag, which must come next.  Leaves p after the end tag.
+static inline bool text(char*& p, char* end, const char* name, char*& value,
+                        size_t& size) {
+  value = p;
+  char* lt = find(p, end, '<');
+  if (lt == NULL)
+    return false;
+  size = lt - p;
+  p = lt;
+  return skipEndTag(p, end, name);
+}
+
+// Skips the rest of an element whose start tag's name has been read, with
+// anything nested in it.  Gives up on comments, CDATA and processing
+// instructions.
+static bool skipElement(char*& p, char* end) {
+  int empty = skipAttributes(p, end);
+  if (empty != 0)
+    return empty == 1;
+  int depth = 1;
+  while (depth > 0) {
+    char* lt = find(p, end, '<');
+    if (lt == NULL || lt + 1 >= end || lt[1] == '!' || lt[1] == '?')
+      return false;
+    p = lt + 1;
+    if (*p == '/') {
+      char* gt = find(p, end, '>');
+      if (gt == NULL)
+        return false;
+      p = gt + 1;
+      --depth;
+    } else {
+      const char* name;
+      size_t size;
+      tagName(p, end, name, size);
+      int nested = skipAttributes(p, end);
+      if (nested == -1)
+        return false;
+      depth += 1 - nested;
+    }
+  }
+  return true;
+}
+
+// Decodes the predefined entities and character references in x[0, n) in
+// place, as rapidxml does, and returns the new size.  The result is never
+// longer.
+static size_t decode(char* x, size_t n) {
+  char* amp = find(x, x + n, '&');
+  if (amp == NULL)
+    return n;
+  char* in = amp;
+  char* out = amp;
+  char* end = x + n;
+  while (in < end) {
+    if (*in != '&') {
+      *out++ = *in++;
+      continue;
+    }
+    char* semicolon = find(in, end, ';');
+    size_t size = semicolon == NULL ? 0 : semicolon - in - 1;
+    const char* name = in + 1;
+    char c = 0;
+    if (nameIs(name, size, "lt")) c = '<';
+    else if (nameIs(name, size, "gt")) c = '>';
+    else if (nameIs(name, size, "amp")) c = '&';
+    else if (nameIs(name, size, "quot")) c = '"';
+    else if (nameIs(name, size, "apos")) c = '\'';
+    if (c != 0) {
+      *out++ = c;
+      in = semicolon + 1;
+      continue;
+    }
+    if (size >= 2 && name[0] == '#') {
+      bool hex = name[1] == 'x';
+      unsigned long code = 0;
+      size_t k = hex ? 2 : 1;
+      bool valid = k < size;
+      for (; k < size && valid; ++k) {
+        char d = name[k];
+        if (d >= '0' && d <= '9')
+          code = (hex ? 16 : 10) * code + (d - '0');
+        else if (hex && (d | 0x20) >= 'a' && (d | 0x20) <= 'f')
+          code = 16 * code + ((d | 0x20) - 'a' + 10);
+        else
+          valid = false;
+        if (code > 0x10FFFF)
+          valid = false;
+      }
+      if (valid) {
+        // As appendUtf8(), into the space of the reference, which is longer
+        if (code == 0) {
+        } else if (code < 0x80) {
+          *out++ = code;
+        } else if (code < 0x800) {
+          *out++ = 0xC0 | (code >> 6);
+          *out++ = 0x80 | (code & 0x3F);
+        } else if (code < 0x10000) {
+          *out++ = 0xE0 | (code >> 12);
+          *out++ = 0x80 | ((code >> 6) & 0x3F);
+          *out++ = 0x80 | (code & 0x3F);
+        } else {
+          *out++ = 0xF0 | (code >> 18);
+          *out++ = 0x80 | ((code >> 12) & 0x3F);
+          *out++ = 0x80 | ((code >> 6) & 0x3F);
+          *out++ = 0x80 | (code & 0x3F);
+        }
+        in = semicolon + 1;
+        continue;
+      }
+    }
+    *out++ = *in++; // not an entity that rapidxml knows, so left alone
+  }
+  return out - x;
+}
+
+static inline xml_type xmlType(const char* t, size_t size) {
+  // By the first byte, then the rest to be sure
+  switch (t[0]) {
+    case 'n':
+      if (size == 1)
+        return xml_type::NUMBER;
+      break;
+    case 's':
+      if (size == 1)
+        return xml_type::SHARED_STRING;
+      if (size == 3 && memcmp(t, "str", 3) == 0)
+        return xml_type::FORMULA_STRING;
+      break;
+    case 'b':
+      if (size == 1)
+        return xml_type::BOOLEAN;
+      break;
+    case 'e':
+      if (size == 1)
+        return xml_type::ERROR;
+      break;
+    case 'd':
+      if (size == 1)
+        return xml_type::DATE;
+      break;
+    case 'i':
+      if (size == 9 && memcmp(t, "inlineStr", 9) == 0)
+        return xml_type::INLINE_STRING;
+      break;
+  }
+  return xml_type::UNKNOWN;
+}
+
+static inline void clear(cellxml& cell) {
+  cell.r_ = NULL;
+  cell.r_size_ = 0;
+  cell.s_ = 0;
+  cell.t_ = xml_type::NUMBER;
+  cell.v_ = NULL;
+  cell.v_size_ = 0;
+  cell.is_ = NULL;
+  cell.is_size_ = 0;
+  cell.is_node_ = NULL;
+  cell.has_f_ = false;
+  cell.f_array_ = false;
+  cell.f_ = NULL;
+  cell.f_size_ = 0;
+  cell.ref_ = NULL;
+  cell.ref_size_ = 0;
+  cell.si_ = -1;
+}
+
+celllexer::celllexer(): row_(0), ht_(NULL), ht_size_(0), size_(0) {}
+
+cellxml& celllexer::nextCell() {
+  if (size_ == cells_.size())
+    cells_.push_back(cellxml());
+  cellxml& cell = cells_[size_++];
+  clear(cell);
+  return cell;
+}
+
+int celllexer::lexStartTag(char*& p, char* end) {
+  row_ = 0;
+  ht_ = NULL;
+  ht_size_ = 0;
+  size_ = 0;
+
+  p = find(p, end, '<');
+  if (p == NULL)
+    return -1;
+  ++p;
+  const char* name;
+  size_t name_size;
+  tagName(p, end, name, name_size);
+  if (!nameIs(name, name_size, "row"))
+    return -1;
+  char* value;
+  size_t value_size;
+  int found;
+  while ((found = nextAttribute(p, end, name, name_size, value, value_size))
+         == 1) {
+    if (nameIs(name, name_size, "r")) {
+      row_ = parseInteger(value, value_size);
+    } else if (nameIs(name, name_size, "ht")) {
+      ht_ = value;
+      ht_size_ = value_size;
+    }
+  }
+  if (found == -1)
+    return -1;
+  return tagEnd(p, end);
+}
+
+bool celllexer::lexRow(char* begin, char* end) {
+  return lexStartTag(begin, end) != -1;
+}
+
+bool celllexer::lex(char* begin, char* end) {
+  char* p = begin;
+  int empty = lexStartTag(p, end);
+  if (empty == -1)
+    return false;
+  const char* name;
+  size_t name_size;
+
+  while (!empty) {
+    char* lt = find(p, end, '<');
+    if (lt == NULL || lt + 1 >= end || lt[1] == '!' || lt[1] == '?')
+      return false;
+    p = lt;
+    if (p[1] == '/') {
+      if (!skipEndTag(p, end, "row"))
+        return false;
+      break;
+    }
+    if (startsWith(p, end, "<c ")) { // as Excel writes it
+      p += 2;
+      if (!lexCell(p, end, nextCell()))
+        return false;
+      continue;
+    }
+    ++p;
+    tagName(p, end, name, name_size);
+    if (nameIs(name, name_size, "c")) {
+      if (!lexCell(p, end, nextCell()))
+        return false;
+    } else if (!skipElement(p, end)) {
+      return false;
+    }
+  }
+
+  // Only now that the whole row has been lexed is anything modified
+  for (size_t k = 0; k < size_; ++k) {
+    cellxml& cell = cells_[k];
+    if (cell.v_ != NULL)
+      cell.v_size_ = decode(cell.v_, cell.v_size_);
+    if (cell.f_ != NULL)
+      cell.f_size_ = decode(cell.f_, cell.f_size_);
+  }
+  return true;
+}
+
+// Lexes a <c> element whose name has been read
+bool celllexer::lexCell(char*& p, char* end, cellxml& cell) {
+  const char* name;
+  size_t name_size;
+  char* value;
+  size_t value_size;
+  int found;
+  while ((found = nextAttribute(p, end, name, name_size, value, value_size))
+         == 1) {
+    if (name_size != 1)
+      continue;
+    switch (name[0]) {
+      case 'r':
+        cell.r_ = value;
+        cell.r_size_ = value_size;
+        break;
+      case 's':
+        cell.s_ = parseInteger(value, value_size);
+        break;
+      case 't':
+        cell.t_ = value_size == 0 ? xml_type::UNKNOWN
+                                  : xmlType(value, value_size);
+        break;
+    }
+  }
+  if (found == -1)
+    return false;
+  int empty = tagEnd(p, end);
+  if (empty == -1)
+    return false;
+
+  while (!empty) {
+    char* lt = find(p, end, '<');
+    if (lt == NULL || lt + 1 >= end || lt[1] == '!' || lt[1] == '?')
+      return false;
+    p = lt;
+    // Excel writes <v> and </c> without prefixes or spaces, so they are
+    // matched byte for byte before anything more general
+    if (startsWith(p, end, "<v>")) {
+      lt = find(p + 3, end, '<');
+      if (lt != NULL && startsWith(lt, end, "</v>")) {
+        cell.v_ = p + 3;
+        cell.v_size_ = lt - cell.v_;
+        p = lt + 4;
+        continue;
+      }
+    }
+    if (p[1] == '/') {
+      if (startsWith(p, end, "</c>")) {
+        p += 4;
+        return true;
+      }
+      return skipEndTag(p, end, "c");
+    }
+    char* start = p;
+    ++p;
+    tagName(p, end, name, name_size);
+    if (nameIs(name, name_size, "v")) {
+      int v_empty = skipAttributes(p, end);
+      if (v_empty == -1)
+        return false;
+      if (v_empty) {
+        cell.v_ = p;
+        cell.v_size_ = 0;
+      } else if (!text(p, end, "v", cell.v_, cell.v_size_)) {
+        return false;
+      }
+    } else if (nameIs(name, name_size, "f")) {
+      cell.has_f_ = true;
+      while ((found = nextAttribute(p, end, name, name_size, value,
+                                    value_size)) == 1) {
+        if (nameIs(name, name_size, "t")) {
+          cell.f_array_ = nameIs(value, value_size, "array");
+        } else if (nameIs(name, name_size, "ref")) {
+          cell.ref_ = value;
+          cell.ref_size_ = value_size;
+        } else if (nameIs(name, name_size, "si")) {
+          cell.si_ = parseInteger(value, value_size);
+        }
+      }
+      if (found == -1)
+        return false;
+      int f_empty = tagEnd(p, end);
+      if (f_empty == -1)
+        return false;
+      if (f_empty) {
+        cell.f_ = p;
+        cell.f_size_ = 0;
+      } else if (!text(p, end, "f", cell.f_, cell.f_size_)) {
+        return false;
+      }
+    } else if (nameIs(name, name_size, "is")) {
+      if (!skipElement(p, end))
+        return false;
+      cell.is_ = start;
+      cell.is_size_ = p - start;
+    } else if (!skipElement(p, end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void celllexer::parse(char* begin, char* end, rapidxml::xml_document<>& xml) {
+  row_ = 0;
+  ht_ = NULL;
+  ht_size_ = 0;
+  size_ = 0;
+
+  // rapidxml needs the row to be nul-terminated, which might be the start of
+  // the next row, so that is put back afterwards
+  char after = *end;
+  *end = '\0';
+  xml.parse<rapidxml::parse_strip_xml_namespaces>(begin);
+  *end = after;
+
+  rapidxml::xml_node<>* row = xml.first_node();
+  rapidxml::xml_attribute<>* r = row->first_attribute("r");
+  if (r != NULL)
+    row_ = parseInteger(r->value(), r->value_size());
+  rapidxml::xml_attribute<>* ht = row->first_attribute("ht");
+  if (ht != NULL) {
+    ht_ = ht->value();
+    ht_size_ = ht->value_size();
+  }
+
+  for (rapidxml::xml_node<>* c = row->first_node("c");
+      c; c = c->next_sibling("c")) {
+    cellxml& cell = nextCell();
+    rapidxml::xml_attribute<>* attribute = c->first_attribute("r");
+    if (attribute != NULL) {
+      cell.r_ = attribute->value();
+      cell.r_size_ = attribute->value_size();
+    }
+    attribute = c->first_attribute("s");
+    if (attribute != NULL)
+      cell.s_ = parseInteger(attribute->value(), attribute->value_size());
+    attribute = c->first_attribute("t");
+    if (attribute != NULL)
+      cell.t_ = attribute->value_size() == 0
+        ? xml_type::UNKNOWN
+        : xmlType(attribute->value(), attribute->value_size());
+    rapidxml::xml_node<>* v = c->first_node("v");
+    if (v != NULL) {
+      cell.v_ = v->value();
+      cell.v_size_ = v->value_size();
+    }
+    cell.is_node_ = c->first_node("is");
+    rapidxml::xml_node<>* f = c->first_node("f");
+    if (f != NULL) {
+      cell.has_f_ = true;
+      cell.f_ = f->value();
+      cell.f_size_ = f->value_size();
+      attribute = f->first_attribute("t");
+      cell.f_array_ = attribute != NULL
+        && nameIs(attribute->value(), attribute->value_size(), "array");
+      attribute = f->first_attribute("ref");
+      if (attribute != NULL) {
+        cell.ref_ = attribute->value();
+        cell.ref_size_ = attribute->value_size();
+      }
+      attribute = f->first_attribute("si");
+      if (attribute != NULL)
+        cell.si_ = parseInteger(attribute->value(), attribute->value_size());
+    }
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef CELLLEXER_
+#define CELLLEXER_
+
+#include <cstddef>
+#include <vector>
+#include "rapidxml.h"
+
+// Type of a cell in the xml, by its t attribute
+enum class xml_type : unsigned char {
+  NUMBER,         // "n", or no t attribute
+  SHARED_STRING,  // "s"
+  FORMULA_STRING, // "str"
+  BOOLEAN,        // "b"
+  ERROR,          // "e"
+  DATE,           // "d", ISO8601
+  INLINE_STRING,  // "inlineStr"
+  UNKNOWN
+};
+
+// The parts of a <c> element that xlsxcell uses.  Text isn't nul-terminated.
+// It points into the xml, and is only valid until the next row is lexed.
+struct cellxml {
+  const char* r_;     // NULL if there isn't an r attribute
+  size_t r_size_;
+  int s_;             // style, 0 if there isn't one
+  xml_type t_;
+  char* v_;           // NULL if there isn't a <v>
+  size_t v_size_;
+  char* is_;          // the whole <is> element, NULL if there isn't one
+  size_t is_size_;
+  rapidxml::xml_node<>* is_node_; // instead of is_, when parsed by rapidxml
+  bool has_f_;
+  bool f_array_;      // t="array"
+  char* f_;           // the formula, empty if it is inherited
+  size_t f_size_;
+  const char* ref_;   // NULL if there isn't a ref attribute
+  size_t ref_size_;
+  int si_;            // -1 if there isn't an si attribute
+};
+
+// Lexes the <row> elements of a worksheet, in the grammar that Excel and
+// other writers use, into a row number, a height and the parts of each cell,
+// in one forward pass over the bytes.  Nothing is allocated once the vector of
+// cells has grown to the width of the sheet.
+//
+// This does the work of rapidxml and of looking up each attribute and child by
+// name, which is the innermost loop of xlsx_cells().  Constructs that are rare
+// in worksheets, such as comments, CDATA and processing instructions, make
+// lex() give up on the row without having modified it, so that rapidxml can
+// parse it instead, by parse().  Namespace prefixes are ignored, and
+// elements that aren't needed, such as <extLst>, are skipped.
+
+class celllexer {
+
+  public:
+
+    int row_;            // the r attribute, 0 if there isn't one
+    const char* ht_;     // the ht attribute, NULL if there isn't one
+    size_t ht_size_;
+    std::vector<cellxml> cells_; // only the first size_ are of this row
+    size_t size_;
+
+    celllexer();
+
+    // Lexes the one <row> element in [begin, end), and decodes the entities
+    // of its values and formulas in place.  Returns false, without having
+    // modified anything, if the row needs rapidxml.
+    bool lex(char* begin, char* end);
+
+    // Lexes only the start tag of the <row>, into row_ and ht_, for when the
+    // cells aren't wanted.  Returns false if the row needs rapidxml.
+    bool lexRow(char* begin, char* end);
+
+    // Parses the <row> in [begin, end) with rapidxml instead, into xml, which
+    // must outlive the cells
+    void parse(char* begin, char* end, rapidxml::xml_document<>& xml);
+
+  private:
+
+    // Lexes the <row> start tag after p, leaving p after it.  Returns 1 if the
+    // row is empty, 0 if it has content, and -1 if it needs rapidxml.
+    int lexStartTag(char*& p, char* end);
+    bool lexCell(char*& p, char* end, cellxml& cell);
+    cellxml& nextCell();
+
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "commenttable.h"
+#include "address.h"
+
+commenttable::commenttable(): mask_(0) {}
+
+void commenttable::add(int row, int col, const std::string& text) {
+  comment c = {packAddress(row, col), text};
+  comments_.push_back(c);
+}
+
+// Multiplicative (Fibonacci) hashing, taking the high bits, which depend on
+// both the row and the column
+size_t commenttable::slot(uint64_t key) const {
+  return ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+}
+
+void commenttable::index() {
+  if (comments_.empty())
+    return;
+
+  // In address order.  When a cell has more than one comment, the last one
+  // wins, as it did when the comments were kept in a std::map.
+  std::stable_sort(comments_.begin(), comments_.end(),
+                   [](const comment& a, const comment& b) {
+                     return a.key_ < b.key_;
+                   });
+  size_t n = 0;
+  for (size_t k = 0; k < comments_.size(); ++k) {
+    if (n > 0 && comments_[n - 1].key_ == comments_[k].key_) {
+      comments_[n - 1].text_.swap(comments_[k].text_);
+    } else {
+      if (n != k)
+        comments_[n] = std::move(comments_[k]);
+      ++n;
+    }
+  }
+  comments_.resize(n);
+
+  // At most half full, so that probes are short
+  size_t size = 1;
+  while (size < 2 * n)
+    size <<= 1;
+  slots_.assign(size, -1);
+  mask_ = size - 1;
+  for (size_t k = 0; k < n; ++k) {
+    size_t s = slot(comments_[k].key_);
+    while (slots_[s] != -1)
+      s = (s + 1) & mask_;
+    slots_[s] = k;
+  }
+}
+
+int commenttable::find(int row, int col) const {
+  if (slots_.empty())
+    return -1;
+  uint64_t key = packAddress(row, col);
+  for (size_t s = slot(key); slots_[s] != -1; s = (s + 1) & mask_) {
+    if (comments_[slots_[s]].key_ == key)
+      return slots_[s];
+  }
+  return -1;
+}
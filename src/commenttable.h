@@ -0,0 +1,52 @@
+#ifndef COMMENTTABLE_
+#define COMMENTTABLE_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// The comments of a sheet, looked up by the row and column of a cell.
+//
+// The comments are kept in a vector in the order of their addresses, and
+// found by an open-addressing hash table of their positions in the vector,
+// keyed by the packed address.  Nothing is allocated for a sheet without
+// comments, and find() returns at once.
+//
+// Add the comments, then call index() before finding any.  The table isn't
+// modified by find(), so several threads can look up comments at once.
+
+class commenttable {
+
+  public:
+
+    commenttable();
+
+    void add(int row, int col, const std::string& text);
+    void index(); // sorts the comments and builds the hash table
+
+    bool empty() const { return comments_.empty(); }
+    size_t size() const { return comments_.size(); }
+
+    // Position of the comment on a cell, or -1 if there isn't one
+    int find(int row, int col) const;
+
+    int row(size_t k) const { return comments_[k].key_ >> 32; }
+    int col(size_t k) const { return comments_[k].key_ & 0xFFFFFFFF; }
+    const std::string& text(size_t k) const { return comments_[k].text_; }
+
+  private:
+
+    struct comment {
+      uint64_t key_;      // packed address
+      std::string text_;
+    };
+
+    std::vector<comment> comments_; // in address order, once indexed
+    std::vector<int> slots_;        // positions in comments_, -1 if empty
+    uint64_t mask_;                 // slots_.size() - 1, a power of two
+
+    size_t slot(uint64_t key) const;
+
+};
+
+#endif
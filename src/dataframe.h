@@ -0,0 +1,21 @@
+#ifndef TIDYXL_DATAFRAME_
+#define TIDYXL_DATAFRAME_
+
+#include <Rcpp.h>
+
+// Turn a list of vectors of n elements into a tibble without checking
+// anything.  The row names c(NA_integer_, -n) are R's compact form of the
+// automatic row names 1:n, which R recognises by the NA and expands when they
+// are asked for, so they aren't stored.  The list is modified in place.
+inline Rcpp::List dataFrame(Rcpp::List out, int n) {
+  out.attr("class") = Rcpp::CharacterVector::create("tbl_df", "tbl", "data.frame");
+  out.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -n);
+  return out;
+}
+
+// With as many rows as the first vector has elements
+inline Rcpp::List dataFrame(Rcpp::List out) {
+  return dataFrame(out, Rf_length(out[0]));
+}
+
+#endif
@@ -25,18 +25,30 @@ inline double dateRound(double date) {
 // How we address this: If date is *prior* to the non-existent leap day: add a
 // day If date is on the non-existent leap day: make negative and, in due
 // course, NA Otherwise: do nothing
-inline double checkDate(double& date, int& dateSystem, int& dateOffset, std::string ref) {
+// This version doesn't call R, so that it can be used by worker threads.  The
+// warning is appended to warnings, to be given later on the main thread.
+inline double checkDate(double& date, int& dateSystem, int& dateOffset,
+                        const std::string& ref,
+                        std::vector<std::string>& warnings) {
   if (dateSystem == 1900 && date < 61) {
     date = (date < 60) ? date + 1 : -1;
   }
   if (date < 0) {
-    Rcpp::warning("NA inserted for impossible 1900-02-29 datetime: " + ref);
+    warnings.push_back("NA inserted for impossible 1900-02-29 datetime: " + ref);
     return NA_REAL;
   } else {
     return dateRound((date - dateOffset) * 86400);
   }
 }
 
+inline double checkDate(double& date, int& dateSystem, int& dateOffset, std::string ref) {
+  std::vector<std::string> warnings;
+  double out = checkDate(date, dateSystem, dateOffset, ref, warnings);
+  if (!warnings.empty())
+    Rcpp::warning(warnings[0]);
+  return out;
+}
+
 // Convert datetime doubles to strings "%Y-%m-%d %H:%M:%S"
 // TODO: Support subseconds
 inline std::string formatDate(double& date, int& dateSystem, int& dateOffset) {
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstdlib>
+#include "dimensions.h"
+
+dimensions::dimensions(double default_size): default_(default_size) {}
+
+void dimensions::add(int first, int last, double size) {
+  if (last < first)
+    return;
+  if (!runs_.empty()) {
+    run& previous = runs_.back();
+    if (previous.last_ + 1 == first && previous.size_ == size) {
+      previous.last_ = last;
+      return;
+    }
+  }
+  run r = {first, last, size};
+  runs_.push_back(r);
+}
+
+void dimensions::append(const dimensions& other) {
+  for (std::vector<run>::const_iterator it = other.runs_.begin();
+      it != other.runs_.end(); ++it) {
+    add(it->first_, it->last_, it->size_);
+  }
+}
+
+void dimensions::index() {
+  bool ordered = true;
+  for (size_t k = 1; k < runs_.size() && ordered; ++k)
+    ordered = runs_[k - 1].last_ < runs_[k].first_;
+  if (ordered)
+    return;
+
+  // Paint each run over the ones before it, so that later runs win where they
+  // overlap, as they did when every size was stored
+  std::vector<run> runs;
+  for (std::vector<run>::iterator it = runs_.begin(); it != runs_.end(); ++it) {
+    std::vector<run> painted;
+    for (std::vector<run>::iterator old = runs.begin(); old != runs.end(); ++old) {
+      if (old->last_ < it->first_ || old->first_ > it->last_) {
+        painted.push_back(*old);
+        continue;
+      }
+      if (old->first_ < it->first_) {
+        run before = {old->first_, it->first_ - 1, old->size_};
+        painted.push_back(before);
+      }
+      if (old->last_ > it->last_) {
+        run after = {it->last_ + 1, old->last_, old->size_};
+        painted.push_back(after);
+      }
+    }
+    painted.push_back(*it);
+    std::sort(painted.begin(), painted.end(),
+              [](const run& a, const run& b) { return a.first_ < b.first_; });
+    runs.swap(painted);
+  }
+  runs_.swap(runs);
+}
+
+double dimensions::operator[](int i) const {
+  // The last run that starts at or before i
+  std::vector<run>::const_iterator it =
+    std::upper_bound(runs_.begin(), runs_.end(), i,
+                     [](int i, const run& r) { return i < r.first_; });
+  if (it == runs_.begin())
+    return default_;
+  --it;
+  return i <= it->last_ ? it->size_ : default_;
+}
+
+void cacheDefaultDims(rapidxml::xml_node<>* worksheet,
+                      double& height, double& width) {
+  rapidxml::xml_node<>* sheetFormatPr_ = worksheet->first_node("sheetFormatPr");
+
+  if (sheetFormatPr_ != NULL) {
+    // Don't use utils::getAttributeValueDouble because it might overwrite the
+    // default value with NA_REAL.
+    rapidxml::xml_attribute<>* defaultRowHeight =
+      sheetFormatPr_->first_attribute("defaultRowHeight");
+    if (defaultRowHeight != NULL)
+      height = strtod(defaultRowHeight->value(), NULL);
+
+    rapidxml::xml_attribute<>*defaultColWidth =
+      sheetFormatPr_->first_attribute("defaultColWidth");
+    if (defaultColWidth != NULL) {
+      width = strtod(defaultColWidth->value(), NULL);
+    } else {
+      // If defaultColWidth not given, ECMA says you can work it out based on
+      // baseColWidth, but that isn't necessarily given either, and the formula
+      // is wrong because the reality is so complicated, see
+      // https://support.microsoft.com/en-gb/kb/214123.
+      width = 8.38;
+    }
+  }
+}
+
+void cacheColWidths(rapidxml::xml_node<>* worksheet, dimensions& widths) {
+  rapidxml::xml_node<>* cols = worksheet->first_node("cols");
+  if (cols == NULL)
+    return; // No custom widths
+
+  for (rapidxml::xml_node<>* col = cols->first_node("col");
+      col; col = col->next_sibling("col")) {
+    // <col> applies to columns from a min to a max
+    int min = strtol(col->first_attribute("min")->value(), NULL, 10);
+    int max = strtol(col->first_attribute("max")->value(), NULL, 10);
+    double width = strtod(col->first_attribute("width")->value(), NULL);
+    widths.add(min, max, width);
+  }
+  widths.index();
+}
@@ -0,0 +1,45 @@
+#ifndef DIMENSIONS_
+#define DIMENSIONS_
+
+#include <vector>
+#include "rapidxml.h"
+
+// The heights of the rows, or the widths of the columns, of a sheet: a
+// default, and runs of consecutive rows or columns of a custom size.  Only the
+// custom sizes are stored, so a sheet costs nothing for the million rows and
+// sixteen thousand columns that it could have.  Looking up a size is a binary
+// search of the runs.
+
+class dimensions {
+
+  public:
+
+    struct run {
+      int first_; // one-based
+      int last_;
+      double size_;
+    };
+
+    double default_;
+    std::vector<run> runs_; // in order, not overlapping, once indexed
+
+    dimensions(double default_size = 0);
+
+    // Runs are usually added in order, and adjacent runs of the same size are
+    // merged.
+    void add(int first, int last, double size);
+    void append(const dimensions& other); // the runs of other, after these
+    void index(); // sorts runs not added in order; later runs win overlaps
+
+    double operator[](int i) const; // size of row or column i
+
+};
+
+// The defaults given by <sheetFormatPr>, if any
+void cacheDefaultDims(rapidxml::xml_node<>* worksheet,
+                      double& height, double& width);
+
+// The custom widths given by <cols>
+void cacheColWidths(rapidxml::xml_node<>* worksheet, dimensions& widths);
+
+#endif
@@ -0,0 +1,409 @@
+#include <cstring>
+#include <stdexcept>
+#include "inflater.h"
+
+// Based on the description of the format in RFC 1951, and on the structure of
+// Mark Adler's 'puff' reference decoder in the zlib distribution.
+
+namespace {
+
+// Base values and extra bits of length symbols 257..285
+const uint16_t length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// Base values and extra bits of distance symbols 0..29
+const uint16_t distance_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577};
+const uint8_t distance_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which the code length code lengths are given
+const uint8_t code_length_order[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+const size_t window_size = 32768;
+
+// Tables for computing the CRC eight bytes at a time ('slicing-by-8')
+struct crc_table {
+  uint32_t entries[8][256];
+  crc_table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      }
+      entries[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        uint32_t c = entries[k - 1][i];
+        entries[k][i] = (c >> 8) ^ entries[0][c & 0xFF];
+      }
+    }
+  }
+};
+
+inline uint32_t le32(const unsigned char* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+} // namespace
+
+uint32_t crc32_update(uint32_t crc, const unsigned char* buf, size_t n) {
+  static const crc_table table; // thread-safe initialisation in C++11
+  const uint32_t (*t)[256] = table.entries;
+  crc = ~crc;
+  for (; n >= 8; n -= 8, buf += 8) {
+    uint32_t one = crc ^ le32(buf);
+    uint32_t two = le32(buf + 4);
+    crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+      t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+      t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+      t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+  }
+  for (; n > 0; --n, ++buf) {
+    crc = t[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+inflater::inflater(const unsigned char* in, size_t in_size):
+  source_(NULL),
+  in_(in),
+  in_size_(in_size),
+  in_pos_(0),
+  bitbuf_(0),
+  bitcount_(0),
+  overrun_(0),
+  window_(window_size),
+  total_out_(0),
+  crc_(0),
+  state_(state::HEADER),
+  final_(false),
+  stored_(0),
+  copy_length_(0),
+  copy_distance_(0) {}
+
+inflater::inflater(inflater_source& source):
+  source_(&source),
+  in_(NULL),
+  in_size_(0),
+  in_pos_(0),
+  bitbuf_(0),
+  bitcount_(0),
+  overrun_(0),
+  window_(window_size),
+  total_out_(0),
+  crc_(0),
+  state_(state::HEADER),
+  final_(false),
+  stored_(0),
+  copy_length_(0),
+  copy_distance_(0) {}
+
+bool inflater::done() const {
+  return state_ == state::DONE && copy_length_ == 0;
+}
+
+uint32_t inflater::crc32() const {
+  return crc_;
+}
+
+size_t inflater::total_out() const {
+  return total_out_;
+}
+
+void inflater::fetch() {
+  // Move on to the next block of input, if there is a source of more
+  in_size_ = source_->next(in_);
+  in_pos_ = 0;
+  if (in_size_ == 0)
+    source_ = NULL;
+}
+
+void inflater::refill() {
+  // Top up the bit buffer a byte at a time.  Past the end of the input, pad
+  // with zeros, but remember how many, so that consuming them is an error.
+  while (bitcount_ <= 56) {
+    if (in_pos_ == in_size_ && source_ != NULL)
+      fetch();
+    if (in_pos_ < in_size_) {
+      bitbuf_ |= (uint64_t)in_[in_pos_++] << bitcount_;
+    } else {
+      ++overrun_;
+    }
+    bitcount_ += 8;
+  }
+}
+
+uint32_t inflater::bits(int n) {
+  if (n == 0)
+    return 0;
+  if (bitcount_ < n)
+    refill();
+  uint32_t out = (uint32_t)(bitbuf_ & ((1ULL << n) - 1));
+  bitbuf_ >>= n;
+  bitcount_ -= n;
+  if (bitcount_ < overrun_ * 8)
+    throw std::runtime_error("Invalid zip member: compressed data is truncated");
+  return out;
+}
+
+int inflater::decode(const huffman& h) {
+  if (bitcount_ < 15)
+    refill();
+  uint16_t entry = h.fast[bitbuf_ & ((1 << fast_bits_) - 1)];
+  int length;
+  int symbol;
+  if (entry != 0) {
+    length = entry & 15;
+    symbol = entry >> 4;
+  } else {
+    // Canonical decode a bit at a time, for codes longer than fast_bits_
+    int code = 0;   // bits of the code so far
+    int first = 0;  // first code of this length
+    int index = 0;  // index of the first code of this length in symbol[]
+    symbol = -1;
+    for (length = 1; length <= 15; ++length) {
+      code |= (int)((bitbuf_ >> (length - 1)) & 1);
+      int count = h.count[length];
+      if (code - count < first) {
+        symbol = h.symbol[index + (code - first)];
+        break;
+      }
+      index += count;
+      first += count;
+      first <<= 1;
+      code <<= 1;
+    }
+    if (symbol < 0)
+      throw std::runtime_error("Invalid zip member: bad Huffman code");
+  }
+  bitbuf_ >>= length;
+  bitcount_ -= length;
+  if (bitcount_ < overrun_ * 8)
+    throw std::runtime_error("Invalid zip member: compressed data is truncated");
+  return symbol;
+}
+
+void inflater::build(huffman& h, const uint8_t* lengths, int n, bool allow_incomplete) {
+  std::memset(h.count, 0, sizeof(h.count));
+  for (int i = 0; i < n; ++i)
+    ++h.count[lengths[i]];
+  h.count[0] = 0;
+
+  // Check that the code is neither over-subscribed nor, unless allowed,
+  // incomplete.
+  int left = 1;
+  for (int length = 1; length <= 15; ++length) {
+    left <<= 1;
+    left -= h.count[length];
+    if (left < 0)
+      throw std::runtime_error("Invalid zip member: over-subscribed Huffman code");
+  }
+  if (left > 0 && !allow_incomplete)
+    throw std::runtime_error("Invalid zip member: incomplete Huffman code");
+
+  // Sort the symbols by code
+  uint16_t offsets[16];
+  offsets[1] = 0;
+  for (int length = 1; length < 15; ++length)
+    offsets[length + 1] = offsets[length] + h.count[length];
+  for (int i = 0; i < n; ++i) {
+    if (lengths[i] != 0)
+      h.symbol[offsets[lengths[i]]++] = (uint16_t)i;
+  }
+
+  // Fill the lookup table.  Codes are stored most-significant bit first, but
+  // the bit buffer is read least-significant bit first, so the table is
+  // indexed by the reversed code, repeated for every possible suffix.
+  std::memset(h.fast, 0, sizeof(h.fast));
+  int code = 0;
+  int index = 0;
+  for (int length = 1; length <= fast_bits_; ++length) {
+    for (int k = 0; k < h.count[length]; ++k) {
+      int reversed = 0;
+      for (int b = 0; b < length; ++b)
+        reversed |= ((code >> b) & 1) << (length - 1 - b);
+      uint16_t entry = (uint16_t)(h.symbol[index] << 4 | length);
+      for (int j = reversed; j < (1 << fast_bits_); j += 1 << length)
+        h.fast[j] = entry;
+      ++code;
+      ++index;
+    }
+    code <<= 1;
+  }
+}
+
+void inflater::fixedCodes() {
+  uint8_t lengths[288];
+  int i = 0;
+  for (; i < 144; ++i) lengths[i] = 8;
+  for (; i < 256; ++i) lengths[i] = 9;
+  for (; i < 280; ++i) lengths[i] = 7;
+  for (; i < 288; ++i) lengths[i] = 8;
+  build(lencode_, lengths, 288, false);
+
+  for (i = 0; i < 30; ++i) lengths[i] = 5;
+  build(distcode_, lengths, 30, true);
+}
+
+void inflater::dynamicCodes() {
+  int nlen  = bits(5) + 257;
+  int ndist = bits(5) + 1;
+  int ncode = bits(4) + 4;
+  if (nlen > 286 || ndist > 30)
+    throw std::runtime_error("Invalid zip member: bad dynamic block header");
+
+  uint8_t lengths[286 + 30];
+  std::memset(lengths, 0, 19);
+  for (int i = 0; i < ncode; ++i)
+    lengths[code_length_order[i]] = (uint8_t)bits(3);
+  build(lencode_, lengths, 19, false); // temporarily the code length code
+
+  int i = 0;
+  while (i < nlen + ndist) {
+    int symbol = decode(lencode_);
+    if (symbol < 16) {
+      lengths[i++] = (uint8_t)symbol;
+      continue;
+    }
+    uint8_t length = 0;
+    int repeat;
+    if (symbol == 16) {
+      if (i == 0)
+        throw std::runtime_error("Invalid zip member: repeat with no first length");
+      length = lengths[i - 1];
+      repeat = 3 + bits(2);
+    } else if (symbol == 17) {
+      repeat = 3 + bits(3);
+    } else {
+      repeat = 11 + bits(7);
+    }
+    if (i + repeat > nlen + ndist)
+      throw std::runtime_error("Invalid zip member: too many code lengths");
+    while (repeat--)
+      lengths[i++] = length;
+  }
+
+  if (lengths[256] == 0)
+    throw std::runtime_error("Invalid zip member: no end-of-block code");
+
+  build(lencode_, lengths, nlen, true);
+  build(distcode_, lengths + nlen, ndist, true);
+}
+
+void inflater::header() {
+  final_ = bits(1) == 1;
+  switch (bits(2)) {
+    case 0:
+      // Stored block: skip to a byte boundary, then LEN and its complement
+      bits(bitcount_ % 8);
+      {
+        uint32_t len = bits(16);
+        uint32_t nlen = bits(16);
+        if (len != (~nlen & 0xFFFF))
+          throw std::runtime_error("Invalid zip member: bad stored block length");
+        stored_ = len;
+      }
+      state_ = state::STORED;
+      break;
+    case 1:
+      fixedCodes();
+      state_ = state::HUFFMAN;
+      break;
+    case 2:
+      dynamicCodes();
+      state_ = state::HUFFMAN;
+      break;
+    default:
+      throw std::runtime_error("Invalid zip member: bad block type");
+  }
+}
+
+inline void inflater::emit(unsigned char c) {
+  window_[total_out_ & (window_size - 1)] = c;
+  ++total_out_;
+}
+
+size_t inflater::read(char* out, size_t n) {
+  size_t produced = 0;
+  while (produced < n) {
+    if (copy_length_ > 0) {
+      // Finish a back-reference before decoding anything else
+      size_t k = copy_length_ < n - produced ? copy_length_ : n - produced;
+      for (size_t j = 0; j < k; ++j) {
+        unsigned char c =
+          window_[(total_out_ - copy_distance_) & (window_size - 1)];
+        emit(c);
+        out[produced++] = (char)c;
+      }
+      copy_length_ -= k;
+      continue;
+    }
+
+    if (state_ == state::HUFFMAN) {
+      int symbol = decode(lencode_);
+      if (symbol < 256) {
+        emit((unsigned char)symbol);
+        out[produced++] = (char)symbol;
+      } else if (symbol == 256) {
+        state_ = final_ ? state::DONE : state::HEADER;
+      } else {
+        symbol -= 257;
+        if (symbol >= 29)
+          throw std::runtime_error("Invalid zip member: bad length symbol");
+        size_t length = length_base[symbol] + bits(length_extra[symbol]);
+        int dsymbol = decode(distcode_);
+        if (dsymbol >= 30)
+          throw std::runtime_error("Invalid zip member: bad distance symbol");
+        size_t distance = distance_base[dsymbol] + bits(distance_extra[dsymbol]);
+        if (distance > total_out_)
+          throw std::runtime_error("Invalid zip member: distance too far back");
+        copy_length_ = length;
+        copy_distance_ = distance;
+      }
+    } else if (state_ == state::STORED) {
+      if (stored_ == 0) {
+        state_ = final_ ? state::DONE : state::HEADER;
+        continue;
+      }
+      if (bitcount_ >= 8) {
+        // Bytes already in the bit buffer come first
+        unsigned char c = (unsigned char)bits(8);
+        emit(c);
+        out[produced++] = (char)c;
+        --stored_;
+        continue;
+      }
+      if (in_pos_ == in_size_ && source_ != NULL)
+        fetch();
+      size_t k = stored_ < n - produced ? stored_ : n - produced;
+      if (k > in_size_ - in_pos_)
+        k = in_size_ - in_pos_;
+      if (k == 0)
+        throw std::runtime_error("Invalid zip member: compressed data is truncated");
+      for (size_t j = 0; j < k; ++j) {
+        unsigned char c = in_[in_pos_ + j];
+        emit(c);
+        out[produced++] = (char)c;
+      }
+      in_pos_ += k;
+      stored_ -= k;
+    } else if (state_ == state::HEADER) {
+      header();
+    } else { // state::DONE
+      break;
+    }
+  }
+  crc_ = crc32_update(crc_, (const unsigned char*)out, produced);
+  return produced;
+}
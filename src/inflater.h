@@ -0,0 +1,95 @@
+#ifndef INFLATER_
+#define INFLATER_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A decoder for raw DEFLATE streams (RFC 1951), which is how the members of
+// an xlsx (zip) archive are usually compressed.
+//
+// The decoder pulls from a compressed buffer already in memory, or from an
+// inflater_source a block at a time, and writes to whatever buffer the caller
+// provides, so a member can be decompressed either all at once or a chunk at a
+// time.  Back-references are resolved from a 32K window of recent output, so
+// the caller never needs to keep more than one chunk of output.
+//
+// It doesn't touch R, so errors are thrown as std::runtime_error.
+
+// Supplies compressed data to an inflater a block at a time
+class inflater_source {
+
+  public:
+
+    virtual ~inflater_source() {}
+
+    // Point data at the next block, returning its size, or 0 at the end
+    virtual size_t next(const unsigned char*& data) = 0;
+};
+
+class inflater {
+
+  public:
+
+    inflater(const unsigned char* in, size_t in_size);
+    inflater(inflater_source& source);
+
+    // Decompress up to n bytes into out, returning the number of bytes
+    // written, which is less than n only at the end of the stream.
+    size_t read(char* out, size_t n);
+
+    bool done() const;
+    uint32_t crc32() const;        // CRC-32 of the output so far
+    size_t total_out() const;      // bytes of output so far
+
+  private:
+
+    // Canonical Huffman code, with a lookup table for codes of up to
+    // fast_bits_ bits, and a slower canonical decode for longer ones.
+    struct huffman {
+      uint16_t count[16];          // number of codes of each length
+      uint16_t symbol[288];        // symbols ordered by code
+      uint16_t fast[1 << 10];      // symbol << 4 | length, 0 for long codes
+    };
+
+    static const int fast_bits_ = 10;
+
+    enum class state {HEADER, STORED, HUFFMAN, DONE};
+
+    inflater_source* source_;      // NULL once exhausted, or if none
+    const unsigned char* in_;
+    size_t in_size_;
+    size_t in_pos_;
+
+    uint64_t bitbuf_;
+    int bitcount_;
+    int overrun_;                  // bytes of zero padding past the input
+
+    std::vector<unsigned char> window_;
+    size_t total_out_;
+    uint32_t crc_;
+
+    state state_;
+    bool final_;                   // whether the current block is the last
+    size_t stored_;                // bytes left in a stored block
+    size_t copy_length_;           // bytes left to copy from the window
+    size_t copy_distance_;
+
+    huffman lencode_;              // literal/length code
+    huffman distcode_;             // distance code
+
+    void fetch();
+    void refill();
+    uint32_t bits(int n);
+    int decode(const huffman& h);
+    void build(huffman& h, const uint8_t* lengths, int n, bool allow_incomplete);
+    void fixedCodes();
+    void dynamicCodes();
+    void header();
+    void emit(unsigned char c);
+};
+
+// CRC-32 (ISO 3309) of a buffer, continuing from a previous value.
+uint32_t crc32_update(uint32_t crc, const unsigned char* buf, size_t n);
+
+#endif
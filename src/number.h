@@ -0,0 +1,142 @@
+#ifndef NUMBER_
+#define NUMBER_
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+
+// Decoding of the numbers in cell values and attributes, straight from the
+// characters of the xml, without copying them into a std::string first.
+//
+// parseNumber() gives exactly the double that strtod() would.  Numbers in
+// worksheets, such as 42, 1234.56 or 0.30000000000000004, have at most 19
+// significant digits, which fit a 64-bit integer.  When the integer is at most
+// 2^53 and the power of ten is exact in a double, the number is the integer
+// multiplied or divided by the power of ten, which is correctly rounded,
+// because both are exact and IEEE arithmetic rounds once (Clinger's fast
+// path).  Otherwise, such as for the 17 significant digits that Excel writes
+// for the results of many formulas, parseDecimal() does it with integer
+// arithmetic.  Anything else is given to strtod().  Parsing doesn't depend on
+// the locale.
+//
+// parseInteger() is for shared string indices, style ids and booleans, which
+// are plain digits.
+
+// Like strtol(x, NULL, 10) on x[0, n): optional sign, then digits, ignoring
+// anything after them.  0 if there aren't any digits.
+inline long parseInteger(const char* x, size_t n) {
+  size_t k = 0;
+  bool negative = false;
+  if (k < n && (x[k] == '-' || x[k] == '+')) {
+    negative = x[k] == '-';
+    ++k;
+  }
+  unsigned long out = 0;
+  for (; k < n && (unsigned)(x[k] - '0') < 10u; ++k)
+    out = 10 * out + (x[k] - '0');
+  return negative ? -(long)out : (long)out;
+}
+
+// strtod() of a copy of x[0, n), which needn't be nul-terminated
+inline double parseNumberSlowly(const char* x, size_t n) {
+  char buffer[64];
+  if (n < sizeof(buffer)) {
+    for (size_t k = 0; k < n; ++k)
+      buffer[k] = x[k];
+    buffer[n] = '\0';
+    return std::strtod(buffer, NULL);
+  }
+  std::string copy(x, n);
+  return std::strtod(copy.c_str(), NULL);
+}
+
+// The range of powers of ten that parseDecimal() can do
+const int MIN_POWER_OF_FIVE = -100;
+const int MAX_POWER_OF_FIVE = 100;
+
+// w * 10^q correctly rounded, for a w of at least 1, without any floating point
+// arithmetic (the Eisel-Lemire algorithm).  Returns false if it can't be sure
+// of rounding correctly, or the number is subnormal, infinite or out of range.
+bool parseDecimal(uint64_t w, int q, double& out);
+
+// Whether arithmetic on doubles is done in double precision.  Extended
+// precision (e.g. x87) would round twice, so the fast path isn't exact.
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+const bool EXACT_DOUBLES = false;
+#else
+const bool EXACT_DOUBLES = true;
+#endif
+
+// Like strtod(x, NULL) on x[0, n)
+inline double parseNumber(const char* x, size_t n) {
+  // Powers of ten that are exact in a double
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char* p = x;
+  const char* end = x + n;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+
+  // The significant digits as an integer, and the power of ten to scale it by
+  uint64_t mantissa = 0;
+  int digits = 0;      // significant digits, after any leading zeros
+  int exponent = 0;
+  bool any = false;    // whether there are any digits at all
+  for (; p < end && (unsigned)(*p - '0') < 10u; ++p) {
+    any = true;
+    if (mantissa == 0 && *p == '0')
+      continue;
+    mantissa = 10 * mantissa + (*p - '0');
+    ++digits;
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && (unsigned)(*p - '0') < 10u; ++p) {
+      any = true;
+      --exponent;
+      if (mantissa == 0 && *p == '0')
+        continue;
+      mantissa = 10 * mantissa + (*p - '0');
+      ++digits;
+    }
+  }
+  if (!any || digits > 19)
+    return parseNumberSlowly(x, n);
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negative_exponent = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative_exponent = *p == '-';
+      ++p;
+    }
+    if (p == end || (unsigned)(*p - '0') >= 10u)
+      return parseNumberSlowly(x, n);
+    int e = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10u; ++p) {
+      if (e < 10000)
+        e = 10 * e + (*p - '0');
+    }
+    exponent += negative_exponent ? -e : e;
+  }
+  if (p != end)
+    return parseNumberSlowly(x, n); // e.g. "inf", "0x1p3" or trailing junk
+
+  double out;
+  if (mantissa == 0) {
+    out = 0;
+  } else if (EXACT_DOUBLES && mantissa <= ((uint64_t)1 << 53)
+             && exponent >= -22 && exponent <= 22) {
+    out = (double)mantissa;
+    out = exponent < 0 ? out / powers[-exponent] : out * powers[exponent];
+  } else if (!parseDecimal(mantissa, exponent, out)) {
+    return parseNumberSlowly(x, n);
+  }
+  return negative ? -out : out;
+}
+
+#endif
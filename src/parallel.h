@@ -0,0 +1,165 @@
+#ifndef TIDYXL_PARALLEL_
+#define TIDYXL_PARALLEL_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <Rcpp.h>
+
+// Runs independent tasks, such as parsing each worksheet, on a pool of
+// threads.  R isn't thread-safe, so the tasks mustn't call R at all, not even
+// to check for interrupts or give warnings.  Instead, tasks call
+// checkInterrupt() every so often, and the main thread waits for them,
+// checking for interrupts from R on their behalf.
+//
+// Exceptions thrown by tasks are rethrown on the main thread once every thread
+// has stopped, so that R can turn them into errors.  If several tasks fail,
+// the exception of the first task (in the order of the tasks) is rethrown.
+//
+// With only one thread, the tasks are run in order on the calling thread, and
+// checkInterrupt() checks R directly.
+//
+// A task can run tasks of its own on a nested pool, constructed with the pool
+// that is running the task as its parent.  The nested pool then waits on the
+// parent's behalf, checking for interrupts by calling the parent's
+// checkInterrupt() rather than R.
+
+class parallel {
+
+  public:
+
+    parallel(int threads, parallel* parent = NULL):
+      threads_(threads), parent_(parent), serial_(true), cancelled_(false) {}
+
+    // Call this from within tasks.  Stops the task if the user has interrupted,
+    // or if another task has failed.
+    void checkInterrupt() {
+      if (!serial_) {
+        if (cancelled_)
+          throw cancelled();
+      } else if (parent_ != NULL) {
+        parent_->checkInterrupt();
+      } else {
+        Rcpp::checkUserInterrupt();
+      }
+    }
+
+    // Run task(k) for each k from 0 to n - 1
+    template <typename Task>
+    void run(size_t n, Task task);
+
+    // Run task(b, first, last) for each block b of the items from 0 to n - 1,
+    // the items of the block being [first, last).  Items such as the formulas
+    // of a workbook are too small to be worth handing to a thread one at a
+    // time.  Blocks are numbered in the order of the items, so results that
+    // are kept per block can be concatenated in order afterwards.  Interrupts
+    // are checked after each block.
+    template <typename Task>
+    void runBlocks(size_t n, Task task);
+
+    // The number of blocks that runBlocks() divides n items into
+    static size_t blockCount(size_t n) {
+      return (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+  private:
+
+    struct cancelled {}; // not a std::exception, so it isn't mistaken for one
+
+    enum { BLOCK_SIZE = 1000 }; // items per block of runBlocks()
+
+    int threads_;
+    parallel* parent_;
+    bool serial_;
+    std::atomic<bool> cancelled_;
+
+};
+
+template <typename Task>
+void parallel::run(size_t n, Task task) {
+  size_t threads = threads_ < 1 ? 1 : threads_;
+  if (threads > n)
+    threads = n;
+  serial_ = threads <= 1;
+  if (serial_) {
+    for (size_t k = 0; k < n; ++k)
+      task(k);
+    return;
+  }
+
+  cancelled_ = false;
+  std::atomic<size_t> next(0);
+  std::vector<std::exception_ptr> errors(n);
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t running = threads;
+
+  auto work = [&]() {
+    size_t k;
+    while (!cancelled_ && (k = next++) < n) {
+      try {
+        task(k);
+      } catch (cancelled&) {
+      } catch (...) {
+        errors[k] = std::current_exception();
+        cancelled_ = true;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    --running;
+    finished.notify_one();
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < threads; ++t)
+    pool.emplace_back(work);
+
+  // Wait for the threads, checking for interrupts every so often.  The
+  // interrupt can't be allowed to end this function until the threads have
+  // stopped, because they refer to its local variables.
+  std::exception_ptr interrupted;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running > 0) {
+      finished.wait_for(lock, std::chrono::milliseconds(100));
+      if (!interrupted) {
+        try {
+          if (parent_ != NULL) {
+            parent_->checkInterrupt();
+          } else {
+            Rcpp::checkUserInterrupt();
+          }
+        } catch (...) {
+          interrupted = std::current_exception();
+          cancelled_ = true;
+        }
+      }
+    }
+  }
+  for (size_t t = 0; t < threads; ++t)
+    pool[t].join();
+  serial_ = true;
+
+  if (interrupted)
+    std::rethrow_exception(interrupted);
+  for (size_t k = 0; k < n; ++k) {
+    if (errors[k])
+      std::rethrow_exception(errors[k]);
+  }
+}
+
+template <typename Task>
+void parallel::runBlocks(size_t n, Task task) {
+  run(blockCount(n), [&](size_t b) {
+    size_t first = b * BLOCK_SIZE;
+    task(b, first, std::min<size_t>(n, first + BLOCK_SIZE));
+    checkInterrupt();
+  });
+}
+
+#endif
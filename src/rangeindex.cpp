@@ -0,0 +1,124 @@
+#include <algorithm>
+#include "rangeindex.h"
+
+void rangeindex::build(const std::vector<cellrange>& ranges) {
+  ranges_ = ranges;
+  nodes_.clear();
+  roots_.clear();
+  by_first_.clear();
+  by_last_.clear();
+
+  std::vector<std::vector<int> > sheets;
+  for (size_t k = 0; k < ranges_.size(); ++k) {
+    size_t sheet = ranges_[k].sheet_;
+    if (sheet >= sheets.size())
+      sheets.resize(sheet + 1);
+    sheets[sheet].push_back(k);
+  }
+  roots_.resize(sheets.size(), -1);
+  for (size_t sheet = 0; sheet < sheets.size(); ++sheet) {
+    if (!sheets[sheet].empty())
+      roots_[sheet] = grow(sheets[sheet]);
+  }
+}
+
+// Makes a node of the members, with subtrees of any that aren't on its centre,
+// and returns its position in nodes_
+int rangeindex::grow(std::vector<int>& members) {
+  // The centre is the median of the first rows, so that the subtrees are at
+  // most half the size of this one
+  std::vector<int>::iterator median = members.begin() + members.size() / 2;
+  std::nth_element(members.begin(), median, members.end(),
+                   [this](int a, int b) {
+                     return ranges_[a].first_row_ < ranges_[b].first_row_;
+                   });
+  int centre = ranges_[*median].first_row_;
+
+  std::vector<int> above;
+  std::vector<int> below;
+  size_t first = by_first_.size();
+  for (size_t k = 0; k < members.size(); ++k) {
+    const cellrange& range = ranges_[members[k]];
+    if (range.last_row_ < centre) {
+      above.push_back(members[k]);
+    } else if (range.first_row_ > centre) {
+      below.push_back(members[k]);
+    } else {
+      by_first_.push_back(members[k]);
+      by_last_.push_back(members[k]);
+    }
+  }
+  size_t last = by_first_.size();
+  std::sort(by_first_.begin() + first, by_first_.end(),
+            [this](int a, int b) {
+              return ranges_[a].first_row_ < ranges_[b].first_row_;
+            });
+  std::sort(by_last_.begin() + first, by_last_.end(),
+            [this](int a, int b) {
+              return ranges_[a].last_row_ > ranges_[b].last_row_;
+            });
+  std::vector<int>().swap(members);
+
+  int k = nodes_.size();
+  node n = {centre, -1, -1, first, last};
+  nodes_.push_back(n);
+  if (!above.empty()) {
+    int left = grow(above);
+    nodes_[k].left_ = left;
+  }
+  if (!below.empty()) {
+    int right = grow(below);
+    nodes_[k].right_ = right;
+  }
+  return k;
+}
+
+void rangeindex::find(const cellrange& query, std::vector<int>& out) const {
+  if (query.sheet_ < 0 || (size_t)query.sheet_ >= roots_.size())
+    return;
+  int root = roots_[query.sheet_];
+  if (root >= 0)
+    find(root, query, out);
+}
+
+void rangeindex::find(int k, const cellrange& query,
+                      std::vector<int>& out) const {
+  while (k >= 0) {
+    const node& n = nodes_[k];
+    // Every range of the node spans its centre, so only one end of each needs
+    // to be checked against the rows of the query, and the scan can stop at
+    // the first range that misses
+    size_t first = out.size();
+    if (query.last_row_ < n.centre_) {
+      for (size_t i = n.first_; i < n.last_; ++i) {
+        if (ranges_[by_first_[i]].first_row_ > query.last_row_)
+          break;
+        out.push_back(by_first_[i]);
+      }
+      k = n.left_;
+    } else if (query.first_row_ > n.centre_) {
+      for (size_t i = n.first_; i < n.last_; ++i) {
+        if (ranges_[by_last_[i]].last_row_ < query.first_row_)
+          break;
+        out.push_back(by_last_[i]);
+      }
+      k = n.right_;
+    } else {
+      out.insert(out.end(), by_first_.begin() + n.first_,
+                 by_first_.begin() + n.last_);
+      if (n.left_ >= 0)
+        find(n.left_, query, out);
+      k = n.right_;
+    }
+
+    // Then the columns
+    size_t kept = first;
+    for (size_t i = first; i < out.size(); ++i) {
+      const cellrange& range = ranges_[out[i]];
+      if (range.first_col_ <= query.last_col_
+          && range.last_col_ >= query.first_col_)
+        out[kept++] = out[i];
+    }
+    out.resize(kept);
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef RANGEINDEX_
+#define RANGEINDEX_
+
+#include <algorithm>
+#include <vector>
+#include "address.h"
+
+// A rectangle of cells on one sheet.  Sheets are zero-based, rows and columns
+// one-based.  Whole rows and columns are ranges that reach MAX_COL or MAX_ROW.
+struct cellrange {
+  int sheet_;
+  int first_row_;
+  int first_col_;
+  int last_row_;
+  int last_col_;
+};
+
+// One corner of a reference, e.g. "$A$1", "A" or "1".  Returns the end of it.
+inline const char* parseRangeCorner(const char* x, const char* end,
+                                    int& col, int& row) {
+  col = 0;
+  row = 0;
+  if (x < end && *x == '$') ++x;
+  x += parseCol(x, end - x, col);
+  if (x < end && *x == '$') ++x;
+  x += parseRow(x, end - x, row);
+  return x;
+}
+
+// A reference such as "A1", "$A$1:B2", "A:B" (whole columns) or "1:2" (whole
+// rows), in upper case, as a range of cells.  Leaves the sheet alone.
+inline bool parseRange(const char* x, size_t n, cellrange& out) {
+  const char* end = x + n;
+  int col1, row1, col2, row2;
+  x = parseRangeCorner(x, end, col1, row1);
+  bool colon = x < end && *x == ':';
+  if (colon) {
+    x = parseRangeCorner(x + 1, end, col2, row2);
+  } else {
+    col2 = col1;
+    row2 = row1;
+  }
+  if (x != end)
+    return false;
+  if (col1 && row1 && col2 && row2) {
+  } else if (colon && col1 && col2 && !row1 && !row2) {
+    row1 = 1;
+    row2 = MAX_ROW;
+  } else if (colon && row1 && row2 && !col1 && !col2) {
+    col1 = 1;
+    col2 = MAX_COL;
+  } else {
+    return false;
+  }
+  out.first_row_ = std::min(row1, row2);
+  out.first_col_ = std::min(col1, col2);
+  out.last_row_ = std::max(row1, row2);
+  out.last_col_ = std::max(col1, col2);
+  return true;
+}
+
+// Finds the ranges that overlap a given range, e.g. the references that
+// include a cell.
+//
+// The ranges of each sheet are kept in a centred interval tree of their rows.
+// Each node of the tree holds the ranges that span the row at its centre,
+// sorted by their first row and again by their last row, and the ranges that
+// are entirely above or below that row are in the subtrees either side.  A
+// query visits one path down the tree, plus the branches that it overlaps,
+// and only then checks the columns.
+//
+// The index isn't modified by find(), so several threads can query it at
+// once.
+
+class rangeindex {
+
+  public:
+
+    void build(const std::vector<cellrange>& ranges);
+
+    // Appends the positions, in the vector given to build(), of the ranges
+    // that overlap query
+    void find(const cellrange& query, std::vector<int>& out) const;
+
+  private:
+
+    struct node {
+      int centre_;
+      int left_;      // position in nodes_, or -1
+      int right_;
+      size_t first_;  // the ranges of this node are by_first_[first_, last_)
+      size_t last_;   // and by_last_[first_, last_)
+    };
+
+    std::vector<cellrange> ranges_;
+    std::vector<node> nodes_;
+    std::vector<int> roots_;    // by sheet, -1 for a sheet without ranges
+    std::vector<int> by_first_; // positions in ranges_, by first row
+    std::vector<int> by_last_;  // by last row, descending
+
+    int grow(std::vector<int>& members);
+    void find(int k, const cellrange& query, std::vector<int>& out) const;
+
+};
+
+#endif
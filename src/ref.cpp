@@ -1,6 +1,20 @@
 #include "ref.h"
+#include "address.h"
 #include <string>
 
+// One side of a reference, e.g. "$A1", up to any colon.  Returns the end of it.
+static const char* parseCorner(const char* x, const char* end,
+                               bool& fixcol, int& col,
+                               bool& fixrow, int& row) {
+  fixcol = x < end && *x == '$'; // Check for a $ fix symbol
+  if (fixcol) ++x;
+  x += parseCol(x, end - x, col);
+  fixrow = x < end && *x == '$'; // Check for a $ fix symbol
+  if (fixrow) ++x;
+  x += parseRow(x, end - x, row);
+  return x;
+}
+
 ref::ref(const std::string& text): text_(text) {
 
   fixcol1_ = false;
@@ -13,107 +27,44 @@ ref::ref(const std::string& text): text_(text) {
   fixrow2_ = false;
   row2_ = 0;
 
-  std::string::const_iterator iter = text_.begin();
-
-  // Check for a $ fix symbol
-  fixcol1_ = *iter == '$';
-  if (fixcol1_) ++iter;
-
-  if (*iter >= 'A' && *iter <= 'Z') { // If it's a column
-    col1_ = 0;
-    for(iter = iter; (*iter >= 'A' && *iter <= 'Z'); ++iter) {
-      col1_ = 26 * col1_ + (*iter - 'A' + 1); // Multiply existing col by 26 and add new col
-    }
-  }
-
-  // Check for a $ fix symbol
-  fixrow1_ = *iter == '$';
-  if (fixrow1_) ++iter;
-
-  if (*iter >= '0' && *iter <= '9') { // If it's a row
-    row1_ = 0;
-    for(iter = iter; (*iter >= '0' && *iter <= '9'); ++iter) {
-      row1_ = 10 * row1_ + (*iter - '0'); // Multiply existing row by 10 and add new row
-    }
-  }
+  const char* end = text_.data() + text_.size();
+  const char* x = parseCorner(text_.data(), end,
+                              fixcol1_, col1_, fixrow1_, row1_);
 
   // If there's a : range symbol then parse the other side of the range
-  colon_ = *iter == ':';
-  if (colon_) {
-    ++iter;
-    // Check for a $ fix symbol
-    fixcol2_ = *iter == '$';
-    if (fixcol2_) ++iter;
-
-    if (*iter >= 'A' && *iter <= 'Z') { // If it's a column
-      col2_ = 0;
-      for(iter = iter; (*iter >= 'A' && *iter <= 'Z'); ++iter) {
-        col2_ = 26 * col2_ + (*iter - 'A' + 1); // Multiply existing col by 26 and add new col
-      }
-    }
-
-    // Check for a $ fix symbol
-    fixrow2_ = *iter == '$';
-    if (fixrow2_) ++iter;
-
-    if (*iter >= '0' && *iter <= '9') { // If it's a row
-      row2_ = 0;
-      for(iter = iter; (*iter >= '0' && *iter <= '9'); ++iter) {
-        row2_ = 10 * row2_ + (*iter - '0'); // Multiply existing row by 10 and add new row
-      }
-    }
-  }
+  colon_ = x < end && *x == ':';
+  if (colon_)
+    parseCorner(x + 1, end, fixcol2_, col2_, fixrow2_, row2_);
 }
 
-std::string ref::offset(int& rows, int& cols) const {
-  std::string out;
-
+void ref::offset(int rows, int cols, std::string& out) const {
   if (fixcol1_) {
-    out = out + '$';
-    if (col1_) out = out + int_to_alpha(col1_);
+    out += '$';
+    if (col1_) appendCol(col1_, out);
   } else {
-    if (col1_) out = out + int_to_alpha(col1_ + cols);
+    if (col1_) appendCol(col1_ + cols, out);
   }
 
   if (fixrow1_) {
-    out = out + '$';
-    if (row1_) out = out + std::to_string(row1_);
+    out += '$';
+    if (row1_) appendRow(row1_, out);
   } else {
-    if (row1_) out = out + std::to_string(row1_ + rows);
+    if (row1_) appendRow(row1_ + rows, out);
   }
 
-  if (colon_) out = out + ':';
+  if (colon_) out += ':';
 
   if (fixcol2_) {
-    out = out + '$';
-    if (col2_) out = out + int_to_alpha(col2_);
+    out += '$';
+    if (col2_) appendCol(col2_, out);
   } else {
-    if (col2_) out = out + int_to_alpha(col2_ + cols);
+    if (col2_) appendCol(col2_ + cols, out);
   }
 
   if (fixrow2_) {
-    out = out + '$';
-    if (row2_) out = out + std::to_string(row2_);
+    out += '$';
+    if (row2_) appendRow(row2_, out);
   } else {
-    if (row2_) out = out + std::to_string(row2_ + rows);
+    if (row2_) appendRow(row2_ + rows, out);
   }
-
-  return out;
-}
-
-// Adapted from http://blog.bigsmoke.us/2010/12/08/cpp-base10-to-base26
-std::string ref::int_to_alpha(int i) const
-{
-    std::string out;
-    int dividend = i;
-    int modulo;
-
-    while (dividend > 0)
-    {
-        modulo = (dividend - 1) % 26;
-        out = (char)(65 + modulo) + out;
-        dividend = (int)((dividend - modulo) / 26);
-    }
-
-    return out;
 }
@@ -3,7 +3,7 @@
 
 #include <string>
 
-enum class token_type {REF, TEXT, OTHER};
+enum class ref_token_type {REF, TEXT, OTHER};
 
 class ref
 {
@@ -24,10 +24,8 @@ class ref
 
     ref(const std::string& text); // parse text into fix/row/col/colon variables
 
-    virtual std::string offset(int& rows, int& cols) const; // return offsetted address
-
-  private:
-    std::string int_to_alpha(int i) const;
+    // Append the address, offset by rows and cols unless fixed, to out
+    void offset(int rows, int cols, std::string& out) const;
 };
 
 #endif
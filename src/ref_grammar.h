@@ -113,11 +113,11 @@ namespace xlref
   {
     template< typename Input >
       static void apply( const Input & in,
-                         std::vector<token_type> & types,
+                         std::vector<ref_token_type> & types,
                          std::vector<std::string> & tokens,
                          std::vector<ref> & references)
       {
-        types.push_back(token_type::REF);
+        types.push_back(ref_token_type::REF);
         ref reference(in.string());
         references.push_back(reference);
       }
@@ -127,11 +127,11 @@ namespace xlref
   {
     template< typename Input >
       static void apply( const Input & in,
-                         std::vector<token_type> & types,
+                         std::vector<ref_token_type> & types,
                          std::vector<std::string> & tokens,
                          std::vector<ref> & references)
       {
-        types.push_back(token_type::TEXT);
+        types.push_back(ref_token_type::TEXT);
         tokens.push_back(in.string());
       }
   };
@@ -140,11 +140,11 @@ namespace xlref
   {
     template< typename Input >
       static void apply( const Input & in,
-                         std::vector<token_type> & types,
+                         std::vector<ref_token_type> & types,
                          std::vector<std::string> & tokens,
                          std::vector<ref> & references)
       {
-        types.push_back(token_type::OTHER);
+        types.push_back(ref_token_type::OTHER);
         tokens.push_back(in.string());
       }
   };
@@ -0,0 +1,262 @@
+#include <cstring>
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "richtext.h"
+#include "xlsxstyles.h"
+#include "dataframe.h"
+
+using namespace Rcpp;
+
+richtext::richtext() {
+  start_.push_back(0);
+}
+
+void richtext::add(const rapidxml::xml_node<>* string, xlsxstyles& styles) {
+  // A single <t> element is plain text.  Anything else (<r> runs, or a <t>
+  // followed by <r> runs) is a row per element.  The text of the data frame
+  // isn't unescaped, so plain text that contains escapes is kept as a run.
+  const rapidxml::xml_node<>* first = string->first_node();
+  bool plain = first != NULL
+    && first->next_sibling() == NULL
+    && strcmp(first->name(), "t") == 0
+    && strstr(first->value(), "_x") == NULL;
+  plain_.push_back(plain);
+  if (plain) {
+    start_.push_back(character_.size());
+    return;
+  }
+
+  for (const rapidxml::xml_node<>* node = string->first_node();
+       node != NULL;
+       node = node->next_sibling()) {
+
+    int bold(NA_LOGICAL);
+    int italic(NA_LOGICAL);
+    nastring underline;
+    int strike(NA_LOGICAL);
+    nastring vertAlign;
+    double size(NA_REAL);
+    nastring color_rgb;
+    int color_theme(NA_INTEGER);
+    int color_indexed(NA_INTEGER);
+    double color_tint(NA_REAL);
+    nastring font;
+    int family(NA_INTEGER);
+    nastring scheme;
+
+    std::string node_name = node->name();
+    if (node_name == "t") {
+
+      character_.push_back(node->value());
+
+    } else {
+
+      const rapidxml::xml_node<>* t = node->first_node("t");
+      character_.push_back(t != NULL ? t->value() : "");
+      rapidxml::xml_node<>* rPr = node->first_node("rPr");
+
+      if (rPr != NULL) {
+
+        bold = rPr->first_node("b") != NULL;
+        italic = rPr->first_node("i") != NULL;
+
+        rapidxml::xml_node<>* u = rPr->first_node("u");
+        if (u != NULL) {
+          rapidxml::xml_attribute<>* u_val = u->first_attribute("val");
+          if (u_val != NULL) {
+            underline = u_val->value();
+          } else {
+            underline = "single";
+          }
+        }
+
+        strike = rPr->first_node("strike") != NULL;
+
+        rapidxml::xml_node<>* vertAlign_node = rPr->first_node("vertAlign");
+        if (vertAlign_node != NULL) {
+          vertAlign = vertAlign_node->first_attribute("val")->value();
+        }
+
+        rapidxml::xml_node<>* sz = rPr->first_node("sz");
+        if (sz != NULL) {
+          size = strtod(sz->value(), NULL);
+        }
+
+        rapidxml::xml_node<>* color = rPr->first_node("color");
+        if (color != NULL) {
+
+          rapidxml::xml_attribute<>* rgb_attr = color->first_attribute("rgb");
+          if (rgb_attr != NULL) {
+
+            color_rgb = rgb_attr->value();
+
+          } else {
+
+            rapidxml::xml_attribute<>* theme_attr = color->first_attribute("theme");
+            if (theme_attr != NULL) {
+
+              int theme_int = strtol(theme_attr->value(), NULL, 10) + 1;
+              color_rgb = nastring(STRING_ELT(styles.theme_, theme_int - 1));
+              color_theme = theme_int;
+
+              rapidxml::xml_attribute<>* tint_attr = color->first_attribute("tint");
+              if (tint_attr != NULL) {
+                color_tint = strtod(tint_attr->value(), NULL);
+              }
+
+            } else {
+
+              // no known case
+              // # nocov start
+              rapidxml::xml_attribute<>* indexed_attr = color->first_attribute("indexed");
+              if (indexed_attr != NULL) {
+                int indexed_int = strtol(indexed_attr->value(), NULL, 10) + 1;
+                color_rgb = nastring(STRING_ELT(styles.indexed_, indexed_int - 1));
+                color_indexed = indexed_int;
+              }
+              // # nocov end
+
+            }
+          }
+        }
+
+        rapidxml::xml_node<>* rFont = rPr->first_node("rFont");
+        if (rFont != NULL) {
+          font = rFont->first_attribute("val")->value();
+        }
+
+        rapidxml::xml_node<>* family_node = rPr->first_node("family");
+        if (family_node != NULL) {
+          family = strtol(family_node->first_attribute("val")->value(), NULL, 10);
+        }
+
+        rapidxml::xml_node<>* scheme_node = rPr->first_node("scheme");
+        if (scheme_node != NULL) {
+          scheme = scheme_node->first_attribute("val")->value();
+        }
+
+      }
+    }
+
+    bold_.push_back(bold);
+    italic_.push_back(italic);
+    underline_.push_back(underline);
+    strike_.push_back(strike);
+    vertAlign_.push_back(vertAlign);
+    size_.push_back(size);
+    color_rgb_.push_back(color_rgb);
+    color_theme_.push_back(color_theme);
+    color_indexed_.push_back(color_indexed);
+    color_tint_.push_back(color_tint);
+    font_.push_back(font);
+    family_.push_back(family);
+    scheme_.push_back(scheme);
+  }
+  start_.push_back(character_.size());
+}
+
+inline void set_string(CharacterVector& x, int i, const nastring& value) {
+  if (!value.na_)
+    SET_STRING_ELT(x, i, Rf_mkCharCE(value.value_.c_str(), CE_UTF8));
+}
+
+SEXP richtext::formatted(size_t i, const std::string& text) {
+  if (cache_.size() != (int)plain_.size())
+    cache_ = List(plain_.size());
+  SEXP cached = VECTOR_ELT(cache_, i);
+  if (cached != R_NilValue)
+    return cached;
+
+  if (plain_[i]) {
+    SET_VECTOR_ELT(cache_, i, plainFormatted(text));
+    return VECTOR_ELT(cache_, i);
+  }
+
+  size_t start = start_[i];
+  int n = start_[i + 1] - start;
+
+  CharacterVector character(n, NA_STRING);
+  LogicalVector bold(n, NA_LOGICAL);
+  LogicalVector italic(n, NA_LOGICAL);
+  CharacterVector underline(n, NA_STRING);
+  LogicalVector strike(n, NA_LOGICAL);
+  CharacterVector vertAlign(n, NA_STRING);
+  NumericVector size(n, NA_REAL);
+  CharacterVector color_rgb(n, NA_STRING);
+  IntegerVector color_theme(n, NA_INTEGER);
+  NumericVector color_tint(n, NA_REAL);
+  IntegerVector color_indexed(n, NA_INTEGER);
+  CharacterVector font(n, NA_STRING);
+  IntegerVector family(n, NA_INTEGER);
+  CharacterVector scheme(n, NA_STRING);
+
+  for (int j = 0; j < n; ++j) {
+    size_t run = start + j;
+    SET_STRING_ELT(character, j, Rf_mkCharCE(character_[run].c_str(), CE_UTF8));
+    bold[j] = bold_[run];
+    italic[j] = italic_[run];
+    set_string(underline, j, underline_[run]);
+    strike[j] = strike_[run];
+    set_string(vertAlign, j, vertAlign_[run]);
+    size[j] = size_[run];
+    set_string(color_rgb, j, color_rgb_[run]);
+    color_theme[j] = color_theme_[run];
+    color_tint[j] = color_tint_[run];
+    color_indexed[j] = color_indexed_[run];
+    set_string(font, j, font_[run]);
+    family[j] = family_[run];
+    set_string(scheme, j, scheme_[run]);
+  }
+
+  List out = List::create(
+      _["character"] = character,
+      _["bold"] = bold,
+      _["italic"] = italic,
+      _["underline"] = underline,
+      _["strike"] = strike,
+      _["vertAlign"] = vertAlign,
+      _["size"] = size,
+      _["color_rgb"] = color_rgb,
+      _["color_theme"] = color_theme,
+      _["color_indexed"] = color_indexed,
+      _["color_tint"] = color_tint,
+      _["font"] = font,
+      _["family"] = family,
+      _["scheme"] = scheme);
+
+  SET_VECTOR_ELT(cache_, i, dataFrame(out, n));
+  return VECTOR_ELT(cache_, i);
+}
+
+SEXP richtext::plainFormatted(const std::string& text) {
+  if (plain_columns_.size() == 0) {
+    // Create the shared columns of NAs once.  R must copy them before they
+    // are modified.
+    plain_columns_ = List::create(
+        R_NilValue, // character
+        LogicalVector(1, NA_LOGICAL),
+        LogicalVector(1, NA_LOGICAL),
+        CharacterVector(1, NA_STRING),
+        LogicalVector(1, NA_LOGICAL),
+        CharacterVector(1, NA_STRING),
+        NumericVector(1, NA_REAL),
+        CharacterVector(1, NA_STRING),
+        IntegerVector(1, NA_INTEGER),
+        IntegerVector(1, NA_INTEGER),
+        NumericVector(1, NA_REAL),
+        CharacterVector(1, NA_STRING),
+        IntegerVector(1, NA_INTEGER),
+        CharacterVector(1, NA_STRING));
+    plain_columns_.attr("names") = CharacterVector::create(
+        "character", "bold", "italic", "underline", "strike", "vertAlign",
+        "size", "color_rgb", "color_theme", "color_indexed", "color_tint",
+        "font", "family", "scheme");
+    for (int j = 1; j < plain_columns_.size(); ++j) {
+      MARK_NOT_MUTABLE(plain_columns_[j]);
+    }
+  }
+  // Copy only the list, not the columns
+  List out(Rf_shallow_duplicate(plain_columns_));
+  SET_VECTOR_ELT(out, 0, Rf_ScalarString(Rf_mkCharCE(text.c_str(), CE_UTF8)));
+  return dataFrame(out, 1);
+}
@@ -0,0 +1,68 @@
+#ifndef RICHTEXT_
+#define RICHTEXT_
+
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "xlsxstyles.h"
+
+// A string attribute of a run of text, which might be NA
+struct nastring {
+  bool na_;
+  std::string value_;
+  nastring(): na_(true) {}
+  nastring(const char* value): na_(false), value_(value) {}
+  nastring(SEXP value): na_(value == NA_STRING),
+                        value_(na_ ? "" : CHAR(value)) {}
+};
+
+// The inline formatting of the strings table, kept as one flat table of runs
+// of text, in order of the strings, rather than as a data frame per string.
+// The runs of string i are start_[i] to start_[i + 1] - 1.
+//
+// Most strings aren't formatted at all, and have no runs in the table.  Their
+// data frames are built from the text of the string, and columns of NAs that
+// are shared by every such string.
+//
+// Data frames are only built when they are asked for by xlsx_cells(), and are
+// then cached, because cells often share a string.
+
+class richtext {
+
+  public:
+
+    richtext();
+
+    // Parse the runs of an <si> or <is> element, and add them to the table
+    void add(const rapidxml::xml_node<>* string, xlsxstyles& styles);
+
+    // The data frame of runs of string i, whose text is text
+    SEXP formatted(size_t i, const std::string& text);
+
+  private:
+
+    std::vector<size_t> start_;       // first run of each string
+    std::vector<unsigned char> plain_;
+
+    std::vector<std::string> character_;
+    std::vector<int>         bold_;
+    std::vector<int>         italic_;
+    std::vector<nastring>    underline_;
+    std::vector<int>         strike_;
+    std::vector<nastring>    vertAlign_;
+    std::vector<double>      size_;
+    std::vector<nastring>    color_rgb_;
+    std::vector<int>         color_theme_;
+    std::vector<int>         color_indexed_;
+    std::vector<double>      color_tint_;
+    std::vector<nastring>    font_;
+    std::vector<int>         family_;
+    std::vector<nastring>    scheme_;
+
+    Rcpp::List cache_;  // data frames built so far, by string
+    Rcpp::List plain_columns_; // NA columns shared by unformatted strings
+
+    SEXP plainFormatted(const std::string& text);
+
+};
+
+#endif
@@ -1,42 +1,89 @@
+#include <stdexcept>
 #include <Rcpp.h>
 #include "shared_formula.h"
 #include "ref_grammar.h"
 #include "ref.h"
 
+// si is a number of a shared formula within a sheet, so it can't be
+// anywhere near as big as this, unless the file is corrupt
+static const int MAX_SI = 1 << 24;
+
+shared_formula::shared_formula(): defined_(false), row_(0), col_(0) {}
+
 shared_formula::shared_formula(
-    std::string& text,
-    int& row,
-    int& col
-    ): text_(text), row_(row), col_(col) {
-  memory_input<> in_mem(text_, "original-formula");
-  parse< xlref::root, xlref::tokenize >(in_mem, types_, tokens_, refs_);
-}
+    const std::string& text,
+    int row,
+    int col
+    ): defined_(true), row_(row), col_(col) {
+  std::vector<ref_token_type> types;
+  std::vector<std::string> tokens;
+  memory_input<> in_mem(text, "original-formula");
+  parse< xlref::root, xlref::tokenize >(in_mem, types, tokens, refs_);
 
-std::string shared_formula::offset(int& row, int& col) const {
-  std::string out;
+  // Consecutive text tokens are one literal part
+  std::vector<std::string>::const_iterator i_token = tokens.begin();
+  int i_ref = 0;
+  for(std::vector<ref_token_type>::const_iterator i_type = types.begin();
+      i_type != types.end(); ++i_type) {
+    if (*i_type == ref_token_type::REF) {
+      part p = {i_ref++, 0, 0};
+      parts_.push_back(p);
+    } else {
+      if (parts_.empty() || parts_.back().ref_ != -1) {
+        part p = {-1, literals_.size(), 0};
+        parts_.push_back(p);
+      }
+      literals_ += *i_token;
+      parts_.back().length_ += i_token->size();
+      ++i_token;
+    }
+  }
+}
 
+void shared_formula::render(int row, int col, std::string& out) const {
   // Size of offset
   int rows = row - row_;
   int cols = col - col_;
 
-  std::vector<std::string>::const_iterator i_token = tokens_.begin();
-  std::vector<ref>::const_iterator i_ref = refs_.begin();
-
-  for(std::vector<token_type>::const_iterator i_type = types_.begin();
-      i_type != types_.end(); ++i_type) {
-    switch (*i_type) {
-      case token_type::REF:
-        out = out + (*i_ref).offset(rows, cols);
-        ++i_ref;
-        break;
-
-      default:
-        out = out + *i_token;
-        ++i_token;
-        break;
+  out.clear();
+  for (std::vector<part>::const_iterator it = parts_.begin();
+      it != parts_.end(); ++it) {
+    if (it->ref_ == -1) {
+      out.append(literals_, it->start_, it->length_);
+    } else {
+      refs_[it->ref_].offset(rows, cols, out);
     }
   }
+}
 
+std::string shared_formula::offset(int row, int col) const {
+  std::string out;
+  render(row, col, out);
   return out;
 }
 
+const shared_formula* shared_formulas::find(int si) const {
+  if (si < 0 || (size_t)si >= formulas_.size() || !formulas_[si].defined())
+    return NULL;
+  return &formulas_[si];
+}
+
+void shared_formulas::insert(int si, const std::string& text, int row,
+                             int col) {
+  if (si < 0 || si >= MAX_SI)
+    throw std::runtime_error("Invalid shared formula index: "
+                             + std::to_string(si));
+  if ((size_t)si >= formulas_.size())
+    formulas_.resize(si + 1);
+  if (!formulas_[si].defined()) // the first definition wins
+    formulas_[si] = shared_formula(text, row, col);
+}
+
+void shared_formulas::merge(shared_formulas& other) {
+  if (formulas_.size() < other.formulas_.size())
+    formulas_.resize(other.formulas_.size());
+  for (size_t si = 0; si < other.formulas_.size(); ++si) {
+    if (other.formulas_[si].defined() && !formulas_[si].defined())
+      std::swap(formulas_[si], other.formulas_[si]);
+  }
+}
@@ -1,27 +1,58 @@
 #ifndef SHARED_FORMULA_
 #define SHARED_FORMULA_
 
-#include <Rcpp.h>
-#include "ref_grammar.h"
+#include <string>
+#include <vector>
 #include "ref.h"
 
+// A formula that is shared by a block of cells, compiled once into a template
+// of literal text and references.  The formula of each dependent cell is then
+// rendered by copying the literal text and offsetting the references, without
+// parsing the formula again.
+
 class shared_formula {
 
-  std::string text_;
+  // A span of literals_, or a reference if ref_ isn't -1
+  struct part {
+    int ref_;
+    size_t start_;
+    size_t length_;
+  };
+
+  bool defined_;
+  std::string literals_;   // the text between the references
+  std::vector<part> parts_;
+  std::vector<ref> refs_;
 
-  // It's position, from which dependent formulas are offset
+  // Its position, from which dependent formulas are offset
   int row_;
   int col_;
 
-  std::vector<token_type> types_;
-  std::vector<std::string> tokens_;
-  std::vector<ref> refs_;
+  public:
+
+    shared_formula(); // undefined, a placeholder
+    shared_formula(const std::string& text, int row, int col);
+
+    bool defined() const { return defined_; }
+
+    // The formula offset to the cell at row, col, replacing the contents of out
+    void render(int row, int col, std::string& out) const;
+    std::string offset(int row, int col) const;
+};
+
+// The shared formulas of a sheet, or of a chunk of its rows, by the si
+// attribute that numbers them from zero
+class shared_formulas {
+
+  std::vector<shared_formula> formulas_;
 
   public:
 
-    shared_formula(std::string& text, int& row, int& col);
+    // NULL if it hasn't been defined
+    const shared_formula* find(int si) const;
 
-    std::string offset(int& row, int& col) const; // return offsetted address
+    void insert(int si, const std::string& text, int row, int col);
+    void merge(shared_formulas& other); // moves other's formulas into this
 };
 
 #endif
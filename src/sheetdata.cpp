@@ -0,0 +1,97 @@
+#include <iterator>
+#include "sheetdata.h"
+
+cellcolumns::cellcolumns(const std::vector<std::string>& names):
+  names_(names) {
+  bool* flags[] = {
+    &sheet, &address, &row, &col, &is_blank, &data_type, &error, &logical,
+    &numeric, &date, &character, &character_formatted, &formula, &is_array,
+    &formula_ref, &formula_group, &comment, &height, &width, &style_format,
+    &local_format_id};
+  const char* all[] = {
+    "sheet", "address", "row", "col", "is_blank", "data_type", "error",
+    "logical", "numeric", "date", "character", "character_formatted",
+    "formula", "is_array", "formula_ref", "formula_group", "comment", "height",
+    "width", "style_format", "local_format_id"};
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+    *flags[i] = false;
+    for (size_t j = 0; j < names.size(); ++j) {
+      if (names[j] == all[i])
+        *flags[i] = true;
+    }
+  }
+}
+
+sheetdata::sheetdata(size_t shared_count): shared_count_(shared_count) {}
+
+size_t sheetdata::size() const {
+  return row_.size();
+}
+
+void sheetdata::push_back(int row, int col) {
+  row_.push_back(row);
+  col_.push_back(col);
+  is_blank_.push_back(false);
+  data_type_.push_back(cell_type::BLANK);
+  value_.push_back(0);
+  string_.push_back(-1);
+  formula_.push_back(-1);
+  is_array_.push_back(false);
+  formula_ref_.push_back(-1);
+  formula_group_.push_back(-1);
+  comment_.push_back(-1);
+  format_.push_back(0);
+}
+
+int sheetdata::addString(const std::string& x) {
+  strings_.push_back(x);
+  return shared_count_ + strings_.size() - 1;
+}
+
+const std::string& sheetdata::string(
+    const std::vector<std::string>& shared,
+    int index) const {
+  if ((size_t)index < shared_count_)
+    return shared[index];
+  return strings_[index - shared_count_];
+}
+
+// Index of a string of other, once other's strings are appended to strings_
+static void rebase(std::vector<int>& to, const std::vector<int>& from,
+                   size_t shared_count, int offset) {
+  to.reserve(to.size() + from.size());
+  for (std::vector<int>::const_iterator it = from.begin();
+      it != from.end(); ++it) {
+    to.push_back(*it >= 0 && (size_t)*it >= shared_count ? *it + offset : *it);
+  }
+}
+
+template <typename T>
+static void extend(std::vector<T>& to, const std::vector<T>& from) {
+  to.insert(to.end(), from.begin(), from.end());
+}
+
+void sheetdata::append(sheetdata& other) {
+  if (size() == 0 && strings_.empty()) {
+    // Nothing to renumber
+    std::swap(*this, other);
+    return;
+  }
+  int offset = strings_.size();
+  strings_.insert(strings_.end(),
+                  std::make_move_iterator(other.strings_.begin()),
+                  std::make_move_iterator(other.strings_.end()));
+  extend(row_, other.row_);
+  extend(col_, other.col_);
+  extend(is_blank_, other.is_blank_);
+  extend(data_type_, other.data_type_);
+  extend(value_, other.value_);
+  rebase(string_, other.string_, shared_count_, offset);
+  rebase(formula_, other.formula_, shared_count_, offset);
+  extend(is_array_, other.is_array_);
+  rebase(formula_ref_, other.formula_ref_, shared_count_, offset);
+  extend(formula_group_, other.formula_group_);
+  rebase(comment_, other.comment_, shared_count_, offset);
+  extend(format_, other.format_);
+  other = sheetdata(shared_count_);
+}
@@ -0,0 +1,75 @@
+#ifndef SHEETDATA_
+#define SHEETDATA_
+
+#include <string>
+#include <vector>
+
+// Type of the value of a cell, returned in the data_type column
+enum class cell_type : unsigned char {
+  BLANK, CHARACTER, NUMERIC, DATE, LOGICAL, ERROR, DATE_ISO8601, UNKNOWN
+};
+
+// The columns of the data frame returned by xlsx_cells(), and whether each has
+// been asked for.  Work that only matters to columns that haven't been asked
+// for, such as allocating them, looking up comments, offsetting shared
+// formulas and looking up style names, is skipped.
+struct cellcolumns {
+  std::vector<std::string> names_; // asked for, in the order to return them
+  bool sheet, address, row, col, is_blank, data_type, error, logical, numeric,
+       date, character, character_formatted, formula, is_array, formula_ref,
+       formula_group, comment, height, width, style_format, local_format_id;
+
+  cellcolumns(const std::vector<std::string>& names);
+
+  bool anyFormula() const {
+    return formula || is_array || formula_ref || formula_group;
+  }
+};
+
+// The cells of one worksheet, parsed into columns of plain C++ types.  The
+// columns grow as the cells are parsed, and are copied into R vectors by
+// xlsxbook::cacheInformation() once every sheet has been parsed, so that the R
+// vectors can be allocated at exactly the right length.
+//
+// Strings are stored as indices.  An index less than shared_count_ refers to
+// the shared strings table of the workbook.  Higher indices refer to strings_,
+// which holds the strings that are only in this sheet: inline strings, errors,
+// formulas and comments.  -1 means there isn't a string.
+//
+// Height, width and address aren't stored, because they are derived from the
+// row and col columns.
+
+class sheetdata {
+
+  public:
+
+    size_t shared_count_;              // size of the shared strings table
+    std::vector<std::string> strings_; // strings that aren't shared
+
+    std::vector<int>           row_;
+    std::vector<int>           col_;
+    std::vector<unsigned char> is_blank_;
+    std::vector<cell_type>     data_type_;
+    std::vector<double>        value_;         // numeric, date or logical
+    std::vector<int>           string_;        // character or error
+    std::vector<int>           formula_;
+    std::vector<unsigned char> is_array_;
+    std::vector<int>           formula_ref_;
+    std::vector<int>           formula_group_; // -1 if none
+    std::vector<int>           comment_;
+    std::vector<int>           format_;        // index into cellXfs, -1 for
+                                               // comments on blank cells
+
+    sheetdata(size_t shared_count);
+
+    size_t size() const;
+
+    void push_back(int row, int col);     // a blank cell
+    int addString(const std::string& x);  // returns the index of the string
+    void append(sheetdata& other);        // moves the cells of other to the end
+    const std::string& string(const std::vector<std::string>& shared,
+                              int index) const;
+
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "sheetreader.h"
+#include "address.h"
+
+// Amount of xml to inflate at a time
+static const size_t CHUNK = 262144;
+
+sheetreader::sheetreader(
+    const zip_archive& archive,
+    const std::string& sheet_path):
+  stream_(archive, sheet_path),
+  pos_(0),
+  done_(false),
+  first_row_(1),
+  last_row_(MAX_ROW),
+  shared_(false) {
+  // Read up to the start of <sheetData>, skipping the declaration, the start
+  // tag of <worksheet> and anything else that comes first
+  bool closing;
+  size_t lt;
+  while ((lt = find('<', pos_)) != std::string::npos) {
+    if (isTag(lt, "sheetData", closing) && !closing) {
+      size_t gt = skipTag(lt);
+      head_.assign(window_, 0, lt);
+      head_ += "</worksheet>"; // rapidxml doesn't check the name
+      done_ = window_[gt - 2] == '/'; // <sheetData/>
+      pos_ = gt;
+      return;
+    }
+    pos_ = skipTag(lt);
+  }
+  // No <sheetData>, so the whole of the xml is the head
+  head_ = window_;
+  done_ = true;
+}
+
+std::string& sheetreader::head() {
+  return head_;
+}
+
+void sheetreader::setRows(int first_row, int last_row, bool shared) {
+  first_row_ = first_row;
+  last_row_ = last_row;
+  shared_ = shared;
+}
+
+char* sheetreader::nextRow() {
+  if (done_)
+    return NULL;
+  // Discard what has been consumed, so that the window never holds much more
+  // than a chunk and a row
+  window_.erase(0, pos_);
+  pos_ = 0;
+  bool closing;
+  size_t lt;
+  while ((lt = find('<', pos_)) != std::string::npos) {
+    if (isTag(lt, "row", closing) && !closing) {
+      size_t end = skipTag(lt);
+      bool windowed = first_row_ > 1 || last_row_ < MAX_ROW;
+      int row = windowed ? rowNumber(lt, end) : 0;
+      if (row > last_row_)
+        break; // rows are in order, so there are no more in the window
+      if (window_[end - 2] != '/') { // not <row/>
+        // Find the end tag, which is the first one, because rows don't nest
+        size_t close = end;
+        for (;;) {
+          close = find("</", close);
+          if (close == std::string::npos)
+            throw std::runtime_error("Invalid worksheet: unterminated <row>");
+          if (isTag(close, "row", closing))
+            break;
+          close += 2;
+        }
+        end = skipTag(close);
+      }
+      if (row != 0 && row < first_row_ &&
+          !(shared_ && contains(lt, end, "shared"))) {
+        // Skip the row without copying it, discarding it from the window
+        // every so often so that a long run of skipped rows isn't kept
+        pos_ = end;
+        if (pos_ >= CHUNK) {
+          window_.erase(0, pos_);
+          pos_ = 0;
+        }
+        continue;
+      }
+      row_.assign(window_, lt, end - lt);
+      pos_ = end;
+      return &row_[0];
+    }
+    if (isTag(lt, "sheetData", closing) && closing)
+      break;
+    pos_ = skipTag(lt);
+  }
+  // Stop inflating at the end of <sheetData>, or of the window of rows
+  done_ = true;
+  window_.clear();
+  pos_ = 0;
+  return NULL;
+}
+
+bool sheetreader::fill() {
+  size_t size = window_.size();
+  window_.resize(size + CHUNK);
+  size_t n = stream_.read(&window_[size], CHUNK);
+  window_.resize(size + n);
+  return n > 0;
+}
+
+size_t sheetreader::find(char c, size_t from) {
+  for (;;) {
+    size_t found = window_.find(c, from);
+    if (found != std::string::npos)
+      return found;
+    from = window_.size();
+    if (!fill())
+      return std::string::npos;
+  }
+}
+
+size_t sheetreader::find(const char* s, size_t from) {
+  size_t n = strlen(s);
+  for (;;) {
+    size_t found = window_.find(s, from);
+    if (found != std::string::npos)
+      return found;
+    // s might straddle the end of the window
+    if (window_.size() + 1 > from + n)
+      from = window_.size() + 1 - n;
+    if (!fill())
+      return std::string::npos;
+  }
+}
+
+// Whether the window has s at position at, reading more if need be
+bool sheetreader::startsWith(size_t at, const char* s) {
+  size_t n = strlen(s);
+  while (window_.size() < at + n)
+    if (!fill())
+      return false;
+  return window_.compare(at, n, s) == 0;
+}
+
+// Position after the tag (or comment etc.) that starts at lt
+size_t sheetreader::skipTag(size_t lt) {
+  size_t end;
+  if (startsWith(lt, "<!--")) {
+    end = find("-->", lt + 4);
+    if (end != std::string::npos)
+      end += 3;
+  } else if (startsWith(lt, "<![CDATA[")) {
+    end = find("]]>", lt + 9);
+    if (end != std::string::npos)
+      end += 3;
+  } else {
+    // Attribute values can't contain '>' in the xml that Excel writes
+    end = find('>', lt);
+    if (end != std::string::npos)
+      end += 1;
+  }
+  if (end == std::string::npos)
+    throw std::runtime_error("Invalid worksheet: unterminated tag");
+  return end;
+}
+
+// Whether the tag at lt is a start or end tag of the element called name,
+// ignoring any namespace prefix
+bool sheetreader::isTag(size_t lt, const char* name, bool& closing) {
+  size_t start = lt + 1;
+  if (start >= window_.size() && !fill())
+    return false;
+  closing = window_[start] == '/';
+  if (closing)
+    ++start;
+  // Read the whole name, which might be split across chunks
+  size_t end = start;
+  for (;;) {
+    if (end == window_.size() && !fill())
+      return false;
+    char c = window_[end];
+    if (c == '>' || c == '/' || c == ' ' || c == '\t' || c == '\r' ||
+        c == '\n')
+      break;
+    if (c == ':')
+      start = end + 1;
+    ++end;
+  }
+  size_t n = strlen(name);
+  return end - start == n && window_.compare(start, n, name) == 0;
+}
+
+// Whether the window has s between from and to
+bool sheetreader::contains(size_t from, size_t to, const char* s) {
+  const char* x = window_.data();
+  return std::search(x + from, x + to, s, s + strlen(s)) != x + to;
+}
+
+// The r attribute of the start tag of a <row> from lt to gt, or 0 if it
+// hasn't got one.  Attribute values can't contain '>', so the whole tag is in
+// the window already.
+int sheetreader::rowNumber(size_t lt, size_t gt) {
+  const char* x = window_.data();
+  size_t i = lt + 1;
+  while (i < gt && x[i] != ' ' && x[i] != '\t' && x[i] != '\r' &&
+         x[i] != '\n' && x[i] != '>' && x[i] != '/')
+    ++i; // the name of the element
+  for (;;) {
+    while (i < gt && (x[i] == ' ' || x[i] == '\t' || x[i] == '\r' ||
+                      x[i] == '\n'))
+      ++i;
+    if (i >= gt || x[i] == '>' || x[i] == '/')
+      return 0;
+    size_t name = i;
+    while (i < gt && x[i] != '=' && x[i] != ' ')
+      ++i;
+    size_t name_size = i - name;
+    while (i < gt && x[i] != '"' && x[i] != '\'')
+      ++i;
+    if (i >= gt)
+      return 0;
+    char quote = x[i];
+    size_t value = ++i;
+    while (i < gt && x[i] != quote)
+      ++i;
+    if (name_size == 1 && x[name] == 'r') {
+      int row = 0;
+      if (parseRow(x + value, i - value, row) != i - value)
+        return 0;
+      return row;
+    }
+    ++i; // past the closing quote
+  }
+}
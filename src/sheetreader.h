@@ -0,0 +1,67 @@
+#ifndef SHEETREADER_
+#define SHEETREADER_
+
+#include <string>
+#include "zip_archive.h"
+
+// Reads the xml of a worksheet a chunk at a time, and hands out one <row>
+// element at a time, so that only a chunk of the inflated xml, and the row
+// being parsed, are ever in memory however big the sheet is.
+//
+// It is a pull tokenizer, not an xml parser.  It only looks for the start and
+// end tags of <sheetData> and <row>, which don't nest, and leaves rapidxml to
+// parse each row, and the elements before <sheetData>, such as <cols>.
+// Namespace prefixes on element names are ignored.
+//
+// Rows can be limited to a window, by the r attribute of each <row>, so that
+// rows before the window are skipped without being copied or parsed, and
+// nothing is inflated after the last row of the window.
+//
+// It doesn't touch R, so errors are thrown as std::runtime_error.
+
+class sheetreader {
+
+  public:
+
+    sheetreader(const zip_archive& archive, const std::string& sheet_path);
+
+    // The elements before <sheetData>, closed so that rapidxml can parse them
+    std::string& head();
+
+    // Only hands out the rows from first_row to last_row, and before them any
+    // that might define a shared formula, if shared is true, because the
+    // cells in the window might share it.  Rows that lack an r attribute are
+    // always handed out.
+    void setRows(int first_row, int last_row, bool shared);
+
+    // The next <row> element, nul-terminated so that rapidxml can parse it in
+    // place.  NULL after the last row.  Only valid until the next call.
+    char* nextRow();
+
+    // The length of the row that nextRow() last handed out
+    size_t rowSize() const { return row_.size(); }
+
+  private:
+
+    zip_stream stream_;
+    std::string window_;  // inflated xml, consumed up to pos_
+    size_t pos_;
+    bool done_;           // no more rows, so no need to inflate any more
+    std::string head_;
+    std::string row_;
+    int first_row_;
+    int last_row_;
+    bool shared_;         // keep rows before first_row_ with shared formulas
+
+    bool fill();
+    size_t find(char c, size_t from);
+    size_t find(const char* s, size_t from);
+    bool startsWith(size_t at, const char* s);
+    size_t skipTag(size_t lt);
+    bool isTag(size_t lt, const char* name, bool& closing);
+    bool contains(size_t from, size_t to, const char* s);
+    int rowNumber(size_t lt, size_t gt);
+
+};
+
+#endif
@@ -1,156 +1,221 @@
 // [[Rcpp::plugins("cpp11")]]
 
 #include <algorithm>
+#include <map>
+#include <tuple>
 #include <Rcpp.h>
 #include "zip.h"
+#include "xlsxfile.h"
 #include "xlsxnames.h"
 #include "xlsxvalidation.h"
+#include "xlsxdimensions.h"
+#include "xlsxdependencies.h"
+#include "xlsxmodel.h"
 #include "xlsxbook.h"
+#include "shared_formula.h"
 #include "xlsxstyles.h"
 #include "date.h"
+#include "dataframe.h"
 
 using namespace Rcpp;
 
-// This is the entry-point from R into Rcpp.  The main function, xlsx_read_,
-// instantiates the xlsxbook class, and then passes that by reference to one or
-// more xlsxsheet instances, iterating through them and returning a list of
-// 'sheets'.
+// This is the entry-point from R into Rcpp.  xlsx_file_ opens a file once,
+// returning an external pointer to an xlsxfile that the other functions share.
+// xlsx_cells_ instantiates the xlsxbook class, and then passes that by
+// reference to one or more xlsxsheet instances, iterating through them and
+// returning a list of 'sheets'.
+
+// [[Rcpp::export]]
+SEXP xlsx_file_(std::string path) {
+  return XPtr<xlsxfile>(new xlsxfile(path), true);
+}
 
 // [[Rcpp::export]]
 List xlsx_cells_(
-    std::string path,
+    SEXP file,
     CharacterVector sheet_paths,
     CharacterVector sheet_names,
-    CharacterVector comments_paths
+    CharacterVector comments_paths,
+    int threads,
+    CharacterVector columns,
+    bool factors,
+    bool lazy_formulas,
+    IntegerVector window
     ) {
-  xlsxbook book(path, sheet_paths, sheet_names, comments_paths);
+  xlsxbook book(as_xlsxfile(file), sheet_paths, sheet_names, comments_paths,
+                threads, columns, factors, lazy_formulas, window);
   return book.information_;
 }
 
 // [[Rcpp::export]]
-List xlsx_formats_(std::string path) {
-  xlsxstyles styles(path);
-  return List::create(
-    _["local"] = styles.local_,
-    _["style"] = styles.style_);
+IntegerVector parse_range_(std::string range) {
+  // As the window of xlsx_cells_(): first row, first col, last row, last col
+  cellrange out;
+  std::string text(range);
+  std::transform(text.begin(), text.end(), text.begin(), ::toupper);
+  if (!parseRange(text.data(), text.size(), out))
+    stop("Invalid range: '%s'", range);
+  return IntegerVector::create(out.first_row_, out.first_col_, out.last_row_,
+                               out.last_col_);
 }
 
-inline String comments_path_(std::string path, std::string sheet_target) {
-  // Given a sheet id, return the path to the comments file, should one exist
-  std::string sheet_rels = "xl/worksheets/_rels/" + sheet_target.replace(0, 11, "") + ".rels";
-  if (zip_has_file(path, sheet_rels)) {
-    std::string targets_text = zip_buffer(path, sheet_rels);
-    rapidxml::xml_document<> targets_xml;
-    targets_xml.parse<rapidxml::parse_strip_xml_namespaces>(&targets_text[0]);
-    rapidxml::xml_node<>* relationships = targets_xml.first_node("Relationships");
-    for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
-        relationship; relationship = relationship->next_sibling()) {
-      std::string target = relationship->first_attribute("Target")->value();
-      if (target.substr(0, 11) == "../comments") {
-        // Return the comments file path
-        return(target.replace(0, 2, "xl"));
-      }
+// [[Rcpp::export]]
+CharacterVector expand_formulas_(
+    CharacterVector formula,
+    IntegerVector from_row,
+    IntegerVector from_col,
+    IntegerVector to_row,
+    IntegerVector to_col
+    ) {
+  // Offset each formula from one cell to another.  Each distinct formula and
+  // origin is compiled only once, because a block of cells shares one.
+  R_xlen_t n = formula.size();
+  CharacterVector out(n, NA_STRING);
+  std::vector<shared_formula> compiled;
+  std::map<std::tuple<SEXP, int, int>, size_t> index;
+  std::string buffer;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    SEXP text = formula[i];
+    if (text == NA_STRING || from_row[i] == NA_INTEGER
+        || from_col[i] == NA_INTEGER || to_row[i] == NA_INTEGER
+        || to_col[i] == NA_INTEGER)
+      continue;
+    std::tuple<SEXP, int, int> key(text, from_row[i], from_col[i]);
+    std::map<std::tuple<SEXP, int, int>, size_t>::iterator it = index.find(key);
+    if (it == index.end()) {
+      compiled.push_back(shared_formula(std::string(CHAR(text)), from_row[i],
+                                        from_col[i]));
+      it = index.insert(std::make_pair(key, compiled.size() - 1)).first;
     }
+    compiled[it->second].render(to_row[i], to_col[i], buffer);
+    SET_STRING_ELT(out, i, Rf_mkCharCE(buffer.c_str(), CE_UTF8));
+    if ((i + 1) % 1000 == 0)
+      checkUserInterrupt();
   }
-  return NA_STRING;
+  return out;
+}
+
+// [[Rcpp::export]]
+List xlsx_formats_(SEXP file) {
+  xlsxstyles& styles = as_xlsxfile(file).styles();
+  styles.cacheFormats();
+  // Cached in the file, so R must copy them before modifying them
+  MARK_NOT_MUTABLE(styles.local_);
+  MARK_NOT_MUTABLE(styles.style_);
+  return List::create(
+    _["local"] = styles.local_,
+    _["style"] = styles.style_);
 }
 
 // [[Rcpp::export]]
-List xlsx_sheet_files_(std::string path) {
+List xlsx_sheet_files_(SEXP file) {
   // Return a list of worksheets,  their index numbers, names, and comments
   // paths.
+  List& out = as_xlsxfile(file).sheetFiles();
+  MARK_NOT_MUTABLE(out); // Cached in the file
+  return out;
+}
 
-  // primary key of two 'tables' of worksheets and other objects
-  // e.g. workbook.xml.rels Id="rId1" target = "worksheets/sheet1.xml"
-  std::string id;
-  std::vector<std::string> ids;
-
-  // Get the filenames of worksheets, indexed by rId, and the same of any
-  // comments files
-  std::map<std::string, std::string> sheet_paths;
-  std::map<std::string, String> comments_paths;
-  std::string rels_text = zip_buffer(path, "xl/_rels/workbook.xml.rels");
-  rapidxml::xml_document<> rels_xml;
-  rels_xml.parse<rapidxml::parse_strip_xml_namespaces>(&rels_text[0]);
-  rapidxml::xml_node<>* relationships = rels_xml.first_node("Relationships");
-  for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
-      relationship; relationship = relationship->next_sibling()) {
-    std::string target = relationship->first_attribute("Target")->value();
-    std::string target_type = target.substr(0, 10);
-    if (target_type == "worksheets" || target_type == "chartsheet") {
-       // Only store worksheets and chartsheets -- requests for chartsheets are
-       // handled in the R wrapper
-      id = relationship->first_attribute("Id")->value();
-      ids.push_back(id);
-      sheet_paths.insert({id, "xl/" + target}) ;
-      comments_paths.insert({id, comments_path_(path, target)});
-    }
-  }
+// [[Rcpp::export]]
+List xlsx_validation_(
+    SEXP file,
+    CharacterVector sheet_paths,
+    CharacterVector sheet_names
+    ) {
+  return xlsxvalidation(as_xlsxfile(file), sheet_paths, sheet_names).information();
+}
 
-  // Get the name and sheetId (display order) of all sheets/charts/etc, indexed
-  // by rId
-  std::map<std::string, std::string> names;
-  std::map<std::string, int> sheetIds;
-  std::string workbook_text = zip_buffer(path, "xl/workbook.xml");
-  rapidxml::xml_document<> workbook_xml;
-  workbook_xml.parse<rapidxml::parse_strip_xml_namespaces>(&workbook_text[0]);
-  rapidxml::xml_node<>* workbook = workbook_xml.first_node("workbook");
-  rapidxml::xml_node<>* sheets = workbook->first_node("sheets");
-  for (rapidxml::xml_node<>* sheet = sheets->first_node("sheet");
-      sheet; sheet = sheet->next_sibling()) {
-    rapidxml::xml_attribute<>* r_id = sheet->first_attribute("id");
-    if (r_id != NULL) {
-      id = r_id->value();
-    } else {
-      stop("Invalid xl/workbook.xml: sheet element lacks id attribute"); // # nocov
-    }
-    names[id] = sheet->first_attribute("name")->value();
-    sheetIds[id] = strtol(sheet->first_attribute("sheetId")->value(), NULL, 10);
-  }
+// [[Rcpp::export]]
+List xlsx_dimensions_(
+    SEXP file,
+    CharacterVector sheet_paths,
+    CharacterVector sheet_names
+    ) {
+  return xlsxdimensions(as_xlsxfile(file), sheet_paths, sheet_names).information();
+}
 
-  // Join by id
-  std::vector<std::string> out_name;
-  std::vector<int> out_rId;
-  std::vector<int> out_sheetId;
-  std::vector<std::string> out_sheet_path;
-  CharacterVector out_comments_path;
-  for(std::vector<std::string>::iterator it = ids.begin(); it != ids.end(); ++it) {
-    std::string key(*it);
-    out_name.push_back(names[key]);
-    out_rId.push_back(std::strtol(key.substr(3, std::string::npos).c_str(), NULL, 10));
-    out_sheetId.push_back(sheetIds[key]);
-    out_sheet_path.push_back(sheet_paths[key]);
-    out_comments_path.push_back(comments_paths[key]);
-  }
+// [[Rcpp::export]]
+List xlsx_dependencies_(
+    CharacterVector sheet_names,
+    IntegerVector sheets,
+    IntegerVector rows,
+    IntegerVector cols,
+    CharacterVector formulas,
+    IntegerVector name_sheets,
+    CharacterVector names,
+    CharacterVector name_formulas,
+    int threads
+    ) {
+  XPtr<xlsxdependencies> graph(
+      new xlsxdependencies(sheet_names, sheets, rows, cols, formulas,
+                           name_sheets, names, name_formulas, threads),
+      true);
+  List out = graph->information();
+  out.push_back(graph, "pointer");
+  return out;
+}
 
-  // Return a data frame
-  List out = List::create(
-      _["name"] = out_name,
-      _["rId"] = out_rId,
-      _["sheetId"] = out_sheetId,
-      _["sheet_path"] = out_sheet_path,
-      _["comments_path"] = out_comments_path);
+// [[Rcpp::export]]
+IntegerVector xlsx_dependents_(
+    SEXP graph,
+    CharacterVector sheets,
+    CharacterVector refs,
+    bool recursive
+    ) {
+  return as_xlsxdependencies(graph).dependents(sheets, refs, recursive);
+}
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(out[0]);
-  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+// [[Rcpp::export]]
+IntegerVector xlsx_precedents_(
+    SEXP graph,
+    CharacterVector sheets,
+    CharacterVector refs,
+    bool recursive
+    ) {
+  return as_xlsxdependencies(graph).precedents(sheets, refs, recursive);
+}
 
-  return out;
+// [[Rcpp::export]]
+List xlsx_model_(
+    SEXP file,
+    CharacterVector sheet_names,
+    List cells,
+    List names,
+    int threads
+    ) {
+  XPtr<xlsxmodel> model(
+      new xlsxmodel(file, sheet_names, cells, names, threads), true);
+  return List::create(_["pointer"] = model,
+                      _["unsupported"] = model->unsupported());
 }
 
 // [[Rcpp::export]]
-List xlsx_validation_(
-    std::string path,
-    CharacterVector sheet_paths,
-    CharacterVector sheet_names
+void xlsx_set_values_(
+    SEXP model,
+    CharacterVector sheets,
+    CharacterVector addresses,
+    SEXP values
     ) {
-  return xlsxvalidation(path, sheet_paths, sheet_names).information();
+  as_xlsxmodel(model).setValues(sheets, addresses, values);
 }
 
 // [[Rcpp::export]]
-List xlsx_names_(std::string path) {
-  return xlsxnames(path).information();
+List xlsx_recalculate_(SEXP model, bool all) {
+  return as_xlsxmodel(model).recalculate(all);
+}
+
+// [[Rcpp::export]]
+List xlsx_values_(
+    SEXP model,
+    CharacterVector sheets,
+    CharacterVector addresses
+    ) {
+  return as_xlsxmodel(model).values(sheets, addresses);
+}
+
+// [[Rcpp::export]]
+List xlsx_names_(SEXP file) {
+  return xlsxnames(as_xlsxfile(file)).information();
 }
 
 // [[Rcpp::export]]
@@ -167,7 +232,7 @@ LogicalVector is_date_format_(CharacterVector formats) {
 }
 
 // [[Rcpp::export]]
-List xlsx_color_theme_(std::string path) {
+List xlsx_color_theme_(SEXP file) {
   CharacterVector theme_name =
     CharacterVector::create("background1",
                             "text1",
@@ -181,45 +246,10 @@ List xlsx_color_theme_(std::string path) {
                             "accent6",
                             "hyperlink",
                             "followed-hyperlink");
-  CharacterVector theme_rgb(12, NA_STRING);
-  std::string FF = "FF";
-  if (zip_has_file(path, "xl/theme/theme1.xml")) {
-    std::string theme1 = zip_buffer(path, "xl/theme/theme1.xml");
-    rapidxml::xml_document<> theme1_xml;
-    theme1_xml.parse<0>(&theme1[0]);
-    rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
-    rapidxml::xml_node<>* themeElements = theme->first_node("a:themeElements");
-    rapidxml::xml_node<>* clrScheme = themeElements->first_node("a:clrScheme");
-
-    // First, two sysClr nodes in the wrong order
-    rapidxml::xml_node<>* color = clrScheme->first_node();
-    theme_rgb[1] = FF + color->first_node()->first_attribute("lastClr")->value();
-    color = color->next_sibling();
-    theme_rgb[0] = FF + color->first_node()->first_attribute("lastClr")->value();
-
-    // Then, two srgbClr nodes in the wrong order
-    color = color->next_sibling();
-    theme_rgb[3] = FF + color->first_node()->first_attribute("val")->value();
-    color = color->next_sibling();
-    theme_rgb[2] = FF + color->first_node()->first_attribute("val")->value();
-
-    // Finally, eight more srgbClr nodes in the correct order
-    // Can't reuse 'color' here, so use 'nextcolor'
-    int i = 4;
-    for (rapidxml::xml_node<>* nextcolor = color->next_sibling();
-        nextcolor; nextcolor = nextcolor->next_sibling()) {
-      theme_rgb[i] = FF + nextcolor->first_node()->first_attribute("val")->value();
-      i++;
-    }
-  }
+  CharacterVector theme_rgb = clone(as_xlsxfile(file).theme());
 
   List out = List::create(_["name"] = theme_name,
                           _["rgb"] = theme_rgb);
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(out[0]);
-  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
-
-  return out;
+  return dataFrame(out);
 }
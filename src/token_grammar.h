@@ -6,6 +6,7 @@
 #include <pegtl.hpp>
 #include <Rcpp.h>
 #include "paren_type.h"
+#include "token_type.h"
 
 using namespace tao::TAOCPP_PEGTL_NAMESPACE;
 
@@ -287,20 +288,30 @@ namespace xltoken
 
   // Specialisations of the user-defined action to do something when a rule
   // succeeds; is called with the portion of the input that matched the rule.
+  // Tokens record where they are in the formula rather than copying it.
+
+  template< typename Input >
+    inline void addToken(const Input & in,
+                         const char* formula,
+                         int level,
+                         token_type type,
+                         std::vector<token> & tokens)
+    {
+      token t = {type, level, static_cast<size_t>(in.begin() - formula),
+                 in.size()};
+      tokens.push_back(t);
+    }
 
   template<> struct tokenize< Ref >
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("ref");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::REF, tokens);
       }
   };
 
@@ -308,15 +319,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("sheet");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::SHEET, tokens);
       }
   };
 
@@ -324,15 +332,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("name");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::NAME, tokens);
       }
   };
 
@@ -340,15 +345,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("DDE");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::DDE, tokens);
       }
   };
 
@@ -356,32 +358,25 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("structured_ref");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::STRUCTURED_REF, tokens);
       }
   };
 
-
   template<> struct tokenize< Text >
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("text");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::TEXT, tokens);
       }
   };
 
@@ -389,15 +384,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("other");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::OTHER, tokens);
       }
   };
 
@@ -405,21 +397,18 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        tokens.push_back(in.string());
         switch (fun_paren.back()) {
           case paren_type::PARENTHESES:
-            types.push_back("operator");
+            addToken(in, formula, level, token_type::OPERATOR, tokens);
             break;
 
           case paren_type::FUNCTION:
-            types.push_back("separator");
+            addToken(in, formula, level, token_type::SEPARATOR, tokens);
             break;
         }
       }
@@ -429,15 +418,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("separator");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::SEPARATOR, tokens);
       }
   };
 
@@ -445,15 +431,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("paren_open");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::PAREN_OPEN, tokens);
         ++level;
         fun_paren.push_back(paren_type::PARENTHESES);
       }
@@ -463,22 +446,19 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
         level--;
-        levels.push_back(level);
-        tokens.push_back(in.string());
         switch (fun_paren.back()) {
           case paren_type::PARENTHESES:
-            types.push_back("paren_close");
+            addToken(in, formula, level, token_type::PAREN_CLOSE, tokens);
             break;
 
           case paren_type::FUNCTION:
-            types.push_back("fun_close");
+            addToken(in, formula, level, token_type::FUN_CLOSE, tokens);
             break;
         }
         fun_paren.pop_back();
@@ -489,15 +469,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("open_array");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::OPEN_ARRAY, tokens);
         level++;
         fun_paren.push_back(paren_type::FUNCTION);
       }
@@ -507,16 +484,13 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
         level--;
-        levels.push_back(level);
-        types.push_back("close_array");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::CLOSE_ARRAY, tokens);
         fun_paren.pop_back();
       }
   };
@@ -525,15 +499,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("bool");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::BOOL, tokens);
       }
   };
 
@@ -541,15 +512,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("error");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::ERROR_VALUE, tokens);
       }
   };
 
@@ -557,15 +525,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("number");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::NUMBER, tokens);
       }
   };
 
@@ -573,23 +538,17 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        // Handle the function name
-        levels.push_back(level);
-        types.push_back("function");
-        std::string in_string(in.string());
-        in_string.pop_back();               // remove the terminal '('
-        tokens.push_back(in_string);
-
-        // Handle the open parenthesis
-        levels.push_back(level);
-        types.push_back("fun_open");
-        tokens.push_back("(");
+        // The function name, without the terminal '(', and then the '('
+        size_t offset = static_cast<size_t>(in.begin() - formula);
+        token name = {token_type::FUNCTION, level, offset, in.size() - 1};
+        token open = {token_type::FUN_OPEN, level, offset + in.size() - 1, 1};
+        tokens.push_back(name);
+        tokens.push_back(open);
 
         // Handle the new level and context
         ++level;
@@ -601,15 +560,12 @@ namespace xltoken
   {
     template< typename Input >
       static void apply( const Input & in,
+                         const char* formula,
                          int & level,
-                         std::vector<int> & levels,
                          std::vector<paren_type> & fun_paren,
-                         std::vector<std::string> & types,
-                         std::vector<std::string> & tokens)
+                         std::vector<token> & tokens)
       {
-        levels.push_back(level);
-        types.push_back("operator");
-        tokens.push_back(in.string());
+        addToken(in, formula, level, token_type::OPERATOR, tokens);
       }
   };
 
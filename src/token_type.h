@@ -0,0 +1,51 @@
+#ifndef TOKEN_TYPE_
+#define TOKEN_TYPE_
+
+#include <cstddef>
+
+// The types of the tokens of a formula, in the order of the levels of the
+// factor that xlex_all() can return.
+enum class token_type : unsigned char {
+  REF,
+  SHEET,
+  NAME,
+  FUNCTION,
+  ERROR_VALUE, // not ERROR, which is a macro on some platforms
+  BOOL,
+  NUMBER,
+  TEXT,
+  OPERATOR,
+  PAREN_OPEN,
+  PAREN_CLOSE,
+  OPEN_ARRAY,
+  CLOSE_ARRAY,
+  FUN_OPEN,
+  FUN_CLOSE,
+  SEPARATOR,
+  DDE,
+  STRUCTURED_REF,
+  OTHER
+};
+
+const int N_TOKEN_TYPES = 19;
+
+// The names of the types, as returned to R
+inline const char* tokenTypeName(token_type type) {
+  static const char* names[N_TOKEN_TYPES] = {
+    "ref", "sheet", "name", "function", "error", "bool", "number", "text",
+    "operator", "paren_open", "paren_close", "open_array", "close_array",
+    "fun_open", "fun_close", "separator", "DDE", "structured_ref", "other"
+  };
+  return names[static_cast<int>(type)];
+}
+
+// A token is a slice of the formula, so that lexing doesn't copy any text.
+// The text is only copied when the token is returned to R.
+struct token {
+  token_type type_;
+  int level_;      // level within nested formula
+  size_t offset_;  // of the first character in the formula
+  size_t length_;
+};
+
+#endif
@@ -1,46 +1,205 @@
+#include <algorithm>
 #include <Rcpp.h>
 #include "token_grammar.h"
+#include "token_type.h"
+#include "xlex.h"
+#include "xltree.h"
 #include "paren_type.h"
+#include "parallel.h"
+#include "dataframe.h"
 
 using namespace Rcpp;
 
-// [[Rcpp::export]]
-List xlex_(CharacterVector x)
-{
-
-  std::string in_string;                   // the formula from the input x
-  List out;                          // wraps types, tokens, levels
-  std::vector<std::string> types;          // bool, number, text, function, etc.
-  std::vector<std::string> tokens;         // the tokens themselves
-  std::vector<int> levels;                 // level within nested formula
+void lexFormula(const char* formula, size_t size, std::vector<token>& tokens) {
   int level(0);                            // starting level
   std::vector<paren_type> fun_paren;       // what is the context of a comma?
 
-  in_string = as<std::string>(x);
-
   // default context before any '('.  Never required in valid formulas, but
   // avoids hard crash in the event, e.g. a formula =A1,B2.
   fun_paren.push_back(paren_type::PARENTHESES);
 
-  memory_input<> in_mem(in_string, "original-formula");
+  memory_input<> in_mem(formula, size, "original-formula");
   parse< xltoken::root, xltoken::tokenize >(in_mem,
+                                            formula,
                                             level,
-                                            levels,
                                             fun_paren,
-                                            types,
                                             tokens);
+}
+
+// The text of a token, in the encoding of the formula
+static SEXP tokenText(SEXP formula, const token& t) {
+  return Rf_mkCharLenCE(CHAR(formula) + t.offset_, t.length_,
+                        Rf_getCharCE(formula));
+}
+
+static CharacterVector tokenTypeNames() {
+  CharacterVector names(N_TOKEN_TYPES);
+  for (int i = 0; i < N_TOKEN_TYPES; ++i)
+    names[i] = tokenTypeName(static_cast<token_type>(i));
+  return names;
+}
+
+// [[Rcpp::export]]
+List xlex_(CharacterVector x)
+{
+  List out;                                // wraps types, tokens, levels
+  std::vector<token> tokens;
+
+  SEXP formula = x[0];
+  lexFormula(CHAR(formula), LENGTH(formula), tokens);
+
+  int n = tokens.size();
+  IntegerVector levels(n);                 // level within nested formula
+  CharacterVector types(n);                // bool, number, text, function, etc.
+  CharacterVector texts(n);                // the tokens themselves
+  CharacterVector type_names = tokenTypeNames();
+  for (int i = 0; i < n; ++i) {
+    levels[i] = tokens[i].level_;
+    types[i] = type_names[static_cast<int>(tokens[i].type_)];
+    texts[i] = tokenText(formula, tokens[i]);
+  }
 
   out = List::create(
       _["level"] = levels,
       _["type"] = types,
-      _["token"] = tokens
+      _["token"] = texts
       );
 
-  int n = tokens.size();
+  dataFrame(out, n);
   out.attr("class") = CharacterVector::create("xlex", "tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
 
   return out;
 }
 
+// [[Rcpp::export]]
+List xlex_all_(CharacterVector x, int threads, bool factors, bool tree)
+{
+  // Find the text of each formula before starting any threads.  Missing
+  // formulas have no tokens.
+  size_t n_formulas = x.size();
+  std::vector<const char*> formulas(n_formulas);
+  std::vector<size_t> sizes(n_formulas);
+  for (size_t k = 0; k < n_formulas; ++k) {
+    SEXP formula = x[k];
+    if (formula != NA_STRING) {
+      formulas[k] = CHAR(formula);
+      sizes[k] = LENGTH(formula);
+    }
+  }
 
+  // Lex the formulas on several threads, each block into its own tokens
+  struct block {
+    std::vector<token> tokens_;
+    std::vector<int> ids_;                 // the formula of each token
+    std::vector<treenode> nodes_;          // if tree
+  };
+  size_t n_blocks = parallel::blockCount(n_formulas);
+  std::vector<block> blocks(n_blocks);
+  parallel pool(threads);
+  pool.runBlocks(n_formulas, [&](size_t b, size_t begin, size_t end) {
+    block& lexed = blocks[b];
+    for (size_t k = begin; k < end; ++k) {
+      if (formulas[k] == NULL)
+        continue;
+      size_t first = lexed.tokens_.size();
+      lexFormula(formulas[k], sizes[k], lexed.tokens_);
+      size_t n_tokens = lexed.tokens_.size();
+      lexed.ids_.resize(n_tokens, k + 1);
+      if (tree && n_tokens > first) {
+        lexed.nodes_.resize(n_tokens);
+        growTree(formulas[k], &lexed.tokens_[first], n_tokens - first,
+                 &lexed.nodes_[first]);
+      }
+    }
+  });
+
+  // Concatenate the tokens of each block, in the order of the formulas
+  int n = 0;
+  for (size_t b = 0; b < n_blocks; ++b)
+    n += blocks[b].tokens_.size();
+
+  IntegerVector id(n);
+  IntegerVector level(n);
+  IntegerVector type_codes(factors ? n : 0);
+  CharacterVector type_names = tokenTypeNames();
+  CharacterVector type(factors ? 0 : n);
+  CharacterVector text(n);
+  int n_tree = tree ? n : 0;
+  IntegerVector node(n_tree);
+  IntegerVector parent(n_tree);
+  IntegerVector child(n_tree);
+  IntegerVector kind_codes(tree && factors ? n : 0);
+  CharacterVector kind_names(N_NODE_KINDS);
+  for (int k = 0; k < N_NODE_KINDS; ++k)
+    kind_names[k] = nodeKindName(static_cast<node_kind>(k));
+  CharacterVector kind(tree && !factors ? n : 0);
+  IntegerVector precedence(n_tree);
+  int i = 0;
+  for (size_t b = 0; b < n_blocks; ++b) {
+    block& lexed = blocks[b];
+    for (size_t j = 0; j < lexed.tokens_.size(); ++j) {
+      const token& t = lexed.tokens_[j];
+      int code = static_cast<int>(t.type_);
+      id[i] = lexed.ids_[j];
+      level[i] = t.level_;
+      if (factors) {
+        type_codes[i] = code + 1;
+      } else {
+        type[i] = type_names[code];
+      }
+      text[i] = tokenText(x[id[i] - 1], t);
+      if (tree) {
+        const treenode& tn = lexed.nodes_[j];
+        node[i] = (j > 0 && lexed.ids_[j - 1] == id[i]) ? node[i - 1] + 1 : 1;
+        parent[i] = tn.parent_ > 0 ? tn.parent_ : NA_INTEGER;
+        child[i] = tn.child_ > 0 ? tn.child_ : NA_INTEGER;
+        precedence[i] = tn.precedence_ > 0 ? tn.precedence_ : NA_INTEGER;
+        int kind_code = static_cast<int>(tn.kind_);
+        if (factors) {
+          kind_codes[i] = kind_code + 1;
+        } else {
+          kind[i] = kind_names[kind_code];
+        }
+      }
+      ++i;
+    }
+    lexed = block();                       // free the memory as we go
+  }
+
+  SEXP types = type;
+  if (factors) {
+    type_codes.attr("levels") = type_names;
+    type_codes.attr("class") = "factor";
+    types = type_codes;
+  }
+  SEXP kinds = kind;
+  if (tree && factors) {
+    kind_codes.attr("levels") = kind_names;
+    kind_codes.attr("class") = "factor";
+    kinds = kind_codes;
+  }
+
+  List out;
+  if (tree) {
+    out = List::create(
+        _["id"] = id,
+        _["level"] = level,
+        _["type"] = types,
+        _["token"] = text,
+        _["node"] = node,
+        _["parent"] = parent,
+        _["child"] = child,
+        _["kind"] = kinds,
+        _["precedence"] = precedence
+        );
+  } else {
+    out = List::create(
+        _["id"] = id,
+        _["level"] = level,
+        _["type"] = types,
+        _["token"] = text
+        );
+  }
+
+  return dataFrame(out, n);
+}
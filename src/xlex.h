@@ -0,0 +1,12 @@
+#ifndef XLEX_
+#define XLEX_
+
+#include <cstddef>
+#include <vector>
+#include "token_type.h"
+
+// Appends the tokens of a formula, which refer to its text, to tokens.
+// Doesn't call R, so formulas can be lexed on several threads at once.
+void lexFormula(const char* formula, size_t size, std::vector<token>& tokens);
+
+#endif
@@ -0,0 +1,1632 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <unordered_map>
+#include "xlformula.h"
+#include "xlex.h"
+#include "xltree.h"
+#include "xlsxdependencies.h"
+
+// The functions that can be calculated, with their least and greatest numbers
+// of arguments.  Names are upper case, without the _xlfn. prefix of functions
+// newer than the file format.
+enum {
+  FN_ABS, FN_AND, FN_AVERAGE, FN_CHOOSE, FN_COLUMN, FN_COLUMNS, FN_CONCATENATE,
+  FN_COUNT, FN_COUNTA, FN_COUNTBLANK, FN_COUNTIF, FN_EXP, FN_FALSE, FN_HLOOKUP,
+  FN_IF, FN_IFERROR, FN_IFNA, FN_INDEX, FN_INT, FN_ISBLANK, FN_ISERR,
+  FN_ISERROR, FN_ISLOGICAL, FN_ISNA, FN_ISNUMBER, FN_ISTEXT, FN_LEFT, FN_LEN,
+  FN_LN, FN_LOG10, FN_LOWER, FN_MATCH, FN_MAX, FN_MID, FN_MIN, FN_MOD, FN_NA,
+  FN_NOT, FN_OR, FN_PI, FN_POWER, FN_PRODUCT, FN_RIGHT, FN_ROUND,
+  FN_ROUNDDOWN, FN_ROUNDUP, FN_ROW, FN_ROWS, FN_SIGN, FN_SQRT, FN_SUM,
+  FN_SUMIF, FN_SUMPRODUCT, FN_TRIM, FN_TRUE, FN_UPPER, FN_VLOOKUP,
+  N_FUNCTIONS
+};
+
+struct functioninfo {
+  const char* name_;
+  int min_;
+  int max_;
+};
+
+static const functioninfo functions[N_FUNCTIONS] = {
+  {"ABS", 1, 1}, {"AND", 1, 255}, {"AVERAGE", 1, 255}, {"CHOOSE", 2, 255},
+  {"COLUMN", 0, 1}, {"COLUMNS", 1, 1}, {"CONCATENATE", 1, 255},
+  {"COUNT", 1, 255}, {"COUNTA", 1, 255}, {"COUNTBLANK", 1, 1},
+  {"COUNTIF", 2, 2}, {"EXP", 1, 1}, {"FALSE", 0, 0}, {"HLOOKUP", 3, 4},
+  {"IF", 1, 3}, {"IFERROR", 2, 2}, {"IFNA", 2, 2}, {"INDEX", 2, 3},
+  {"INT", 1, 1}, {"ISBLANK", 1, 1}, {"ISERR", 1, 1}, {"ISERROR", 1, 1},
+  {"ISLOGICAL", 1, 1}, {"ISNA", 1, 1}, {"ISNUMBER", 1, 1}, {"ISTEXT", 1, 1},
+  {"LEFT", 1, 2}, {"LEN", 1, 1}, {"LN", 1, 1}, {"LOG10", 1, 1},
+  {"LOWER", 1, 1}, {"MATCH", 2, 3}, {"MAX", 1, 255}, {"MID", 3, 3},
+  {"MIN", 1, 255}, {"MOD", 2, 2}, {"NA", 0, 0}, {"NOT", 1, 1},
+  {"OR", 1, 255}, {"PI", 0, 0}, {"POWER", 2, 2}, {"PRODUCT", 1, 255},
+  {"RIGHT", 1, 2}, {"ROUND", 2, 2}, {"ROUNDDOWN", 2, 2}, {"ROUNDUP", 2, 2},
+  {"ROW", 0, 1}, {"ROWS", 1, 1}, {"SIGN", 1, 1}, {"SQRT", 1, 1},
+  {"SUM", 1, 255}, {"SUMIF", 2, 3}, {"SUMPRODUCT", 1, 255}, {"TRIM", 1, 1},
+  {"TRUE", 0, 0}, {"UPPER", 1, 1}, {"VLOOKUP", 3, 4}
+};
+
+static std::unordered_map<std::string, int> makeFunctionIndex() {
+  std::unordered_map<std::string, int> out;
+  for (int k = 0; k < N_FUNCTIONS; ++k)
+    out[functions[k].name_] = k;
+  return out;
+}
+
+// Position of a function in the table, or -1
+static int findFunction(std::string name) {
+  static const std::unordered_map<std::string, int> index = makeFunctionIndex();
+  for (size_t i = 0; i < name.size(); ++i)
+    name[i] = std::toupper((unsigned char)name[i]);
+  if (name.compare(0, 6, "_XLFN.") == 0 || name.compare(0, 6, "_XLWS.") == 0)
+    name.erase(0, 6);
+  std::unordered_map<std::string, int>::const_iterator it = index.find(name);
+  return it == index.end() ? -1 : it->second;
+}
+
+// Conversions between types, as Excel does them ------------------------------
+
+static bool equalsIgnoringCase(const std::string& a, const char* b) {
+  size_t n = a.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (b[i] == '\0' || std::toupper((unsigned char)a[i]) != b[i])
+      return false;
+  }
+  return b[n] == '\0';
+}
+
+// Text such as " 1.5e3 " as a number.  Rejects anything strtod() would accept
+// that Excel wouldn't, such as "inf" and hexadecimal.
+static bool parseNumber(const std::string& x, double& out) {
+  size_t first = x.find_first_not_of(' ');
+  size_t last = x.find_last_not_of(' ');
+  if (first == std::string::npos)
+    return false;
+  std::string trimmed = x.substr(first, last - first + 1);
+  for (size_t i = 0; i < trimmed.size(); ++i) {
+    char c = trimmed[i];
+    if (!std::isdigit((unsigned char)c) && c != '.' && c != 'e' && c != 'E'
+        && c != '+' && c != '-')
+      return false;
+  }
+  char* end;
+  out = std::strtod(trimmed.c_str(), &end);
+  return end == trimmed.c_str() + trimmed.size();
+}
+
+// Like Excel's General format, with up to 15 significant digits
+static std::string formatNumber(double x) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.15g", x);
+  std::string out(buffer);
+  std::replace(out.begin(), out.end(), 'e', 'E');
+  return out;
+}
+
+// Returns false, with the error in error, if x isn't a number and can't be
+// made into one
+static bool toNumber(const cellvalue& x, double& out, cellvalue& error) {
+  switch (x.type_) {
+    case value_type::BLANK:
+      out = 0;
+      return true;
+    case value_type::NUMBER:
+    case value_type::BOOL:
+      out = x.number_;
+      return true;
+    case value_type::TEXT:
+      if (parseNumber(x.text_, out))
+        return true;
+      error = errorValue("#VALUE!");
+      return false;
+    default:
+      error = x;
+      return false;
+  }
+}
+
+static bool toText(const cellvalue& x, std::string& out, cellvalue& error) {
+  switch (x.type_) {
+    case value_type::BLANK:
+      out.clear();
+      return true;
+    case value_type::NUMBER:
+      out = formatNumber(x.number_);
+      return true;
+    case value_type::BOOL:
+      out = x.number_ != 0 ? "TRUE" : "FALSE";
+      return true;
+    case value_type::TEXT:
+      out = x.text_;
+      return true;
+    default:
+      error = x;
+      return false;
+  }
+}
+
+static bool toBool(const cellvalue& x, bool& out, cellvalue& error) {
+  switch (x.type_) {
+    case value_type::BLANK:
+      out = false;
+      return true;
+    case value_type::NUMBER:
+    case value_type::BOOL:
+      out = x.number_ != 0;
+      return true;
+    case value_type::TEXT:
+      if (equalsIgnoringCase(x.text_, "TRUE")) {
+        out = true;
+        return true;
+      }
+      if (equalsIgnoringCase(x.text_, "FALSE")) {
+        out = false;
+        return true;
+      }
+      error = errorValue("#VALUE!");
+      return false;
+    default:
+      error = x;
+      return false;
+  }
+}
+
+static cellvalue checkNumber(double x) {
+  return std::isfinite(x) ? numberValue(x) : errorValue("#NUM!");
+}
+
+// Text compared without regard to (ASCII) case
+static int compareText(const std::string& a, const std::string& b) {
+  size_t n = std::min(a.size(), b.size());
+  for (size_t i = 0; i < n; ++i) {
+    int x = std::tolower((unsigned char)a[i]);
+    int y = std::tolower((unsigned char)b[i]);
+    if (x != y)
+      return x < y ? -1 : 1;
+  }
+  return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+// Excel orders numbers before text before logicals.  A blank is compared as
+// whatever the other value is: zero, empty text or FALSE.
+static int typeRank(value_type type) {
+  switch (type) {
+    case value_type::NUMBER: return 0;
+    case value_type::TEXT: return 1;
+    case value_type::BOOL: return 2;
+    default: return 3;
+  }
+}
+
+static int compareValues(const cellvalue& a, const cellvalue& b) {
+  value_type type_a = a.type_;
+  value_type type_b = b.type_;
+  if (type_a == value_type::BLANK && type_b == value_type::BLANK)
+    return 0;
+  if (type_a == value_type::BLANK)
+    type_a = type_b;
+  if (type_b == value_type::BLANK)
+    type_b = type_a;
+  if (type_a != type_b)
+    return typeRank(type_a) < typeRank(type_b) ? -1 : 1;
+  if (type_a == value_type::TEXT)
+    return compareText(a.type_ == value_type::BLANK ? std::string() : a.text_,
+                       b.type_ == value_type::BLANK ? std::string() : b.text_);
+  double x = a.number_;
+  double y = b.number_;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Wildcards * and ?, escaped by ~, matched without regard to case
+static bool wildcardMatch(const char* pattern, const char* text) {
+  for (; *pattern != '\0'; ++pattern) {
+    if (*pattern == '*') {
+      for (const char* rest = text; ; ++rest) {
+        if (wildcardMatch(pattern + 1, rest))
+          return true;
+        if (*rest == '\0')
+          return false;
+      }
+    }
+    if (*text == '\0')
+      return false;
+    if (*pattern == '~' && (pattern[1] == '*' || pattern[1] == '?'
+                            || pattern[1] == '~'))
+      ++pattern;
+    else if (*pattern == '?') {
+      ++text;
+      continue;
+    }
+    if (std::tolower((unsigned char)*pattern)
+        != std::tolower((unsigned char)*text))
+      return false;
+    ++text;
+  }
+  return *text == '\0';
+}
+
+static bool hasWildcards(const std::string& x) {
+  return x.find_first_of("*?~") != std::string::npos;
+}
+
+// Whether a value is the one looked for by MATCH(), VLOOKUP() or HLOOKUP()
+// with an exact match
+static bool lookupEqual(const cellvalue& wanted, const cellvalue& x) {
+  if (wanted.type_ != x.type_)
+    return false;
+  if (wanted.type_ == value_type::TEXT)
+    return hasWildcards(wanted.text_)
+      ? wildcardMatch(wanted.text_.c_str(), x.text_.c_str())
+      : compareText(wanted.text_, x.text_) == 0;
+  return wanted.number_ == x.number_;
+}
+
+// The criteria of SUMIF() and COUNTIF(), e.g. 3, ">=3", "<>apple" or "a*"
+struct criterion {
+  char op_;          // '=', 'n' (<>), '<', '>', 'l' (<=) or 'g' (>=)
+  cellvalue value_;  // blank for "=" and "<>" alone
+};
+
+static criterion parseCriterion(const cellvalue& x) {
+  criterion out = {'=', x};
+  if (x.type_ != value_type::TEXT)
+    return out;
+  const std::string& text = x.text_;
+  size_t n = 0;
+  if (text.compare(0, 2, "<=") == 0) { out.op_ = 'l'; n = 2; }
+  else if (text.compare(0, 2, ">=") == 0) { out.op_ = 'g'; n = 2; }
+  else if (text.compare(0, 2, "<>") == 0) { out.op_ = 'n'; n = 2; }
+  else if (text.compare(0, 1, "<") == 0) { out.op_ = '<'; n = 1; }
+  else if (text.compare(0, 1, ">") == 0) { out.op_ = '>'; n = 1; }
+  else if (text.compare(0, 1, "=") == 0) { out.op_ = '='; n = 1; }
+  std::string rest = text.substr(n);
+  double number;
+  if (rest.empty())
+    out.value_ = blankValue();
+  else if (parseNumber(rest, number))
+    out.value_ = numberValue(number);
+  else if (equalsIgnoringCase(rest, "TRUE"))
+    out.value_ = boolValue(true);
+  else if (equalsIgnoringCase(rest, "FALSE"))
+    out.value_ = boolValue(false);
+  else
+    out.value_ = textValue(rest);
+  return out;
+}
+
+static bool meetsCriterion(const criterion& c, const cellvalue& x) {
+  bool empty = x.type_ == value_type::BLANK
+    || (x.type_ == value_type::TEXT && x.text_.empty());
+  switch (c.op_) {
+    case '=':
+    case 'n': {
+      bool equal;
+      if (c.value_.type_ == value_type::BLANK)
+        equal = empty;
+      else if (c.value_.type_ == value_type::TEXT)
+        equal = x.type_ == value_type::TEXT
+          && wildcardMatch(c.value_.text_.c_str(), x.text_.c_str());
+      else
+        equal = x.type_ == c.value_.type_ && x.number_ == c.value_.number_;
+      return c.op_ == '=' ? equal : !equal;
+    }
+    default: {
+      if (x.type_ != c.value_.type_)
+        return false;
+      int order = compareValues(x, c.value_);
+      switch (c.op_) {
+        case '<': return order < 0;
+        case '>': return order > 0;
+        case 'l': return order <= 0;
+        default: return order >= 0;
+      }
+    }
+  }
+}
+
+// Number of UTF-8 characters, and the byte offset of the kth of them
+static size_t countChars(const std::string& x) {
+  size_t n = 0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    if (((unsigned char)x[i] & 0xC0) != 0x80)
+      ++n;
+  }
+  return n;
+}
+
+static size_t charOffset(const std::string& x, size_t k) {
+  size_t i = 0;
+  for (; i < x.size() && k > 0; ++i) {
+    if (((unsigned char)x[i + 1] & 0xC0) != 0x80)
+      --k;
+  }
+  return std::min(i, x.size());
+}
+
+// Truncates a position or count towards zero, as Excel does, clamped to the
+// range of an int, because casting a double outside it is undefined.  NaN is
+// INT_MIN.
+static int truncateInt(double x) {
+  if (!(x > INT_MIN))
+    return INT_MIN;
+  if (x > INT_MAX)
+    return INT_MAX;
+  return (int)x;
+}
+
+// Rounds half away from zero to digits decimal places, as ROUND() does, or
+// away from zero (direction 1) or towards it (direction -1)
+static double roundDigits(double x, double digits, int direction) {
+  double scale = std::pow(10.0, std::floor(digits));
+  double y = std::fabs(x) * scale;
+  // Undo the error of the multiplication before deciding which way to go
+  double nearest = std::floor(y + 0.5);
+  if (std::fabs(y - nearest) < 1e-9 * std::max(1.0, y))
+    y = nearest;
+  if (direction > 0)
+    y = std::ceil(y);
+  else if (direction < 0)
+    y = std::floor(y);
+  else
+    y = std::floor(y + 0.5);
+  return (x < 0 ? -y : y) / scale;
+}
+
+// Operands ------------------------------------------------------------------
+
+static operand valueOperand(const cellvalue& x) {
+  operand out;
+  out.kind_ = operand::VALUE;
+  out.value_ = x;
+  out.rows_ = 1;
+  out.cols_ = 1;
+  return out;
+}
+
+static operand arrayOperand(int rows, int cols) {
+  operand out;
+  out.kind_ = operand::ARRAY;
+  out.value_ = blankValue();
+  out.rows_ = rows;
+  out.cols_ = cols;
+  out.array_.resize((size_t)rows * cols, blankValue());
+  return out;
+}
+
+static operand referenceOperand(const cellrange& range) {
+  operand out;
+  out.kind_ = operand::REFERENCE;
+  out.value_ = blankValue();
+  out.rows_ = range.last_row_ - range.first_row_ + 1;
+  out.cols_ = range.last_col_ - range.first_col_ + 1;
+  out.ref_ = range;
+  return out;
+}
+
+static operand errorOperand(const char* x) {
+  return valueOperand(errorValue(x));
+}
+
+// A read-only view of an operand as a table of values
+class grid {
+
+  public:
+
+    grid(const operand& x, const xlcontext& context):
+      x_(x), context_(context), rows_(x.rows_), cols_(x.cols_) {}
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    // The rows and columns worth searching, leaving out any beyond the last
+    // cell of the sheet, which are blank
+    int searchRows() const {
+      if (x_.kind_ != operand::REFERENCE)
+        return rows_;
+      int last = context_.lastRow(x_.ref_.sheet_) - x_.ref_.first_row_ + 1;
+      return std::max(0, std::min(rows_, last));
+    }
+
+    int searchCols() const {
+      if (x_.kind_ != operand::REFERENCE)
+        return cols_;
+      int last = context_.lastCol(x_.ref_.sheet_) - x_.ref_.first_col_ + 1;
+      return std::max(0, std::min(cols_, last));
+    }
+
+    const cellvalue& at(int i, int j) const {
+      switch (x_.kind_) {
+        case operand::REFERENCE:
+          return context_.value(x_.ref_.sheet_, x_.ref_.first_row_ + i,
+                                x_.ref_.first_col_ + j);
+        case operand::ARRAY:
+          return x_.array_[(size_t)i * cols_ + j];
+        default:
+          return x_.value_;
+      }
+    }
+
+  private:
+
+    const operand& x_;
+    const xlcontext& context_;
+    int rows_;
+    int cols_;
+
+};
+
+// Evaluation ----------------------------------------------------------------
+
+class xlevaluator {
+
+  public:
+
+    xlevaluator(const xlcontext& context): context_(context), depth_(0) {}
+
+    operand evaluate(const xlformula& f, int k, const cellposition& at);
+
+    cellvalue scalar(const operand& x, const cellposition& at) const;
+
+  private:
+
+    typedef xlformula::expr expr;
+    typedef xlformula::expr_kind expr_kind;
+
+    const xlcontext& context_;
+    int depth_; // of defined names within defined names
+
+    operand prepare(const operand& x, const cellposition& at) const;
+    operand materialise(const operand& x) const;
+
+    template <typename Function>
+    operand lift(std::vector<operand>& args, const cellposition& at,
+                 Function f) const;
+    template <typename Function>
+    operand lift1(const operand& x, const cellposition& at, Function f) const;
+
+    operand infix(char op, const operand& a, const operand& b,
+                  const cellposition& at) const;
+    operand call(const xlformula& f, const expr& e, const cellposition& at);
+
+    operand argument(const xlformula& f, const expr& e, size_t i,
+                     const cellposition& at) {
+      if (i >= e.args_.size())
+        return valueOperand(blankValue());
+      return evaluate(f, e.args_[i], at);
+    }
+
+    bool missing(const xlformula& f, const expr& e, size_t i) const {
+      return i >= e.args_.size()
+        || f.exprs_[e.args_[i]].kind_ == expr_kind::MISSING;
+    }
+
+    // Functions of a kind
+    operand aggregate(int function, const xlformula& f, const expr& e,
+                      const cellposition& at);
+    operand logical(int function, const xlformula& f, const expr& e,
+                    const cellposition& at);
+    operand lookup(int function, const xlformula& f, const expr& e,
+                   const cellposition& at);
+    operand index(const xlformula& f, const expr& e, const cellposition& at);
+    operand conditional(int function, const xlformula& f, const expr& e,
+                        const cellposition& at);
+    operand sumproduct(const xlformula& f, const expr& e,
+                       const cellposition& at);
+
+    int findInLine(const cellvalue& wanted, const grid& g, bool by_row,
+                   int line, int n, int type) const;
+
+};
+
+// A single value from an operand.  A range that is more than one cell is
+// implicitly intersected with the row or column of the formula's cell.
+cellvalue xlevaluator::scalar(const operand& x, const cellposition& at) const {
+  switch (x.kind_) {
+    case operand::VALUE:
+      return x.value_;
+    case operand::ARRAY:
+      return x.array_.empty() ? errorValue("#VALUE!") : x.array_[0];
+    default:
+      break;
+  }
+  const cellrange& r = x.ref_;
+  if (r.first_row_ == r.last_row_ && r.first_col_ == r.last_col_)
+    return context_.value(r.sheet_, r.first_row_, r.first_col_);
+  if (r.first_col_ == r.last_col_
+      && at.row_ >= r.first_row_ && at.row_ <= r.last_row_)
+    return context_.value(r.sheet_, at.row_, r.first_col_);
+  if (r.first_row_ == r.last_row_
+      && at.col_ >= r.first_col_ && at.col_ <= r.last_col_)
+    return context_.value(r.sheet_, r.first_row_, at.col_);
+  return errorValue("#VALUE!");
+}
+
+operand xlevaluator::materialise(const operand& x) const {
+  grid g(x, context_);
+  operand out = arrayOperand(g.rows(), g.cols());
+  int rows = g.searchRows();
+  int cols = g.searchCols();
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j)
+      out.array_[(size_t)i * out.cols_ + j] = g.at(i, j);
+  }
+  return out;
+}
+
+// An operand as a value or an array, for operators and functions that work on
+// each element of an array.  Ranges are arrays only in array formulas.
+operand xlevaluator::prepare(const operand& x, const cellposition& at) const {
+  if (x.kind_ != operand::REFERENCE)
+    return x;
+  if (at.array_ && (x.rows_ > 1 || x.cols_ > 1))
+    return materialise(x);
+  return valueOperand(scalar(x, at));
+}
+
+// Applies f to the values of the arguments, or to each element of any arrays
+// among them.  Arrays of different sizes are extended to the largest, either
+// by repeating a single row or column, or with #N/A.
+template <typename Function>
+operand xlevaluator::lift(std::vector<operand>& args, const cellposition& at,
+                         Function f) const {
+  int rows = 1;
+  int cols = 1;
+  bool arrays = false;
+  for (size_t i = 0; i < args.size(); ++i) {
+    args[i] = prepare(args[i], at);
+    if (args[i].kind_ == operand::ARRAY) {
+      arrays = true;
+      rows = std::max(rows, args[i].rows_);
+      cols = std::max(cols, args[i].cols_);
+    }
+  }
+  std::vector<cellvalue> values(args.size());
+  if (!arrays) {
+    for (size_t i = 0; i < args.size(); ++i)
+      values[i] = args[i].value_;
+    return valueOperand(f(values));
+  }
+  operand out = arrayOperand(rows, cols);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      for (size_t i = 0; i < args.size(); ++i) {
+        const operand& x = args[i];
+        if (x.kind_ != operand::ARRAY) {
+          values[i] = x.value_;
+          continue;
+        }
+        int r2 = x.rows_ == 1 ? 0 : r;
+        int c2 = x.cols_ == 1 ? 0 : c;
+        values[i] = r2 < x.rows_ && c2 < x.cols_
+          ? x.array_[(size_t)r2 * x.cols_ + c2]
+          : errorValue("#N/A");
+      }
+      out.array_[(size_t)r * cols + c] = f(values);
+    }
+  }
+  return out;
+}
+
+template <typename Function>
+operand xlevaluator::lift1(const operand& x, const cellposition& at,
+                          Function f) const {
+  operand y = prepare(x, at);
+  if (y.kind_ == operand::VALUE)
+    return valueOperand(f(y.value_));
+  for (size_t i = 0; i < y.array_.size(); ++i)
+    y.array_[i] = f(y.array_[i]);
+  return y;
+}
+
+static cellvalue arithmetic(char op, const cellvalue& a, const cellvalue& b) {
+  double x, y;
+  cellvalue error;
+  if (!toNumber(a, x, error) || !toNumber(b, y, error))
+    return error;
+  switch (op) {
+    case '+': return checkNumber(x + y);
+    case '-': return checkNumber(x - y);
+    case '*': return checkNumber(x * y);
+    case '/':
+      if (y == 0)
+        return errorValue("#DIV/0!");
+      return checkNumber(x / y);
+    default: // '^'
+      if (x == 0 && y == 0)
+        return errorValue("#NUM!");
+      if (x == 0 && y < 0)
+        return errorValue("#DIV/0!");
+      return checkNumber(std::pow(x, y));
+  }
+}
+
+static cellvalue comparison(char op, const cellvalue& a, const cellvalue& b) {
+  if (a.isError())
+    return a;
+  if (b.isError())
+    return b;
+  int order = compareValues(a, b);
+  switch (op) {
+    case '=': return boolValue(order == 0);
+    case 'n': return boolValue(order != 0);
+    case '<': return boolValue(order < 0);
+    case '>': return boolValue(order > 0);
+    case 'l': return boolValue(order <= 0);
+    default: return boolValue(order >= 0);
+  }
+}
+
+static cellvalue concatenation(const cellvalue& a, const cellvalue& b) {
+  std::string x, y;
+  cellvalue error;
+  if (!toText(a, x, error) || !toText(b, y, error))
+    return error;
+  return textValue(x + y);
+}
+
+operand xlevaluator::infix(char op, const operand& a, const operand& b,
+                           const cellposition& at) const {
+  switch (op) {
+    case ':':
+    case ' ': {
+      if (a.kind_ != operand::REFERENCE || b.kind_ != operand::REFERENCE
+          || a.ref_.sheet_ != b.ref_.sheet_)
+        return errorOperand("#VALUE!");
+      cellrange range = a.ref_;
+      if (op == ':') {
+        range.first_row_ = std::min(a.ref_.first_row_, b.ref_.first_row_);
+        range.first_col_ = std::min(a.ref_.first_col_, b.ref_.first_col_);
+        range.last_row_ = std::max(a.ref_.last_row_, b.ref_.last_row_);
+        range.last_col_ = std::max(a.ref_.last_col_, b.ref_.last_col_);
+      } else {
+        range.first_row_ = std::max(a.ref_.first_row_, b.ref_.first_row_);
+        range.first_col_ = std::max(a.ref_.first_col_, b.ref_.first_col_);
+        range.last_row_ = std::min(a.ref_.last_row_, b.ref_.last_row_);
+        range.last_col_ = std::min(a.ref_.last_col_, b.ref_.last_col_);
+        if (range.first_row_ > range.last_row_
+            || range.first_col_ > range.last_col_)
+          return errorOperand("#NULL!");
+      }
+      return referenceOperand(range);
+    }
+    case ',':
+      return errorOperand("#VALUE!"); // unions aren't supported()
+    default:
+      break;
+  }
+  std::vector<operand> args;
+  args.push_back(a);
+  args.push_back(b);
+  return lift(args, at, [op](const std::vector<cellvalue>& x) -> cellvalue {
+    switch (op) {
+      case '&':
+        return concatenation(x[0], x[1]);
+      case '=': case 'n': case '<': case '>': case 'l': case 'g':
+        return comparison(op, x[0], x[1]);
+      default:
+        return arithmetic(op, x[0], x[1]);
+    }
+  });
+}
+
+operand xlevaluator::evaluate(const xlformula& f, int k, const cellposition& at) {
+  if (k < 0)
+    return valueOperand(blankValue());
+  const expr& e = f.exprs_[k];
+  switch (e.kind_) {
+    case expr_kind::CONSTANT:
+      return valueOperand(e.value_);
+    case expr_kind::MISSING:
+      return valueOperand(blankValue());
+    case expr_kind::REF: {
+      cellrange range = e.range_;
+      if (range.sheet_ < 0)
+        range.sheet_ = at.sheet_;
+      return referenceOperand(range);
+    }
+    case expr_kind::NAME: {
+      const xlformula* name = context_.name(e.name_);
+      if (name == NULL || depth_ > 32) // a name that refers to itself
+        return errorOperand("#NAME?");
+      ++depth_;
+      operand out = evaluate(*name, name->root_, at);
+      --depth_;
+      return out;
+    }
+    case expr_kind::PREFIX: {
+      operand x = evaluate(f, e.args_[0], at);
+      if (e.op_ == '+')
+        return x;
+      return lift1(x, at, [](const cellvalue& v) {
+        return arithmetic('*', v, numberValue(-1));
+      });
+    }
+    case expr_kind::POSTFIX: {
+      operand x = evaluate(f, e.args_[0], at);
+      return lift1(x, at, [](const cellvalue& v) {
+        return arithmetic('/', v, numberValue(100));
+      });
+    }
+    case expr_kind::INFIX: {
+      operand a = evaluate(f, e.args_[0], at);
+      operand b = evaluate(f, e.args_[1], at);
+      return infix(e.op_, a, b, at);
+    }
+    case expr_kind::ARRAY: {
+      operand out = arrayOperand(e.rows_, e.cols_);
+      for (size_t i = 0; i < e.args_.size(); ++i) {
+        out.array_[i] = e.args_[i] < 0
+          ? errorValue("#N/A")
+          : scalar(evaluate(f, e.args_[i], at), at);
+      }
+      return out;
+    }
+    default:
+      return call(f, e, at);
+  }
+}
+
+// SUM(), COUNT() and the like.  Ranges and arrays contribute only their
+// numbers, but values given directly are converted if they can be.
+operand xlevaluator::aggregate(int function, const xlformula& f, const expr& e,
+                               const cellposition& at) {
+  double total = function == FN_PRODUCT ? 1 : 0;
+  double extreme = function == FN_MIN ? INFINITY : -INFINITY;
+  double count = 0;
+  std::vector<const cellvalue*> values;
+  for (size_t i = 0; i < e.args_.size(); ++i) {
+    if (missing(f, e, i))
+      continue;
+    operand x = evaluate(f, e.args_[i], at);
+    bool direct = x.kind_ == operand::VALUE;
+    values.clear();
+    if (x.kind_ == operand::REFERENCE) {
+      context_.values(x.ref_, values);
+      if (function == FN_COUNTBLANK) {
+        double area = (double)x.rows_ * x.cols_;
+        for (size_t j = 0; j < values.size(); ++j) {
+          const cellvalue& v = *values[j];
+          if (!(v.type_ == value_type::TEXT && v.text_.empty()))
+            --area;
+        }
+        return valueOperand(numberValue(area));
+      }
+    } else {
+      for (size_t j = 0; j < x.array_.size(); ++j)
+        values.push_back(&x.array_[j]);
+      if (direct)
+        values.push_back(&x.value_);
+      if (function == FN_COUNTBLANK)
+        return errorOperand("#VALUE!");
+    }
+    for (size_t j = 0; j < values.size(); ++j) {
+      const cellvalue& v = *values[j];
+      if (function == FN_COUNTA) {
+        if (v.type_ != value_type::BLANK || direct)
+          ++count;
+        continue;
+      }
+      double number;
+      if (v.type_ == value_type::NUMBER) {
+        number = v.number_;
+      } else if (direct && v.type_ != value_type::ERROR_VALUE) {
+        cellvalue error;
+        if (!toNumber(v, number, error)) {
+          if (function == FN_COUNT)
+            continue;
+          return valueOperand(error);
+        }
+      } else if (v.isError() && function != FN_COUNT) {
+        return valueOperand(v);
+      } else {
+        continue;
+      }
+      ++count;
+      total = function == FN_PRODUCT ? total * number : total + number;
+      extreme = function == FN_MIN
+        ? std::min(extreme, number) : std::max(extreme, number);
+    }
+  }
+  switch (function) {
+    case FN_SUM:
+      return valueOperand(checkNumber(total));
+    case FN_PRODUCT:
+      return valueOperand(checkNumber(count == 0 ? 0 : total));
+    case FN_MIN:
+    case FN_MAX:
+      return valueOperand(numberValue(count == 0 ? 0 : extreme));
+    case FN_AVERAGE:
+      if (count == 0)
+        return errorOperand("#DIV/0!");
+      return valueOperand(checkNumber(total / count));
+    default: // FN_COUNT, FN_COUNTA
+      return valueOperand(numberValue(count));
+  }
+}
+
+// AND() and OR(), which take logicals from ranges and arrays much as SUM()
+// takes numbers
+operand xlevaluator::logical(int function, const xlformula& f, const expr& e,
+                             const cellposition& at) {
+  bool any = false;
+  bool out = function == FN_AND;
+  std::vector<const cellvalue*> values;
+  for (size_t i = 0; i < e.args_.size(); ++i) {
+    if (missing(f, e, i))
+      continue;
+    operand x = evaluate(f, e.args_[i], at);
+    values.clear();
+    if (x.kind_ == operand::REFERENCE)
+      context_.values(x.ref_, values);
+    for (size_t j = 0; j < x.array_.size(); ++j)
+      values.push_back(&x.array_[j]);
+    if (x.kind_ == operand::VALUE) {
+      bool b;
+      cellvalue error;
+      if (!toBool(x.value_, b, error))
+        return valueOperand(error);
+      any = true;
+      out = function == FN_AND ? out && b : out || b;
+      continue;
+    }
+    for (size_t j = 0; j < values.size(); ++j) {
+      const cellvalue& v = *values[j];
+      if (v.isError())
+        return valueOperand(v);
+      if (v.type_ != value_type::NUMBER && v.type_ != value_type::BOOL)
+        continue;
+      any = true;
+      out = function == FN_AND ? out && v.number_ != 0 : out || v.number_ != 0;
+    }
+  }
+  if (!any)
+    return errorOperand("#VALUE!");
+  return valueOperand(boolValue(out));
+}
+
+// The position of a value in row or column line of a table, searching the
+// first n elements.  type 0 is an exact match; 1 is the largest value that is
+// no greater, in ascending order; -1 is the smallest value that is no less,
+// in descending order.  Returns -1 if there isn't one.
+int xlevaluator::findInLine(const cellvalue& wanted, const grid& g,
+                            bool by_row, int line, int n, int type) const {
+  auto element = [&](int i) -> const cellvalue& {
+    return by_row ? g.at(line, i) : g.at(i, line);
+  };
+  if (type == 0) {
+    for (int i = 0; i < n; ++i) {
+      if (lookupEqual(wanted, element(i)))
+        return i;
+    }
+    return -1;
+  }
+  if (type < 0) {
+    int found = -1;
+    for (int i = 0; i < n; ++i) {
+      const cellvalue& x = element(i);
+      if (x.type_ != wanted.type_)
+        continue;
+      if (compareValues(x, wanted) < 0)
+        break;
+      found = i;
+    }
+    return found;
+  }
+  // A binary search, skipping values of other types, as Excel does
+  int found = -1;
+  int low = 0;
+  int high = n - 1;
+  while (low <= high) {
+    int middle = low + (high - low) / 2;
+    int i = middle;
+    while (i >= low && element(i).type_ != wanted.type_)
+      --i;
+    if (i < low) {
+      low = middle + 1;
+      continue;
+    }
+    if (compareValues(element(i), wanted) <= 0) {
+      found = i;
+      low = middle + 1;
+    } else {
+      high = i - 1;
+    }
+  }
+  return found;
+}
+
+// MATCH(), VLOOKUP() and HLOOKUP()
+operand xlevaluator::lookup(int function, const xlformula& f, const expr& e,
+                            const cellposition& at) {
+  cellvalue wanted = scalar(argument(f, e, 0, at), at);
+  if (wanted.isError())
+    return valueOperand(wanted);
+  if (wanted.type_ == value_type::BLANK)
+    return errorOperand("#N/A");
+  operand table = argument(f, e, 1, at);
+  grid g(table, context_);
+  size_t last = function == FN_MATCH ? 2 : 3;
+  int type = 1;
+  if (!missing(f, e, last)) {
+    cellvalue x = scalar(argument(f, e, last, at), at);
+    double number;
+    cellvalue error;
+    if (function == FN_MATCH) {
+      if (!toNumber(x, number, error))
+        return valueOperand(error);
+      type = number > 0 ? 1 : (number < 0 ? -1 : 0);
+    } else {
+      bool approximate;
+      if (!toBool(x, approximate, error))
+        return valueOperand(error);
+      type = approximate ? 1 : 0;
+    }
+  }
+  if (function == FN_MATCH) {
+    bool by_row = g.rows() == 1;
+    if (!by_row && g.cols() != 1)
+      return errorOperand("#N/A");
+    int n = by_row ? g.searchCols() : g.searchRows();
+    int i = findInLine(wanted, g, by_row, 0, n, type);
+    if (i < 0)
+      return errorOperand("#N/A");
+    return valueOperand(numberValue(i + 1));
+  }
+  double number;
+  cellvalue error;
+  if (!toNumber(scalar(argument(f, e, 2, at), at), number, error))
+    return valueOperand(error);
+  int other = truncateInt(number);
+  bool by_row = function == FN_HLOOKUP;
+  if (other < 1)
+    return errorOperand("#VALUE!");
+  if (other > (by_row ? g.rows() : g.cols()))
+    return errorOperand("#REF!");
+  int n = by_row ? g.searchCols() : g.searchRows();
+  int i = findInLine(wanted, g, by_row, 0, n, type);
+  if (i < 0)
+    return errorOperand("#N/A");
+  return valueOperand(by_row ? g.at(other - 1, i) : g.at(i, other - 1));
+}
+
+// INDEX() of a range gives a range, so that it can be used wherever a range
+// can, e.g. INDEX(A:A, 3):A10
+operand xlevaluator::index(const xlformula& f, const expr& e,
+                           const cellposition& at) {
+  operand x = argument(f, e, 0, at);
+  if (x.kind_ == operand::VALUE && x.value_.isError())
+    return x;
+  double numbers[2] = {0, 0};
+  for (size_t i = 1; i <= 2; ++i) {
+    if (missing(f, e, i))
+      continue;
+    cellvalue error;
+    if (!toNumber(scalar(argument(f, e, i, at), at), numbers[i - 1], error))
+      return valueOperand(error);
+  }
+  int row = truncateInt(numbers[0]);
+  int col = truncateInt(numbers[1]);
+  if (e.args_.size() == 2 && x.rows_ == 1) {
+    col = row; // INDEX(A1:E1, 3) is C1
+    row = 0;
+  }
+  if (row < 0 || col < 0)
+    return errorOperand("#VALUE!");
+  if (row > x.rows_ || col > x.cols_)
+    return errorOperand("#REF!");
+  if (x.kind_ == operand::REFERENCE) {
+    cellrange range = x.ref_;
+    if (row > 0) {
+      range.first_row_ += row - 1;
+      range.last_row_ = range.first_row_;
+    }
+    if (col > 0) {
+      range.first_col_ += col - 1;
+      range.last_col_ = range.first_col_;
+    }
+    return referenceOperand(range);
+  }
+  if (x.kind_ == operand::VALUE)
+    return x;
+  int rows = row > 0 ? 1 : x.rows_;
+  int cols = col > 0 ? 1 : x.cols_;
+  operand out = arrayOperand(rows, cols);
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      int i2 = row > 0 ? row - 1 : i;
+      int j2 = col > 0 ? col - 1 : j;
+      out.array_[(size_t)i * cols + j] = x.array_[(size_t)i2 * x.cols_ + j2];
+    }
+  }
+  if (rows == 1 && cols == 1)
+    return valueOperand(out.array_[0]);
+  return out;
+}
+
+// SUMIF() and COUNTIF()
+operand xlevaluator::conditional(int function, const xlformula& f,
+                                 const expr& e, const cellposition& at) {
+  operand range = argument(f, e, 0, at);
+  criterion c = parseCriterion(scalar(argument(f, e, 1, at), at));
+  if (c.value_.isError())
+    return valueOperand(c.value_);
+  operand sums = missing(f, e, 2) ? range : argument(f, e, 2, at);
+  if (sums.kind_ == operand::REFERENCE) {
+    // The range to sum is the size of the range to test, from its own corner
+    sums.ref_.last_row_ = sums.ref_.first_row_ + range.rows_ - 1;
+    sums.ref_.last_col_ = sums.ref_.first_col_ + range.cols_ - 1;
+    sums.rows_ = range.rows_;
+    sums.cols_ = range.cols_;
+  }
+  grid tested(range, context_);
+  grid summed(sums, context_);
+  int rows = tested.searchRows();
+  int cols = tested.searchCols();
+  double total = 0;
+  double count = 0;
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      if (!meetsCriterion(c, tested.at(i, j)))
+        continue;
+      ++count;
+      if (function == FN_SUMIF && i < summed.rows() && j < summed.cols()) {
+        const cellvalue& v = summed.at(i, j);
+        if (v.isError())
+          return valueOperand(v);
+        if (v.type_ == value_type::NUMBER)
+          total += v.number_;
+      }
+    }
+  }
+  // Cells beyond the last of the sheet are blank
+  if (meetsCriterion(c, blankValue()))
+    count += (double)tested.rows() * tested.cols() - (double)rows * cols;
+  if (function == FN_COUNTIF)
+    return valueOperand(numberValue(count));
+  return valueOperand(checkNumber(total));
+}
+
+// SUMPRODUCT() treats its arguments as arrays, even outside array formulas
+operand xlevaluator::sumproduct(const xlformula& f, const expr& e,
+                                const cellposition& at) {
+  cellposition array_at = at;
+  array_at.array_ = true;
+  std::vector<operand> args;
+  for (size_t i = 0; i < e.args_.size(); ++i) {
+    operand x = argument(f, e, i, array_at);
+    args.push_back(x.kind_ == operand::REFERENCE ? materialise(x) : x);
+    if (args[i].kind_ == operand::VALUE) {
+      if (args[i].value_.isError())
+        return args[i];
+      args[i] = arrayOperand(1, 1);
+      args[i].array_[0] = x.value_;
+    }
+    if (args[i].rows_ != args[0].rows_ || args[i].cols_ != args[0].cols_)
+      return errorOperand("#VALUE!");
+  }
+  double total = 0;
+  size_t n = args.empty() ? 0 : args[0].array_.size();
+  for (size_t j = 0; j < n; ++j) {
+    double product = 1;
+    for (size_t i = 0; i < args.size(); ++i) {
+      const cellvalue& v = args[i].array_[j];
+      if (v.isError())
+        return valueOperand(v);
+      product *= v.type_ == value_type::NUMBER ? v.number_ : 0;
+    }
+    total += product;
+  }
+  return valueOperand(checkNumber(total));
+}
+
+operand xlevaluator::call(const xlformula& f, const expr& e,
+                          const cellposition& at) {
+  int function = e.function_;
+  switch (function) {
+    case FN_SUM: case FN_PRODUCT: case FN_MIN: case FN_MAX: case FN_AVERAGE:
+    case FN_COUNT: case FN_COUNTA: case FN_COUNTBLANK:
+      return aggregate(function, f, e, at);
+    case FN_AND: case FN_OR:
+      return logical(function, f, e, at);
+    case FN_MATCH: case FN_VLOOKUP: case FN_HLOOKUP:
+      return lookup(function, f, e, at);
+    case FN_INDEX:
+      return index(f, e, at);
+    case FN_SUMIF: case FN_COUNTIF:
+      return conditional(function, f, e, at);
+    case FN_SUMPRODUCT:
+      return sumproduct(f, e, at);
+    case FN_TRUE:
+      return valueOperand(boolValue(true));
+    case FN_FALSE:
+      return valueOperand(boolValue(false));
+    case FN_NA:
+      return errorOperand("#N/A");
+    case FN_PI:
+      return valueOperand(numberValue(3.14159265358979323846));
+    case FN_IF: {
+      operand condition = prepare(argument(f, e, 0, at), at);
+      if (condition.kind_ == operand::ARRAY) {
+        std::vector<operand> args;
+        args.push_back(condition);
+        args.push_back(argument(f, e, 1, at));
+        args.push_back(e.args_.size() < 3 ? valueOperand(boolValue(false))
+                                          : argument(f, e, 2, at));
+        return lift(args, at, [](const std::vector<cellvalue>& x) -> cellvalue {
+          bool b;
+          cellvalue error;
+          if (!toBool(x[0], b, error))
+            return error;
+          return b ? x[1] : x[2];
+        });
+      }
+      bool b;
+      cellvalue error;
+      if (!toBool(condition.value_, b, error))
+        return valueOperand(error);
+      size_t chosen = b ? 1 : 2;
+      if (chosen >= e.args_.size())
+        return valueOperand(boolValue(false));
+      return argument(f, e, chosen, at);
+    }
+    case FN_IFERROR:
+    case FN_IFNA: {
+      operand x = prepare(argument(f, e, 0, at), at);
+      auto caught = [function](const cellvalue& v) {
+        return v.isError() && (function == FN_IFERROR || v.text_ == "#N/A");
+      };
+      if (x.kind_ == operand::VALUE)
+        return caught(x.value_) ? argument(f, e, 1, at) : x;
+      cellvalue alternative = scalar(argument(f, e, 1, at), at);
+      for (size_t i = 0; i < x.array_.size(); ++i) {
+        if (caught(x.array_[i]))
+          x.array_[i] = alternative;
+      }
+      return x;
+    }
+    case FN_CHOOSE: {
+      double number;
+      cellvalue error;
+      if (!toNumber(scalar(argument(f, e, 0, at), at), number, error))
+        return valueOperand(error);
+      int chosen = truncateInt(number);
+      if (chosen < 1 || (size_t)chosen >= e.args_.size())
+        return errorOperand("#VALUE!");
+      return argument(f, e, chosen, at);
+    }
+    case FN_ROW:
+    case FN_COLUMN: {
+      if (missing(f, e, 0))
+        return valueOperand(numberValue(function == FN_ROW ? at.row_ : at.col_));
+      operand x = argument(f, e, 0, at);
+      if (x.kind_ != operand::REFERENCE)
+        return errorOperand("#VALUE!");
+      return valueOperand(numberValue(function == FN_ROW
+                                      ? x.ref_.first_row_ : x.ref_.first_col_));
+    }
+    case FN_ROWS:
+    case FN_COLUMNS: {
+      operand x = argument(f, e, 0, at);
+      if (x.kind_ == operand::VALUE && x.value_.isError())
+        return x;
+      return valueOperand(numberValue(function == FN_ROWS ? x.rows_ : x.cols_));
+    }
+    default:
+      break;
+  }
+
+  // The rest work on one value at a time, or on each element of arrays
+  std::vector<operand> args;
+  for (size_t i = 0; i < e.args_.size(); ++i)
+    args.push_back(argument(f, e, i, at));
+  size_t n_args = args.size();
+  return lift(args, at,
+              [function, n_args](const std::vector<cellvalue>& x) -> cellvalue {
+    double a = 0;
+    double b = 0;
+    cellvalue error;
+    std::string text;
+    switch (function) {
+      case FN_ISBLANK: return boolValue(x[0].type_ == value_type::BLANK);
+      case FN_ISNUMBER: return boolValue(x[0].type_ == value_type::NUMBER);
+      case FN_ISTEXT: return boolValue(x[0].type_ == value_type::TEXT);
+      case FN_ISLOGICAL: return boolValue(x[0].type_ == value_type::BOOL);
+      case FN_ISERROR: return boolValue(x[0].isError());
+      case FN_ISERR: return boolValue(x[0].isError() && x[0].text_ != "#N/A");
+      case FN_ISNA: return boolValue(x[0].isError() && x[0].text_ == "#N/A");
+      case FN_NOT: {
+        bool value;
+        if (!toBool(x[0], value, error))
+          return error;
+        return boolValue(!value);
+      }
+      case FN_CONCATENATE: {
+        std::string out;
+        for (size_t i = 0; i < x.size(); ++i) {
+          if (!toText(x[i], text, error))
+            return error;
+          out += text;
+        }
+        return textValue(out);
+      }
+      case FN_LEN: case FN_UPPER: case FN_LOWER: case FN_TRIM:
+      case FN_LEFT: case FN_RIGHT: case FN_MID: {
+        if (!toText(x[0], text, error))
+          return error;
+        for (size_t i = 1; i < x.size(); ++i) {
+          if (!toNumber(x[i], i == 1 ? a : b, error))
+            return error;
+        }
+        switch (function) {
+          case FN_LEN:
+            return numberValue(countChars(text));
+          case FN_UPPER:
+          case FN_LOWER:
+            for (size_t i = 0; i < text.size(); ++i) {
+              text[i] = function == FN_UPPER
+                ? std::toupper((unsigned char)text[i])
+                : std::tolower((unsigned char)text[i]);
+            }
+            return textValue(text);
+          case FN_TRIM: {
+            std::string out;
+            for (size_t i = 0; i < text.size(); ++i) {
+              if (text[i] == ' ' && (out.empty() || out[out.size() - 1] == ' '))
+                continue;
+              out += text[i];
+            }
+            if (!out.empty() && out[out.size() - 1] == ' ')
+              out.erase(out.size() - 1);
+            return textValue(out);
+          }
+          case FN_LEFT:
+          case FN_RIGHT: {
+            int count = n_args < 2 ? 1 : truncateInt(a);
+            if (count < 0)
+              return errorValue("#VALUE!");
+            size_t total = countChars(text);
+            size_t k = std::min((size_t)count, total);
+            if (function == FN_LEFT)
+              return textValue(text.substr(0, charOffset(text, k)));
+            return textValue(text.substr(charOffset(text, total - k)));
+          }
+          default: { // FN_MID
+            int start = truncateInt(a);
+            int count = truncateInt(b);
+            if (start < 1 || count < 0)
+              return errorValue("#VALUE!");
+            size_t first = charOffset(text, (size_t)start - 1);
+            size_t last = charOffset(text, (size_t)start - 1 + (size_t)count);
+            return textValue(text.substr(first, last - first));
+          }
+        }
+      }
+      default:
+        break;
+    }
+
+    // Functions of numbers
+    if (!toNumber(x[0], a, error))
+      return error;
+    if (x.size() > 1 && !toNumber(x[1], b, error))
+      return error;
+    switch (function) {
+      case FN_ABS: return numberValue(std::fabs(a));
+      case FN_INT: return numberValue(std::floor(a));
+      case FN_SIGN: return numberValue(a > 0 ? 1 : (a < 0 ? -1 : 0));
+      case FN_EXP: return checkNumber(std::exp(a));
+      case FN_SQRT:
+        return a < 0 ? errorValue("#NUM!") : numberValue(std::sqrt(a));
+      case FN_LN:
+        return a <= 0 ? errorValue("#NUM!") : checkNumber(std::log(a));
+      case FN_LOG10:
+        return a <= 0 ? errorValue("#NUM!") : checkNumber(std::log10(a));
+      case FN_POWER: return arithmetic('^', numberValue(a), numberValue(b));
+      case FN_MOD:
+        if (b == 0)
+          return errorValue("#DIV/0!");
+        return checkNumber(a - b * std::floor(a / b));
+      case FN_ROUND: return checkNumber(roundDigits(a, b, 0));
+      case FN_ROUNDUP: return checkNumber(roundDigits(a, b, 1));
+      case FN_ROUNDDOWN: return checkNumber(roundDigits(a, b, -1));
+      default: return errorValue("#NAME?");
+    }
+  });
+}
+
+operand xlformula::evaluate(const xlcontext& context,
+                            const cellposition& at) const {
+  return xlevaluator(context).evaluate(*this, root_, at);
+}
+
+cellvalue resultValue(const operand& x, const xlcontext& context,
+                      const cellposition& at, int i, int j) {
+  cellvalue out;
+  if (!at.array_ || x.kind_ == operand::VALUE) {
+    out = xlevaluator(context).scalar(x, at);
+  } else {
+    // A single row or column is repeated to fill the range of the formula
+    int i2 = x.rows_ == 1 ? 0 : i;
+    int j2 = x.cols_ == 1 ? 0 : j;
+    if (i2 >= x.rows_ || j2 >= x.cols_)
+      out = errorValue("#N/A");
+    else
+      out = grid(x, context).at(i2, j2);
+  }
+  if (out.type_ == value_type::BLANK)
+    out = numberValue(0);
+  return out;
+}
+
+// Compilation ---------------------------------------------------------------
+
+class xlcompiler {
+
+  public:
+
+    xlcompiler(xlformula& f, const char* formula, const std::vector<token>& tokens,
+               const std::vector<treenode>& nodes,
+               const xlsxdependencies& graph):
+      f_(f), formula_(formula), tokens_(tokens), nodes_(nodes), graph_(graph),
+      children_(tokens.size() + 1) {
+      // The children of each node, and the roots at the end, by their number
+      for (size_t k = 0; k < nodes.size(); ++k) {
+        node_kind kind = nodes[k].kind_;
+        if (kind == node_kind::PUNCTUATION || kind == node_kind::SPACE)
+          continue;
+        int parent = nodes[k].parent_;
+        children_[parent == 0 ? nodes.size() : parent - 1].push_back(k);
+      }
+      for (size_t k = 0; k < children_.size(); ++k) {
+        std::sort(children_[k].begin(), children_[k].end(),
+                  [&nodes](int a, int b) {
+                    return nodes[a].child_ < nodes[b].child_;
+                  });
+      }
+    }
+
+    int compileRoot(int sheet) {
+      const std::vector<int>& roots = children_.back();
+      if (roots.size() != 1) {
+        f_.supported_ = false;
+        return constant(errorValue("#NAME?"));
+      }
+      return compile(roots[0], sheet);
+    }
+
+  private:
+
+    typedef xlformula::expr expr;
+    typedef xlformula::expr_kind expr_kind;
+
+    xlformula& f_;
+    const char* formula_;
+    const std::vector<token>& tokens_;
+    const std::vector<treenode>& nodes_;
+    const xlsxdependencies& graph_;
+    std::vector<std::vector<int> > children_;
+
+    std::string text(int k) const {
+      return std::string(formula_ + tokens_[k].offset_, tokens_[k].length_);
+    }
+
+    int add(expr_kind kind) {
+      expr e;
+      e.kind_ = kind;
+      e.op_ = 0;
+      e.function_ = -1;
+      e.name_ = -1;
+      e.range_.sheet_ = -1;
+      e.rows_ = 0;
+      e.cols_ = 0;
+      e.value_ = blankValue();
+      f_.exprs_.push_back(e);
+      return f_.exprs_.size() - 1;
+    }
+
+    int constant(const cellvalue& x) {
+      int k = add(expr_kind::CONSTANT);
+      f_.exprs_[k].value_ = x;
+      return k;
+    }
+
+    int unsupported() {
+      f_.supported_ = false;
+      return constant(errorValue("#NAME?"));
+    }
+
+    // The children of node k, with -1 for the positions of empty arguments,
+    // and n at least the number of positions given by the separators
+    std::vector<int> positions(int k, size_t n) const {
+      std::vector<int> out(n, -1);
+      const std::vector<int>& children = children_[k];
+      for (size_t i = 0; i < children.size(); ++i) {
+        size_t position = nodes_[children[i]].child_;
+        if (position > out.size())
+          out.resize(position, -1);
+        out[position - 1] = children[i];
+      }
+      return out;
+    }
+
+    // Separators attached to node k, in order
+    std::vector<char> separators(int k) const {
+      std::vector<char> out;
+      for (size_t i = k + 1; i < nodes_.size(); ++i) {
+        if (nodes_[i].parent_ == k + 1 && nodes_[i].kind_ == node_kind::PUNCTUATION
+            && tokens_[i].type_ == token_type::SEPARATOR)
+          out.push_back(formula_[tokens_[i].offset_]);
+      }
+      return out;
+    }
+
+    // Compiles node k on sheet (-1 for the sheet of the cell)
+    int compile(int k, int sheet) {
+      const treenode& node = nodes_[k];
+      const std::vector<int>& children = children_[k];
+      switch (node.kind_) {
+        case node_kind::OPERAND:
+          return leaf(k, sheet);
+        case node_kind::SHEET: {
+          int first, last;
+          std::string x = text(k);
+          if (children.empty() || !graph_.parseSheets(x.data(), x.size(), first, last)
+              || first != last)
+            return unsupported();
+          return compile(children[0], first);
+        }
+        case node_kind::GROUP:
+          if (children.empty())
+            return add(expr_kind::MISSING);
+          return compile(children[0], sheet);
+        case node_kind::PREFIX:
+        case node_kind::POSTFIX: {
+          char op = formula_[tokens_[k].offset_];
+          int operand = children.empty() ? add(expr_kind::MISSING)
+                                         : compile(children[0], sheet);
+          if (node.kind_ == node_kind::PREFIX && op != '+' && op != '-')
+            return operand; // e.g. the '=' of "=A1"
+          int e = add(node.kind_ == node_kind::PREFIX ? expr_kind::PREFIX
+                                                      : expr_kind::POSTFIX);
+          f_.exprs_[e].op_ = op;
+          f_.exprs_[e].args_.push_back(operand);
+          return e;
+        }
+        case node_kind::INFIX: {
+          std::string x = text(k);
+          char op = x[0];
+          if (x == "<=") op = 'l';
+          else if (x == ">=") op = 'g';
+          else if (x == "<>") op = 'n';
+          if (op == ',')
+            f_.supported_ = false;
+          std::vector<int> operands = positions(k, 2);
+          int e = add(expr_kind::INFIX);
+          f_.exprs_[e].op_ = op;
+          for (size_t i = 0; i < 2; ++i) {
+            int operand = operands[i] < 0 ? add(expr_kind::MISSING)
+                                          : compile(operands[i], sheet);
+            f_.exprs_[e].args_.push_back(operand);
+          }
+          return e;
+        }
+        case node_kind::FUNCTION: {
+          int function = findFunction(text(k));
+          size_t n_separators = separators(k).size();
+          std::vector<int> args =
+            positions(k, children.empty() && n_separators == 0
+                           ? 0 : n_separators + 1);
+          if (function < 0 || (int)args.size() < functions[function].min_
+              || (int)args.size() > functions[function].max_)
+            return unsupported();
+          int e = add(expr_kind::FUNCTION);
+          f_.exprs_[e].function_ = function;
+          for (size_t i = 0; i < args.size(); ++i) {
+            int arg = args[i] < 0 ? add(expr_kind::MISSING)
+                                  : compile(args[i], sheet);
+            f_.exprs_[e].args_.push_back(arg);
+          }
+          return e;
+        }
+        case node_kind::ARRAY: {
+          // Rows are separated by semicolons, elements by commas
+          std::vector<char> seps = separators(k);
+          std::vector<int> elements = positions(k, seps.size() + 1);
+          std::vector<std::vector<int> > rows(1);
+          for (size_t i = 0; i < elements.size(); ++i) {
+            rows.back().push_back(elements[i]);
+            if (i < seps.size() && seps[i] == ';')
+              rows.push_back(std::vector<int>());
+          }
+          size_t cols = 0;
+          for (size_t i = 0; i < rows.size(); ++i)
+            cols = std::max(cols, rows[i].size());
+          std::vector<int> compiled;
+          for (size_t i = 0; i < rows.size(); ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+              int element = j < rows[i].size() ? rows[i][j] : -1;
+              compiled.push_back(element < 0 ? -1
+                                             : compile(element, sheet));
+            }
+          }
+          int e = add(expr_kind::ARRAY);
+          f_.exprs_[e].rows_ = rows.size();
+          f_.exprs_[e].cols_ = cols;
+          f_.exprs_[e].args_ = compiled;
+          return e;
+        }
+        default:
+          return unsupported();
+      }
+    }
+
+    int leaf(int k, int sheet) {
+      std::string x = text(k);
+      switch (tokens_[k].type_) {
+        case token_type::NUMBER: {
+          double number;
+          if (!parseNumber(x, number))
+            return unsupported();
+          return constant(numberValue(number));
+        }
+        case token_type::TEXT: {
+          std::string out;
+          for (size_t i = 1; i + 1 < x.size(); ++i) {
+            out += x[i];
+            if (x[i] == '"' && x[i + 1] == '"')
+              ++i; // quotes are escaped by doubling
+          }
+          return constant(textValue(out));
+        }
+        case token_type::BOOL:
+          return constant(boolValue(equalsIgnoringCase(x, "TRUE")));
+        case token_type::ERROR_VALUE:
+          return constant(errorValue(x));
+        case token_type::REF: {
+          for (size_t i = 0; i < x.size(); ++i)
+            x[i] = std::toupper((unsigned char)x[i]);
+          cellrange range;
+          if (!parseRange(x.data(), x.size(), range))
+            return constant(errorValue("#REF!"));
+          int e = add(expr_kind::REF);
+          range.sheet_ = sheet;
+          f_.exprs_[e].range_ = range;
+          return e;
+        }
+        case token_type::NAME: {
+          int name = graph_.findName(sheet, x.data(), x.size());
+          if (name < 0)
+            return constant(errorValue("#NAME?"));
+          int e = add(expr_kind::NAME);
+          f_.exprs_[e].name_ = name;
+          return e;
+        }
+        default: // structured references, DDE and anything else
+          return unsupported();
+      }
+    }
+
+};
+
+xlformula::xlformula(): root_(-1), supported_(true) {}
+
+void xlformula::compile(const char* formula, size_t size, int sheet,
+                        const xlsxdependencies& graph) {
+  exprs_.clear();
+  supported_ = true;
+  std::vector<token> tokens;
+  try {
+    lexFormula(formula, size, tokens);
+  } catch (std::exception& e) {
+    tokens.clear();
+    supported_ = false;
+  }
+  std::vector<treenode> nodes(tokens.size());
+  if (!tokens.empty())
+    growTree(formula, &tokens[0], tokens.size(), &nodes[0]);
+  root_ = xlcompiler(*this, formula, tokens, nodes, graph).compileRoot(sheet);
+}
@@ -0,0 +1,124 @@
+#ifndef XLFORMULA_
+#define XLFORMULA_
+
+#include <string>
+#include <vector>
+#include "rangeindex.h"
+#include "xlvalue.h"
+
+class xlsxdependencies;
+
+// Formulas compiled from their syntax trees (see xltree.h), to be calculated
+// again and again as the cells that they refer to change.
+//
+// The functions that can be calculated are listed in xlformula.cpp.  Others,
+// such as INDIRECT(), give #NAME?, as they would in a copy of Excel without
+// them, and so do references to other workbooks, structured references to
+// tables, and three-dimensional references.  Formulas that use any of these
+// aren't supported().
+
+// The cell whose formula is being calculated.  In array formulas, ranges are
+// arrays of their values.  In others, a range where a single value is wanted
+// is implicitly intersected with the row or column of the cell.
+struct cellposition {
+  int sheet_;
+  int row_;
+  int col_;
+  bool array_;
+};
+
+// A value, an array of values, or a reference to a range of cells, which is
+// only turned into values when needed
+struct operand {
+  enum kind_type : unsigned char { VALUE, ARRAY, REFERENCE };
+
+  kind_type kind_;
+  cellvalue value_;
+  int rows_;                     // ARRAY
+  int cols_;
+  std::vector<cellvalue> array_; // by row
+  cellrange ref_;                // REFERENCE
+};
+
+class xlformula;
+
+// Where formulas get the values of cells and defined names.  Implemented by
+// xlsxmodel.
+class xlcontext {
+
+  public:
+
+    virtual ~xlcontext() {}
+
+    // The value of a cell, blank if there isn't one
+    virtual const cellvalue& value(int sheet, int row, int col) const = 0;
+
+    // Appends the values of the cells in range that aren't blank, in no
+    // particular order
+    virtual void values(const cellrange& range,
+                        std::vector<const cellvalue*>& out) const = 0;
+
+    // The last row and column of a sheet that have a cell, so that whole
+    // columns and rows needn't be searched to the end
+    virtual int lastRow(int sheet) const = 0;
+    virtual int lastCol(int sheet) const = 0;
+
+    // The formula of a defined name, by its position in the names of the
+    // dependency graph, or NULL
+    virtual const xlformula* name(int k) const = 0;
+
+};
+
+class xlformula {
+
+  public:
+
+    xlformula();
+
+    // Compiles a formula on a sheet (zero-based), looking up sheets and
+    // defined names in the graph.  A sheet of -1 is for the formulas of
+    // global names, whose unqualified refs are on the sheet of the cell whose
+    // formula uses the name.  Doesn't call R.
+    void compile(const char* formula, size_t size, int sheet,
+                 const xlsxdependencies& graph);
+
+    // Doesn't modify the formula, so several can be calculated at once
+    operand evaluate(const xlcontext& context, const cellposition& at) const;
+
+    bool supported() const { return supported_; }
+
+  private:
+
+    enum class expr_kind : unsigned char {
+      CONSTANT, REF, NAME, FUNCTION, INFIX, PREFIX, POSTFIX, ARRAY, MISSING
+    };
+
+    struct expr {
+      expr_kind kind_;
+      char op_;               // an operator, with "<=", ">=" and "<>" as
+                              // 'l', 'g' and 'n'
+      int function_;          // in the table of functions, -1 if unknown
+      int name_;              // position of a defined name, -1 if unknown
+      cellrange range_;       // of a ref, sheet -1 for the sheet of the cell
+      int rows_;              // of an array constant
+      int cols_;
+      cellvalue value_;       // of a constant
+      std::vector<int> args_; // positions of the operands in exprs_
+    };
+
+    std::vector<expr> exprs_;
+    int root_;
+    bool supported_;
+
+    friend class xlcompiler;
+    friend class xlevaluator;
+
+};
+
+// The value that a formula puts in a cell: the (i, j)th cell of an array
+// formula, or the whole result of any other, implicitly intersected with its
+// cell if it is a range.  Blanks are zero, as Excel shows them.
+cellvalue resultValue(const operand& x, const xlcontext& context,
+                      const cellposition& at, int i, int j);
+
+#endif
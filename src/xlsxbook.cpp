@@ -1,122 +1,126 @@
+#include <map>
 #include <Rcpp.h>
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxbook.h"
+#include "xlsxfile.h"
 #include "xlsxsheet.h"
 #include "xlsxstyles.h"
 #include "string.h"
+#include "parallel.h"
+#include "address.h"
+#include "dataframe.h"
 
 using namespace Rcpp;
 
-xlsxbook::xlsxbook(const std::string& path): path_(path), styles_(path_) {
-  std::string book = zip_buffer(path_, "xl/workbook.xml");
+// Codes strings as the levels of a factor, in the order they are first seen
+class factorlevels {
 
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
+  public:
 
-  rapidxml::xml_node<>* workbook = xml.first_node("workbook");
+    int code(const std::string& x) { // one-based, as in R
+      std::map<std::string, int>::iterator it = codes_.find(x);
+      if (it != codes_.end())
+        return it->second;
+      levels_.push_back(x);
+      codes_[x] = levels_.size();
+      return levels_.size();
+    }
+
+    CharacterVector levels() const {
+      CharacterVector out(levels_.size());
+      for (size_t k = 0; k < levels_.size(); ++k)
+        SET_STRING_ELT(out, k, Rf_mkCharCE(levels_[k].c_str(), CE_UTF8));
+      return out;
+    }
+
+  private:
 
-  cacheDateOffset(workbook); // Must come before cacheSheets
-  cacheStrings();
+    std::map<std::string, int> codes_;
+    std::vector<std::string> levels_;
+
+};
+
+// Makes codes into a factor
+inline SEXP asFactor(IntegerVector& codes, const CharacterVector& levels) {
+  codes.attr("levels") = levels;
+  codes.attr("class") = "factor";
+  return codes;
 }
 
 xlsxbook::xlsxbook(
-    const std::string& path,
+    xlsxfile& file,
     CharacterVector& sheet_paths,
     CharacterVector& sheet_names,
-    CharacterVector& comments_paths):
-  path_(path),
+    CharacterVector& comments_paths,
+    int threads,
+    CharacterVector& columns,
+    bool factors,
+    bool lazy_formulas,
+    IntegerVector& window):
+  file_(file),
+  path_(file.path_),
+  archive_(file.archive_),
   sheet_paths_(sheet_paths),
   sheet_names_(sheet_names),
   comments_paths_(comments_paths),
-  styles_(path_) {
-  std::string book = zip_buffer(path_, "xl/workbook.xml");
-
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
-
-  rapidxml::xml_node<>* workbook = xml.first_node("workbook");
-
-  cacheDateOffset(workbook); // Must come before cacheSheets
-  cacheStrings();
-  cacheSheetXml();
+  styles_(file.styles()),
+  strings_(file.strings()),
+  strings_formatted_(file.stringsFormatted()),
+  dateSystem_(file.dateSystem()),
+  dateOffset_(file.dateOffset()),
+  threads_(threads),
+  columns_(as<std::vector<std::string> >(columns)),
+  factors_(factors),
+  lazy_formulas_(lazy_formulas) {
+  window_.sheet_ = -1;
+  window_.first_row_ = window[0];
+  window_.first_col_ = window[1];
+  window_.last_row_ = window[2];
+  window_.last_col_ = window[3];
   createSheets();
   countCells();
   initializeColumns();
   cacheInformation();
 }
 
-// Based on hadley/readxl
-void xlsxbook::cacheStrings() {
-  if (!zip_has_file(path_, "xl/sharedStrings.xml"))
-    return;
-
-  std::string xml = zip_buffer(path_, "xl/sharedStrings.xml");
-  rapidxml::xml_document<> sharedStrings;
-  sharedStrings.parse<rapidxml::parse_strip_xml_namespaces>(&xml[0]);
-
-  rapidxml::xml_node<>* sst = sharedStrings.first_node("sst");
-  rapidxml::xml_attribute<>* uniqueCount = sst->first_attribute("uniqueCount");
-  if (uniqueCount != NULL) {
-    unsigned long int n = strtol(uniqueCount->value(), NULL, 10);
-    strings_.reserve(n);
-  }
-
-  // 18.4.8 si (String Item) [p1725]
-  for (rapidxml::xml_node<>* string = sst->first_node();
-      string; string = string->next_sibling()) {
-    std::string out;
-    parseString(string, out);    // missing strings are treated as empty ""
-    strings_.push_back(out);
-
-    Rcpp::List out_df = parseFormattedString(string, styles_);
-    strings_formatted_.push_back(out_df);
-  }
-}
-
-void xlsxbook::cacheDateOffset(rapidxml::xml_node<>* workbook) {
-  rapidxml::xml_node<>* workbookPr = workbook->first_node("workbookPr");
-  if (workbookPr != NULL) {
-    rapidxml::xml_attribute<>* date1904 = workbookPr->first_attribute("date1904");
-    if (date1904 != NULL) {
-      std::string is1904 = date1904->value();
-      if ((is1904 == "1") || (is1904 == "true")) {
-        dateSystem_ = 1904;
-        dateOffset_ = 24107;
-        return;
-      }
-    }
-  }
-
-  dateSystem_ = 1900;
-  dateOffset_ = 25569;
-}
-
-void xlsxbook::cacheSheetXml() {
-  // Loop through sheets, reading the xml into memory
-  CharacterVector::iterator in_it;
-  for(in_it = sheet_paths_.begin(); in_it != sheet_paths_.end(); ++in_it) {
-    std::string xml(*in_it);
-    sheet_xml_.push_back(zip_buffer(path_, xml));
-  }
-}
-
 void xlsxbook::createSheets() {
-  // Loop through sheets
-  std::vector<std::string>::iterator xml;
+  // Create the sheets on the main thread, because their names and paths come
+  // from R, then stream the xml of each one into the columns of its sheetdata,
+  // in parallel if threads_ > 1.
+  sheets_.reserve(sheet_paths_.size());
+  CharacterVector::iterator sheet_path;
   CharacterVector::iterator name;
   CharacterVector::iterator comments_path;
-  int i = 0;
-  for(xml = sheet_xml_.begin(),
+  for(sheet_path = sheet_paths_.begin(),
       name = sheet_names_.begin(),
       comments_path = comments_paths_.begin();
-      xml != sheet_xml_.end();
-      ++xml, ++name, ++comments_path) {
-    std::string xmlstring(*xml);
+      sheet_path != sheet_paths_.end();
+      ++sheet_path, ++name, ++comments_path) {
     String namestring(*name);
-    String comments_path_string(*comments_path);
-    sheets_.emplace_back(xlsxsheet(namestring, xmlstring, *this, comments_path_string));
-    ++i;
+    std::string comments_path_string;
+    if (*comments_path != NA_STRING)
+      comments_path_string = std::string(*comments_path);
+    sheets_.emplace_back(namestring, std::string(*sheet_path), *this,
+                         comments_path_string);
+  }
+
+  // Share the threads between the sheets, and then between the rows of each
+  // sheet, so that a workbook of one big sheet is parsed in parallel too
+  size_t n = sheets_.size();
+  int sheet_threads = n > 0 && (size_t)threads_ > n ? threads_ / n : 1;
+  parallel pool(threads_);
+  pool.run(n, [&](size_t k) { sheets_[k].parse(pool, sheet_threads); });
+
+  // Warnings can only be given on the main thread
+  for(std::vector<xlsxsheet>::iterator sheet = sheets_.begin();
+      sheet != sheets_.end();
+      ++sheet) {
+    for(std::vector<std::string>::iterator warning = sheet->warnings_.begin();
+        warning != sheet->warnings_.end();
+        ++warning) {
+      Rcpp::warning(*warning);
+    }
   }
 }
 
@@ -127,111 +131,304 @@ void xlsxbook::countCells() {
   for(sheet = sheets_.begin();
       sheet != sheets_.end();
       ++sheet) {
-    cellcount_ += sheet->cellcount_;
+    cellcount_ += sheet->data_.size();
   }
 }
 
 void xlsxbook::initializeColumns() {
-  sheet_           = CharacterVector(cellcount_, NA_STRING);
-  address_         = CharacterVector(cellcount_, NA_STRING);
-  row_             = IntegerVector(cellcount_,   NA_INTEGER);
-  col_             = IntegerVector(cellcount_,   NA_INTEGER);
-  is_blank_        = LogicalVector(cellcount_,   false);
-  data_type_       = CharacterVector(cellcount_, NA_STRING);
-  error_           = CharacterVector(cellcount_, NA_STRING);
-  logical_         = LogicalVector(cellcount_,   NA_LOGICAL);
-  numeric_         = NumericVector(cellcount_,   NA_REAL);
-  date_            = NumericVector(cellcount_,   NA_REAL);
-  date_.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
-  date_.attr("tzone") = "UTC";
-  character_       = CharacterVector(cellcount_, NA_STRING);
-  formula_         = CharacterVector(cellcount_, NA_STRING);
-  is_array_        = LogicalVector(cellcount_,   false);
-  formula_ref_     = CharacterVector(cellcount_, NA_STRING);
-  formula_group_   = IntegerVector(cellcount_,   NA_INTEGER);
-  comment_         = CharacterVector(cellcount_, NA_STRING);
-  character_formatted_ = List(cellcount_);
-  height_          = NumericVector(cellcount_,   NA_REAL);
-  width_           = NumericVector(cellcount_,   NA_REAL);
-  style_format_    = CharacterVector(cellcount_, NA_STRING);
-  local_format_id_ = IntegerVector(cellcount_,   NA_INTEGER);
+  // Only the columns that have been asked for are allocated
+  if (columns_.sheet && factors_)
+    sheet_codes_     = IntegerVector(cellcount_,   NA_INTEGER);
+  else if (columns_.sheet)
+    sheet_           = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.address)
+    address_         = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.row)
+    row_             = IntegerVector(cellcount_,   NA_INTEGER);
+  if (columns_.col)
+    col_             = IntegerVector(cellcount_,   NA_INTEGER);
+  if (columns_.is_blank)
+    is_blank_        = LogicalVector(cellcount_,   false);
+  if (columns_.data_type && factors_)
+    data_type_codes_ = IntegerVector(cellcount_,   NA_INTEGER);
+  else if (columns_.data_type)
+    data_type_       = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.error)
+    error_           = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.logical)
+    logical_         = LogicalVector(cellcount_,   NA_LOGICAL);
+  if (columns_.numeric)
+    numeric_         = NumericVector(cellcount_,   NA_REAL);
+  if (columns_.date) {
+    date_            = NumericVector(cellcount_,   NA_REAL);
+    date_.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+    date_.attr("tzone") = "UTC";
+  }
+  if (columns_.character)
+    character_       = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.formula)
+    formula_         = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.is_array)
+    is_array_        = LogicalVector(cellcount_,   false);
+  if (columns_.formula_ref)
+    formula_ref_     = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.formula_group)
+    formula_group_   = IntegerVector(cellcount_,   NA_INTEGER);
+  if (columns_.comment)
+    comment_         = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.character_formatted)
+    character_formatted_ = List(cellcount_);
+  if (columns_.height)
+    height_          = NumericVector(cellcount_,   NA_REAL);
+  if (columns_.width)
+    width_           = NumericVector(cellcount_,   NA_REAL);
+  if (columns_.style_format && factors_)
+    style_format_codes_ = IntegerVector(cellcount_, NA_INTEGER);
+  else if (columns_.style_format)
+    style_format_    = CharacterVector(cellcount_, NA_STRING);
+  if (columns_.local_format_id)
+    local_format_id_ = IntegerVector(cellcount_,   NA_INTEGER);
 }
 
 void xlsxbook::cacheInformation() {
-  // Loop through sheets
-  List sheet_list(sheet_paths_.size());
+  // Copy the columns of each sheet into the R vectors that have been asked for
+  CharacterVector type_names = CharacterVector::create(
+      "blank", "character", "numeric", "date", "logical", "error",
+      "date (ISO8601)", "unknown"); // in the order of cell_type
+  const cellcolumns& c = columns_;
 
-  std::vector<std::string>::iterator xml;
-  std::vector<xlsxsheet>::iterator sheet;
-  List::iterator sheet_list_it;
+  // Names that are repeated in many cells are made into CHARSXPs only once,
+  // rather than being looked up in R's global cache of strings for every cell.
+  // Shared strings are made by file_.stringChar(), and the names of cell
+  // styles by styles_, once per format.  As factors, they are coded once
+  // instead.
+  const std::vector<cellformat>& formats = styles_.cellFormats_;
+  // The vector keeps its CHARSXP from being collected while cells are made
+  CharacterVector normal_name = CharacterVector::create("Normal");
+  SEXP normal = STRING_ELT(normal_name, 0);
+  std::vector<int> style_codes;
+  int normal_code = NA_INTEGER;
+  factorlevels style_levels;
+  if (c.style_format && factors_) {
+    style_codes.resize(formats.size());
+    for (size_t k = 0; k < formats.size(); ++k)
+      style_codes[k] = style_levels.code(CHAR(formats[k].styleName_));
+    normal_code = style_levels.code("Normal");
+  }
+  factorlevels sheet_levels; // the same sheet can be asked for twice
 
   unsigned long long int i(0); // position of each cell in the output vectors
-  for(xml = sheet_xml_.begin(),
-      sheet = sheets_.begin(),
-      sheet_list_it = sheet_list.begin();
-      xml != sheet_xml_.end();
-      ++xml, ++sheet, ++sheet_list_it) {
-    rapidxml::xml_document<> doc;
-    doc.parse<rapidxml::parse_strip_xml_namespaces>(&(*xml)[0]);
-    rapidxml::xml_node<>* workbook = doc.first_node("worksheet");
-    rapidxml::xml_node<>* sheetData = workbook->first_node("sheetData");
-    sheet->parseSheetData(sheetData, i);
-    sheet->appendComments(i);
+  for(size_t k = 0; k < sheets_.size(); ++k) {
+    std::vector<xlsxsheet>::iterator sheet = sheets_.begin() + k;
+    SEXP sheet_name = STRING_ELT(sheet_names_, k);
+    int sheet_code = sheet_levels.code(sheet->name_);
+    const sheetdata& data = sheet->data_;
+    for (size_t j = 0; j < data.size(); ++j, ++i) {
+      int row = data.row_[j];
+      int col = data.col_[j];
+      if (c.sheet && factors_)
+        sheet_codes_[i] = sheet_code;
+      else if (c.sheet)
+        SET_STRING_ELT(sheet_, i, sheet_name);
+      if (c.address)
+        SET_STRING_ELT(address_, i, Rf_mkChar(formatAddress(row, col).c_str()));
+      if (c.row)
+        row_[i] = row;
+      if (c.col)
+        col_[i] = col;
+      if (c.is_blank)
+        is_blank_[i] = data.is_blank_[j];
+      if (c.data_type && factors_)
+        data_type_codes_[i] = (int)data.data_type_[j] + 1;
+      else if (c.data_type)
+        SET_STRING_ELT(data_type_, i,
+            STRING_ELT(type_names, (int)data.data_type_[j]));
+
+      double value = data.value_[j];
+      int string = data.string_[j];
+      switch (data.data_type_[j]) {
+        case cell_type::CHARACTER:
+          if (string != -1) {
+            if (c.character) {
+              if ((size_t)string < data.shared_count_) {
+                SET_STRING_ELT(character_, i, file_.stringChar(string));
+              } else {
+                SET_STRING_ELT(character_, i,
+                    Rf_mkCharCE(data.string(strings_, string).c_str(), CE_UTF8));
+              }
+            }
+            if (c.character_formatted && (size_t)string < data.shared_count_)
+              SET_VECTOR_ELT(character_formatted_, i,
+                  strings_formatted_.formatted(string, strings_[string]));
+          }
+          break;
+        case cell_type::NUMERIC:
+          if (c.numeric)
+            numeric_[i] = value;
+          break;
+        case cell_type::DATE:
+          if (c.date)
+            date_[i] = value;
+          break;
+        case cell_type::LOGICAL:
+          if (c.logical)
+            logical_[i] = value;
+          break;
+        case cell_type::ERROR:
+          if (c.error)
+            SET_STRING_ELT(error_, i,
+                Rf_mkCharCE(data.string(strings_, string).c_str(), CE_UTF8));
+          break;
+        default:
+          break;
+      }
+
+      if (c.formula && data.formula_[j] != -1) {
+        SET_STRING_ELT(formula_, i,
+            Rf_mkCharCE(data.string(strings_, data.formula_[j]).c_str(), CE_UTF8));
+      }
+      if (c.is_array)
+        is_array_[i] = data.is_array_[j];
+      if (c.formula_ref && data.formula_ref_[j] != -1) {
+        SET_STRING_ELT(formula_ref_, i,
+            Rf_mkCharCE(data.string(strings_, data.formula_ref_[j]).c_str(), CE_UTF8));
+      }
+      if (c.formula_group && data.formula_group_[j] != -1)
+        formula_group_[i] = data.formula_group_[j];
+      if (c.comment && data.comment_[j] != -1) {
+        SET_STRING_ELT(comment_, i,
+            Rf_mkCharCE(data.string(strings_, data.comment_[j]).c_str(), CE_UTF8));
+      }
+
+      // Sheet name, row height and col width aren't really determined by the
+      // cell, so they're looked up in the sheet
+      if (c.height)
+        height_[i] = sheet->rowHeights_[row];
+      if (c.width)
+        width_[i] = sheet->colWidths_[col];
+
+      int format = data.format_[j];
+      if (format == -1) { // comment on a blank cell
+        if (c.style_format && factors_)
+          style_format_codes_[i] = normal_code;
+        else if (c.style_format)
+          SET_STRING_ELT(style_format_, i, normal);
+        if (c.local_format_id)
+          local_format_id_[i] = 1;
+      } else {
+        if (c.style_format && factors_)
+          style_format_codes_[i] = style_codes[format];
+        else if (c.style_format)
+          SET_STRING_ELT(style_format_, i, formats[format].styleName_);
+        if (c.local_format_id)
+          local_format_id_[i] = format + 1;
+      }
+
+      if ((i + 1) % 1000 == 0)
+        checkUserInterrupt();
+    }
+  }
+
+  // Returns a nested data frame of the columns that have been asked for, in
+  // the order that they were asked for, the data frame itself wrapped in a
+  // list.
+
+  std::map<std::string, SEXP> all;
+  all["sheet"] = sheet_;
+  all["address"] = address_;
+  all["row"] = row_;
+  all["col"] = col_;
+  all["is_blank"] = is_blank_;
+  all["data_type"] = data_type_;
+  all["error"] = error_;
+  all["logical"] = logical_;
+  all["numeric"] = numeric_;
+  all["date"] = date_;
+  all["character"] = character_;
+  all["character_formatted"] = character_formatted_;
+  all["formula"] = formula_;
+  all["is_array"] = is_array_;
+  all["formula_ref"] = formula_ref_;
+  all["formula_group"] = formula_group_;
+  all["comment"] = comment_;
+  all["height"] = height_;
+  all["width"] = width_;
+  all["style_format"] = style_format_;
+  all["local_format_id"] = local_format_id_;
+  if (factors_) {
+    if (c.sheet)
+      all["sheet"] = asFactor(sheet_codes_, sheet_levels.levels());
+    if (c.data_type)
+      all["data_type"] = asFactor(data_type_codes_, type_names);
+    if (c.style_format)
+      all["style_format"] = asFactor(style_format_codes_, style_levels.levels());
   }
 
-  // Returns a nested data frame of everything, the data frame itself wrapped in
-  // a list.
-
-  information_ = List(21);
-  information_[0] = sheet_;
-  information_[1] = address_;
-  information_[2] = row_;
-  information_[3] = col_;
-  information_[4] = is_blank_;
-  information_[5] = data_type_;
-  information_[6] = error_;
-  information_[7] = logical_;
-  information_[8] = numeric_;
-  information_[9] = date_;
-  information_[10] = character_;
-  information_[11] = character_formatted_;
-  information_[12] = formula_;
-  information_[13] = is_array_;
-  information_[14] = formula_ref_;
-  information_[15] = formula_group_;
-  information_[16] = comment_;
-  information_[17] = height_;
-  information_[18] = width_;
-  information_[19] = style_format_;
-  information_[20] = local_format_id_;
-
-  std::vector<std::string> names(21);
-  names[0]  = "sheet";
-  names[1]  = "address";
-  names[2]  = "row";
-  names[3]  = "col";
-  names[4]  = "is_blank";
-  names[5]  = "data_type";
-  names[6]  = "error";
-  names[7]  = "logical";
-  names[8]  = "numeric";
-  names[9]  = "date";
-  names[10] = "character";
-  names[11] = "character_formatted";
-  names[12] = "formula";
-  names[13] = "is_array";
-  names[14] = "formula_ref";
-  names[15] = "formula_group";
-  names[16] = "comment";
-  names[17] = "height";
-  names[18] = "width";
-  names[19] = "style_format";
-  names[20] = "local_format_id";
+  const std::vector<std::string>& names = columns_.names_;
+  information_ = List(names.size());
+  for (size_t k = 0; k < names.size(); ++k)
+    information_[k] = all[names[k]];
 
   information_.attr("names") = names;
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(information_[0]);
-  information_.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  information_.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  dataFrame(information_, cellcount_);
+
+  if (lazy_formulas_ && c.formula)
+    information_.attr("shared_formulas") = sharedFormulas();
+}
+
+List xlsxbook::sharedFormulas() {
+  // Without their dependent cells, whose formulas weren't filled in, the only
+  // cells with both a formula and a formula group are the masters.  Masters
+  // outside the window of cells are kept by the sheets separately.
+  std::vector<size_t> sheet_index;
+  std::vector<size_t> cell_index;
+  size_t outside = 0;
+  for(size_t k = 0; k < sheets_.size(); ++k) {
+    const sheetdata& data = sheets_[k].data_;
+    for (size_t j = 0; j < data.size(); ++j) {
+      if (data.formula_group_[j] != -1 && data.formula_[j] != -1) {
+        sheet_index.push_back(k);
+        cell_index.push_back(j);
+      }
+    }
+    outside += sheets_[k].masters_.size();
+  }
+
+  size_t n = cell_index.size() + outside;
+  CharacterVector sheet(n);
+  IntegerVector   formula_group(n);
+  CharacterVector formula(n);
+  IntegerVector   row(n);
+  IntegerVector   col(n);
+  size_t i = 0;
+  for (; i < cell_index.size(); ++i) {
+    const sheetdata& data = sheets_[sheet_index[i]].data_;
+    size_t j = cell_index[i];
+    SET_STRING_ELT(sheet, i, STRING_ELT(sheet_names_, sheet_index[i]));
+    formula_group[i] = data.formula_group_[j];
+    SET_STRING_ELT(formula, i,
+        Rf_mkCharCE(data.string(strings_, data.formula_[j]).c_str(), CE_UTF8));
+    row[i] = data.row_[j];
+    col[i] = data.col_[j];
+  }
+  for(size_t k = 0; k < sheets_.size(); ++k) {
+    const std::vector<shared_master>& masters = sheets_[k].masters_;
+    for (size_t j = 0; j < masters.size(); ++j, ++i) {
+      SET_STRING_ELT(sheet, i, STRING_ELT(sheet_names_, k));
+      formula_group[i] = masters[j].si;
+      SET_STRING_ELT(formula, i,
+          Rf_mkCharCE(masters[j].formula.c_str(), CE_UTF8));
+      row[i] = masters[j].row;
+      col[i] = masters[j].col;
+    }
+  }
+
+  List out = List::create(
+      _["sheet"] = sheet,
+      _["formula_group"] = formula_group,
+      _["formula"] = formula,
+      _["row"] = row,
+      _["col"] = col);
+  return dataFrame(out, n);
 }
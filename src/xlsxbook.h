@@ -3,26 +3,35 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
+#include "zip_archive.h"
+#include "xlsxfile.h"
 #include "xlsxsheet.h"
 #include "xlsxstyles.h"
+#include "sheetdata.h"
+#include "rangeindex.h"
 
 class xlsxbook {
 
   public:
 
+    xlsxfile& file_;                       // book-level parts, parsed once
     const std::string& path_;              // workbook path
+    const zip_archive& archive_;           // index of the files in path_
     Rcpp::CharacterVector sheet_paths_;    // worksheet paths
     Rcpp::CharacterVector sheet_names_;    // worksheet names
     Rcpp::CharacterVector comments_paths_; // comments files
-    std::vector<std::string> strings_;     // strings table
-    std::vector<Rcpp::List> strings_formatted_; // strings with inline formatting
-                                                // list of data frames
-    xlsxstyles styles_;
+    xlsxstyles& styles_;
+    std::vector<std::string>& strings_;    // strings table
+    richtext& strings_formatted_;        // inline formatting of strings
 
     int dateSystem_; // 1900 or 1904
     int dateOffset_; // for converting 1900 or 1904 Excel datetimes to R
+    int threads_;    // number of sheets to parse at once
+    cellcolumns columns_; // the columns to return
+    bool factors_;   // sheet, data_type and style_format as factors
+    bool lazy_formulas_; // leave shared formulas for expand_formulas()
+    cellrange window_;   // the rows and columns of the cells to return
 
-    std::vector<std::string> sheet_xml_; // xml of worksheets
     std::vector<xlsxsheet> sheets_;      // worksheet objects
     unsigned long long int cellcount_;   // total cellcount of all sheets
 
@@ -51,23 +60,29 @@ class xlsxbook {
     Rcpp::CharacterVector style_format_;    // cellXfs xfId links to cellStyleXfs entry
     Rcpp::IntegerVector   local_format_id_; // cell 'c' links to cellXfs entry
 
-    xlsxbook(const std::string& path);    // constructor
+    // Instead of sheet_, data_type_ and style_format_ when factors_ is true
+    Rcpp::IntegerVector   sheet_codes_;
+    Rcpp::IntegerVector   data_type_codes_;
+    Rcpp::IntegerVector   style_format_codes_;
 
     xlsxbook(
-        const std::string& path,
-        Rcpp::CharacterVector& sheet_names,
+        xlsxfile& file,
         Rcpp::CharacterVector& sheet_paths,
-        Rcpp::CharacterVector& comments_paths
+        Rcpp::CharacterVector& sheet_names,
+        Rcpp::CharacterVector& comments_paths,
+        int threads,
+        Rcpp::CharacterVector& columns,
+        bool factors,
+        bool lazy_formulas,
+        Rcpp::IntegerVector& window // first row, first col, last row, last col
         );
 
-    void cacheStrings();
-    void cacheDateOffset(rapidxml::xml_node<>* workbook);
-    void cacheSheetXml();
     void createSheets();
     void countCells();
     void initializeColumns();
     void cacheCells();
     void cacheInformation();
+    Rcpp::List sharedFormulas(); // the master of each shared formula
 
 };
 
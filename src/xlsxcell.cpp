@@ -1,209 +1,206 @@
+#include <stdexcept>
 #include <Rcpp.h>
 #include "rapidxml.h"
 #include "xlsxbook.h"
 #include "xlsxcell.h"
 #include "xlsxsheet.h"
 #include "string.h"
+#include "address.h"
+#include "number.h"
 #include "date.h"
 
 using namespace Rcpp;
 
 xlsxcell::xlsxcell(
-    rapidxml::xml_node<>* cell,
-    xlsxsheet* sheet,
+    const cellxml& cell,
+    sheetchunk& chunk,
     xlsxbook& book,
     unsigned long long int& i
     ) {
-    parseAddress(cell, sheet, book, i);
-    cacheValue  (cell, sheet, book, i); // Also caches format, as inextricable
-    cacheFormula(cell, sheet, book, i);
+    parseAddress(cell, chunk, book, i);
+    cacheValue  (cell, chunk, book, i); // Also caches format, as inextricable
+    cacheFormula(cell, chunk, book, i);
 }
 
-// Based on hadley/readxl
-// Get the A1-style address, and parse it for the row and column numbers.
-// Simple parser: does not check that order of numbers and letters is correct
+// Get the A1-style address, and decode it into the row and column numbers.
 // row_ and column_ are one-based
 void xlsxcell::parseAddress(
-    rapidxml::xml_node<>* cell,
-    xlsxsheet* sheet,
+    const cellxml& cell,
+    sheetchunk& chunk,
     xlsxbook& book,
     unsigned long long int& i
     ) {
-  rapidxml::xml_attribute<>* r = cell->first_attribute("r");
-  address_ = r->value(); // we need this std::string in a moment
-  book.address_[i] = address_;
-
-  col_ = 0;
-  row_ = 0;
-  // Iterate though the A1-style address string character by character
-  for(std::string::const_iterator iter = address_.begin();
-      iter != address_.end(); ++iter) {
-    if (*iter >= '0' && *iter <= '9') { // If it's a number
-      row_ = row_ * 10 + (*iter - '0'); // Then multiply existing row by 10 and add new number
-    } else if (*iter >= 'A' && *iter <= 'Z') { // If it's a character
-      col_ = 26 * col_ + (*iter - 'A' + 1); // Then do similarly with columns
-    }
+  if (cell.r_ == NULL)
+    throw std::runtime_error("Invalid row or cell: lacks 'r' attribute");
+  address_ = cell.r_;
+  address_size_ = cell.r_size_;
+  if (!::parseAddress(address_, address_size_, row_, col_)) {
+    throw std::runtime_error("Invalid cell address: '" + chunk.sheet_.name_
+                             + "'!" + address());
   }
-  book.col_[i] = col_;
-  book.row_[i] = row_;
+  sheetdata& data = chunk.data_;
+  data.push_back(row_, col_); // the cell is at position i
 
-  // Look up any comment using the address, and delete it if found
-  std::map<std::string, std::string>& comments = sheet->comments_;
-  std::map<std::string, std::string>::iterator it = comments.find(address_);
-  if(it != comments.end()) {
-    SET_STRING_ELT(book.comment_, i, Rf_mkCharCE(it->second.c_str(), CE_UTF8));
-    comments.erase(it);
+  // Look up any comment using the address.  Other chunks might be looking at
+  // the same time, so it is only marked when the chunks are joined.
+  if (!book.columns_.comment)
+    return;
+  const commenttable& comments = chunk.sheet_.comments_;
+  int k = comments.find(row_, col_);
+  if (k != -1) {
+    data.comment_[i] = data.addString(comments.text(k));
+    chunk.comments_found_.push_back(k);
   }
 }
 
 void xlsxcell::cacheValue(
-    rapidxml::xml_node<>* cell,
-    xlsxsheet* sheet,
+    const cellxml& cell,
+    sheetchunk& chunk,
     xlsxbook& book,
     unsigned long long int& i
     ) {
+  sheetdata& data = chunk.data_;
+
   // 'v' for 'value' is either literal (numeric) or an index into a string table
-  rapidxml::xml_node<>* v = cell->first_node("v");
-  std::string vvalue;
-  if (v != NULL) {
-    vvalue = v->value();
+  // It is parsed straight from the xml, without being copied.
+  const char* vvalue = "";
+  size_t vvalue_size = 0;
+  if (cell.v_ != NULL) {
+    vvalue = cell.v_;
+    vvalue_size = cell.v_size_;
   } else {
-    book.is_blank_[i] = true;
-  }
-
-  // 't' for 'type' defines the meaning of 'v' for value
-  rapidxml::xml_attribute<>* t = cell->first_attribute("t");
-  std::string tvalue;
-  if (t != NULL) {
-    tvalue = t->value();
+    data.is_blank_[i] = true;
   }
 
-  // 's' for 'style' indexes into data structures of formatting
-  rapidxml::xml_attribute<>* s = cell->first_attribute("s");
-  // Default the local format id to '1' if not present
-  int svalue;
-  if (s != NULL) {
-    svalue = strtol(s->value(), NULL, 10);
-  } else {
-    svalue = 0;
-  }
-  book.local_format_id_[i] = svalue + 1;
-  book.style_format_[i] = book.styles_.cellStyles_map_[book.styles_.cellXfs_[svalue].xfId_];
+  // 't' for 'type' defines the meaning of 'v' for value, and was classified
+  // by the lexer.  's' for 'style' indexes into data structures of formatting,
+  // and is 0 if not present.
+  xml_type tvalue = cell.t_;
+  int svalue = cell.s_;
+  if (svalue < 0 || (size_t)svalue >= book.styles_.cellFormats_.size())
+    throw std::runtime_error("Invalid style index: '" + chunk.sheet_.name_ + "'!" + address());
+  data.format_[i] = svalue;
 
-  if (t != NULL && tvalue == "inlineStr") {
-    book.data_type_[i] = "character";
-    rapidxml::xml_node<>* is = cell->first_node("is");
-    if (is != NULL) { // Get the inline string if it's really there
+  if (tvalue == xml_type::INLINE_STRING) {
+    data.data_type_[i] = cell_type::CHARACTER;
+    if (book.columns_.character) { // Get the inline string if it's really there
       std::string inlineString;
-      parseString(is, inlineString); // value is modified in place
-      SET_STRING_ELT(book.character_, i, Rf_mkCharCE(inlineString.c_str(), CE_UTF8));
+      if (cell.is_node_ != NULL) {
+        parseString(cell.is_node_, inlineString); // value is modified in place
+      } else if (cell.is_ != NULL) {
+        // The lexer leaves the rich text of inline strings to rapidxml, in a
+        // copy so that the row isn't modified
+        std::string is(cell.is_, cell.is_size_);
+        rapidxml::xml_document<> xml;
+        xml.parse<rapidxml::parse_strip_xml_namespaces>(&is[0]);
+        parseString(xml.first_node(), inlineString);
+      } else {
+        return;
+      }
+      data.string_[i] = data.addString(inlineString);
     }
     return;
-  } else if (v == NULL) {
+  } else if (cell.v_ == NULL) {
     // Can't now be an inline string (tested above)
-    book.data_type_[i] = "blank";
+    data.data_type_[i] = cell_type::BLANK;
     return;
-  } else if (t == NULL || tvalue == "n") {
-    if (book.styles_.cellXfs_[svalue].applyNumberFormat_ == 1) {
-      // local number format applies
-      if (book.styles_.isDate_[book.styles_.cellXfs_[svalue].numFmtId_]) {
-        // local number format is a date format
-        book.data_type_[i] = "date";
-        double date = strtod(vvalue.c_str(), NULL);
-        book.date_[i] = checkDate(date, book.dateSystem_, book.dateOffset_,
-                                  "'" + sheet->name_ + "'!" + address_);
-        return;
-      } else {
-        book.data_type_[i] = "numeric";
-        book.numeric_[i] = strtod(vvalue.c_str(), NULL);
-      }
-    } else if ( // no known case # nocov start
-          book.styles_.isDate_[
-            book.styles_.cellStyleXfs_[
-              book.styles_.cellXfs_[svalue].xfId_
-            ].numFmtId_
-          ]
-        ) {
-      // style number format is a date format
-      book.data_type_[i] = "date";
-      double date = strtod(vvalue.c_str(), NULL);
-      book.date_[i] = checkDate(date, book.dateSystem_, book.dateOffset_,
-                                  "'" + sheet->name_ + "'!" + address_);
+  } else if (tvalue == xml_type::NUMBER) {
+    // Whether the number format that applies, local or else that of the cell
+    // style, is a date format was worked out once per format by the styles
+    if (book.styles_.cellFormats_[svalue].isDate_) {
+      data.data_type_[i] = cell_type::DATE;
+      double date = parseNumber(vvalue, vvalue_size);
+      data.value_[i] = checkDate(date, book.dateSystem_, book.dateOffset_,
+                                 "'" + chunk.sheet_.name_ + "'!" + address(),
+                                 chunk.warnings_);
       return;
     } else {
-      book.data_type_[i] = "numeric";
-      book.numeric_[i] = strtod(vvalue.c_str(), NULL); // # nocov end
+      data.data_type_[i] = cell_type::NUMERIC;
+      data.value_[i] = parseNumber(vvalue, vvalue_size);
     }
-  } else if (tvalue == "s") {
+  } else if (tvalue == xml_type::SHARED_STRING) {
     // the t attribute exists and its value is exactly "s", so v is an index
     // into the string table.
-    book.data_type_[i] = "character";
-    SET_STRING_ELT(book.character_, i, Rf_mkCharCE(book.strings_[strtol(vvalue.c_str(), NULL, 10)].c_str(), CE_UTF8));
-    book.character_formatted_[i] = book.strings_formatted_[strtol(vvalue.c_str(), NULL, 10)];
+    long int index = parseInteger(vvalue, vvalue_size);
+    if (index < 0 || (size_t)index >= data.shared_count_)
+      throw std::runtime_error("Invalid shared string index: '" + chunk.sheet_.name_ + "'!" + address()); // # nocov
+    data.data_type_[i] = cell_type::CHARACTER;
+    data.string_[i] = index;
     return;
-  } else if (tvalue == "str") {
+  } else if (tvalue == xml_type::FORMULA_STRING) {
     // Formula, which could have evaluated to anything, so only a string is safe
-    book.data_type_[i] = "character";
-    book.character_[i] = vvalue;
+    data.data_type_[i] = cell_type::CHARACTER;
+    if (book.columns_.character)
+      data.string_[i] = data.addString(std::string(vvalue, vvalue_size));
     return;
-  } else if (tvalue == "b"){
-    book.data_type_[i] = "logical";
-    book.logical_[i] = strtod(vvalue.c_str(), NULL);
+  } else if (tvalue == xml_type::BOOLEAN) {
+    data.data_type_[i] = cell_type::LOGICAL;
+    data.value_[i] = parseInteger(vvalue, vvalue_size);
     return;
-  } else if (tvalue == "e") {
-    book.data_type_[i] = "error";
-    book.error_[i] = vvalue;
+  } else if (tvalue == xml_type::ERROR) {
+    data.data_type_[i] = cell_type::ERROR;
+    if (book.columns_.error)
+      data.string_[i] = data.addString(std::string(vvalue, vvalue_size));
     return;
-  } else if (tvalue == "d") { // # nocov start
+  } else if (tvalue == xml_type::DATE) { // # nocov start
     // Does excel use this date type? Regardless, don't have cross-platform
     // ISO8601 parser (yet) so need to return as text.
-    book.data_type_[i] = "date (ISO8601)";
+    data.data_type_[i] = cell_type::DATE_ISO8601;
     return; // # nocov end
   } else { // no known case
-    book.data_type_[i] = "unknown"; // # nocov start
+    data.data_type_[i] = cell_type::UNKNOWN; // # nocov start
     return; // # nocov end
   }
 }
 
 void xlsxcell::cacheFormula(
-    rapidxml::xml_node<>* cell,
-    xlsxsheet* sheet,
+    const cellxml& cell,
+    sheetchunk& chunk,
     xlsxbook& book,
     unsigned long long int& i
     ) {
-  rapidxml::xml_node<>* f = cell->first_node("f");
-  std::string formula;
-  int si_number;
-  std::map<int, shared_formula>::iterator it;
-  if (f != NULL) {
-    formula = f->value();
-    book.formula_[i] = formula;
-    rapidxml::xml_attribute<>* f_t = f->first_attribute("t");
-    if (f_t != NULL) {
-      std::string ftvalue(f_t->value());
-      if (ftvalue == "array") {
-        book.is_array_[i] = true;
-      }
+  const cellcolumns& columns = book.columns_;
+  if (!columns.anyFormula())
+    return;
+  sheetdata& data = chunk.data_;
+  std::string& formula = chunk.formula_; // reused by every cell in the chunk
+  if (cell.has_f_) {
+    if (cell.f_array_ && columns.is_array) {
+      data.is_array_[i] = true;
     }
 
-    rapidxml::xml_attribute<>* ref = f->first_attribute("ref");
-    if (ref != NULL) {
-      book.formula_ref_[i] = ref->value();
+    if (cell.ref_ != NULL && columns.formula_ref) {
+      data.formula_ref_[i] =
+        data.addString(std::string(cell.ref_, cell.ref_size_));
     }
 
     // Formulas are sometimes defined once, and then 'shared' with a range
     // p.1629 'shared' and 'si' attributes
-    rapidxml::xml_attribute<>* si = f->first_attribute("si");
-    if (si != NULL) {
-      si_number = strtol(si->value(), NULL, 10);
-      book.formula_group_[i] = si_number;
+    int si_number = cell.si_;
+    if (si_number != -1) {
+      data.formula_group_[i] = si_number;
+    }
+
+    // Only the formula itself is left, which can be expensive to offset
+    if (!columns.formula)
+      return;
+    formula.assign(cell.f_, cell.f_size_);
+    if (si_number != -1) {
       if (formula.length() == 0) { // inherits definition
-        it = sheet->shared_formulas_.find(si_number);
-        book.formula_[i] = it->second.offset(row_, col_);
-      } else { // defines shared formula
-        shared_formula new_shared_formula(formula, row_, col_);
-        sheet->shared_formulas_.insert({si_number, new_shared_formula});
+        if (book.lazy_formulas_)
+          return; // left to expand_formulas()
+        const shared_formula* master = chunk.shared_formulas_.find(si_number);
+        if (master == NULL) {
+          // The master is in an earlier chunk
+          chunk.unresolved_.push_back({(size_t)i, si_number, row_, col_});
+          return;
+        }
+        master->render(row_, col_, formula);
+      } else if (!book.lazy_formulas_) { // defines shared formula
+        chunk.shared_formulas_.insert(si_number, formula, row_, col_);
       }
     }
+
+    data.formula_[i] = data.addString(formula);
   }
 }
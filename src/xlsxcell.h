@@ -5,39 +5,43 @@
 #include "rapidxml.h"
 #include "xlsxbook.h"
 #include "xlsxsheet.h"
+#include "celllexer.h"
 
 class xlsxcell {
 
-  std::string address_;
+  const char* address_;  // A1-style, not nul-terminated
+  size_t address_size_;
   int col_;
   int row_;
 
+  std::string address() const { return std::string(address_, address_size_); }
+
   public:
 
     xlsxcell(
-        rapidxml::xml_node<>* cell, // the cell node,
-        xlsxsheet* sheet,           // the parent worksheet
+        const cellxml& cell,        // the parts of the <c> element
+        sheetchunk& chunk,          // the rows of the worksheet being parsed
         xlsxbook& book,             // the parent workbook
-        unsigned long long int& i   // the index of the cell
+        unsigned long long int& i   // the index of the cell in the chunk
         );
 
     void parseAddress(
-        rapidxml::xml_node<>* cell,
-        xlsxsheet* sheet,
+        const cellxml& cell,
+        sheetchunk& chunk,
         xlsxbook& book,
         unsigned long long int& i
         );
 
     void cacheValue(
-        rapidxml::xml_node<>* cell,
-        xlsxsheet* sheet,
+        const cellxml& cell,
+        sheetchunk& chunk,
         xlsxbook& book,
         unsigned long long int& i
         );
 
     void cacheFormula(
-        rapidxml::xml_node<>* cell,
-        xlsxsheet* sheet,
+        const cellxml& cell,
+        sheetchunk& chunk,
         xlsxbook& book,
         unsigned long long int& i
         );
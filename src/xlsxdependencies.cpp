@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <deque>
+#include <tuple>
+#include <Rcpp.h>
+#include "xlsxdependencies.h"
+#include "address.h"
+#include "parallel.h"
+#include "token_type.h"
+#include "xlex.h"
+#include "string.h"
+#include "dataframe.h"
+
+using namespace Rcpp;
+
+static std::string nameKey(int scope, const std::string& name) {
+  return std::to_string(scope) + '!' + name;
+}
+
+static bool rangeLess(const cellrange& a, const cellrange& b) {
+  return std::tie(a.sheet_, a.first_row_, a.first_col_, a.last_row_, a.last_col_)
+    < std::tie(b.sheet_, b.first_row_, b.first_col_, b.last_row_, b.last_col_);
+}
+
+static bool rangeEqual(const cellrange& a, const cellrange& b) {
+  return !rangeLess(a, b) && !rangeLess(b, a);
+}
+
+// Sorts ranges[first, end) and removes duplicates, so that a formula that
+// refers to a range more than once has only one reference to it
+static void tidyRanges(std::vector<cellrange>& ranges, size_t first) {
+  std::sort(ranges.begin() + first, ranges.end(), rangeLess);
+  ranges.erase(std::unique(ranges.begin() + first, ranges.end(), rangeEqual),
+               ranges.end());
+}
+
+xlsxdependencies::xlsxdependencies(
+    CharacterVector sheet_names,
+    IntegerVector sheets,
+    IntegerVector rows,
+    IntegerVector cols,
+    CharacterVector formulas,
+    IntegerVector name_sheets,
+    CharacterVector names,
+    CharacterVector name_formulas,
+    int threads): sheet_names_(sheet_names) {
+  for (R_xlen_t k = 0; k < sheet_names.size(); ++k) {
+    SEXP name = sheet_names[k];
+    sheet_index_[upper(CHAR(name), LENGTH(name))] = k;
+  }
+
+  for (R_xlen_t k = 0; k < names.size(); ++k) {
+    if (names[k] == NA_STRING || name_formulas[k] == NA_STRING)
+      continue;
+    SEXP name = names[k];
+    definedname defined;
+    defined.formula_ = std::string(name_formulas[k]);
+    defined.scope_ = name_sheets[k] == NA_INTEGER ? -1 : name_sheets[k] - 1;
+    defined.state_ = 0;
+    name_index_[nameKey(defined.scope_, upper(CHAR(name), LENGTH(name)))] =
+      names_.size();
+    names_.push_back(defined);
+  }
+
+  for (R_xlen_t k = 0; k < formulas.size(); ++k) {
+    sheets_.push_back(sheets[k] == NA_INTEGER ? -1 : sheets[k] - 1);
+    rows_.push_back(rows[k]);
+    cols_.push_back(cols[k]);
+  }
+
+  resolveNames();
+  resolveFormulas(formulas, threads);
+  linkFormulas(threads);
+}
+
+bool xlsxdependencies::parseSheets(const char* x, size_t n,
+                                   int& first, int& last) const {
+  if (n > 0 && x[n - 1] == '!')
+    --n;
+  std::string name;
+  if (n >= 2 && x[0] == '\'' && x[n - 1] == '\'') {
+    for (size_t i = 1; i + 1 < n; ++i) {
+      name += x[i];
+      if (x[i] == '\'' && i + 2 < n && x[i + 1] == '\'')
+        ++i; // quotes are escaped by doubling
+    }
+  } else {
+    name.assign(x, n);
+  }
+
+  // Other workbooks are prefixed by an index like [1], or a path.  Sheet
+  // names can't contain square brackets.  [0] is this workbook.
+  size_t close = name.rfind(']');
+  if (close != std::string::npos) {
+    size_t open = name.rfind('[', close);
+    if (open == std::string::npos || name.compare(open, close - open + 1, "[0]") != 0)
+      return false;
+    name.erase(0, close + 1);
+  }
+
+  // Three-dimensional references span sheets in the order of the workbook.
+  // Sheet names can't contain colons.
+  size_t colon = name.find(':');
+  std::string name1 = upper(name.data(), std::min(colon, name.size()));
+  std::string name2 = colon == std::string::npos
+    ? name1
+    : upper(name.data() + colon + 1, name.size() - colon - 1);
+  std::unordered_map<std::string, int>::const_iterator sheet1 =
+    sheet_index_.find(name1);
+  std::unordered_map<std::string, int>::const_iterator sheet2 =
+    sheet_index_.find(name2);
+  if (sheet1 == sheet_index_.end() || sheet2 == sheet_index_.end())
+    return false;
+  first = std::min(sheet1->second, sheet2->second);
+  last = std::max(sheet1->second, sheet2->second);
+  return true;
+}
+
+int xlsxdependencies::findName(int sheet, const char* x, size_t n) const {
+  std::string name = upper(x, n);
+  std::unordered_map<std::string, int>::const_iterator it;
+  if (sheet >= 0) {
+    it = name_index_.find(nameKey(sheet, name));
+    if (it != name_index_.end())
+      return it->second;
+  }
+  it = name_index_.find(nameKey(-1, name));
+  return it == name_index_.end() ? -1 : it->second;
+}
+
+void xlsxdependencies::resolve(const char* formula, size_t size, int sheet,
+                               std::vector<cellrange>& out) {
+  std::vector<token> tokens;
+  lexFormula(formula, size, tokens);
+
+  // A sheet token qualifies the ref or name after it
+  bool qualified = false;
+  bool external = false;
+  int first = sheet;
+  int last = sheet;
+  for (std::vector<token>::const_iterator t = tokens.begin();
+      t != tokens.end(); ++t) {
+    const char* x = formula + t->offset_;
+    switch (t->type_) {
+      case token_type::SHEET:
+        qualified = true;
+        external = !parseSheets(x, t->length_, first, last);
+        continue;
+      case token_type::REF: {
+        cellrange range;
+        if (!external && parseRange(x, t->length_, range)) {
+          for (int k = first; k <= last; ++k) {
+            range.sheet_ = k;
+            out.push_back(range);
+          }
+        }
+        break;
+      }
+      case token_type::NAME: {
+        int k = external ? -1 : findName(first, x, t->length_);
+        if (k >= 0) {
+          if (names_[k].state_ == 0)
+            resolveName(k);
+          for (std::vector<cellrange>::const_iterator it =
+              names_[k].ranges_.begin(); it != names_[k].ranges_.end(); ++it) {
+            cellrange range = *it;
+            if (range.sheet_ < 0)
+              range.sheet_ = first;
+            out.push_back(range);
+          }
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    if (qualified) {
+      qualified = false;
+      external = false;
+      first = sheet;
+      last = sheet;
+    }
+  }
+}
+
+// Unqualified refs in the formula of a global name are left on sheet -1, to be
+// replaced by the sheet of each formula that uses the name.  A name that
+// refers to itself, directly or not, resolves to whatever it had so far.
+void xlsxdependencies::resolveName(int k) {
+  definedname& name = names_[k]; // names_ isn't resized while resolving
+  name.state_ = 1;
+  std::vector<cellrange> ranges;
+  resolve(name.formula_.data(), name.formula_.size(), name.scope_, ranges);
+  tidyRanges(ranges, 0);
+  name.ranges_.swap(ranges);
+  name.state_ = 2;
+}
+
+void xlsxdependencies::resolveNames() {
+  for (size_t k = 0; k < names_.size(); ++k) {
+    if (names_[k].state_ == 0)
+      resolveName(k);
+  }
+}
+
+void xlsxdependencies::resolveFormulas(CharacterVector formulas, int threads) {
+  size_t n_cells = formulas.size();
+  std::vector<const char*> texts(n_cells);
+  std::vector<size_t> sizes(n_cells);
+  for (size_t k = 0; k < n_cells; ++k) {
+    SEXP formula = formulas[k];
+    if (formula != NA_STRING && sheets_[k] >= 0) {
+      texts[k] = CHAR(formula);
+      sizes[k] = LENGTH(formula);
+    }
+  }
+
+  // Resolve the formulas on several threads, each block into its own ranges
+  struct block {
+    std::vector<cellrange> ranges_;
+    std::vector<int> counts_;        // the number of ranges of each formula
+  };
+  size_t n_blocks = parallel::blockCount(n_cells);
+  std::vector<block> blocks(n_blocks);
+  parallel pool(threads);
+  pool.runBlocks(n_cells, [&](size_t b, size_t begin, size_t end) {
+    block& resolved = blocks[b];
+    for (size_t k = begin; k < end; ++k) {
+      size_t first = resolved.ranges_.size();
+      if (texts[k] != NULL) {
+        resolve(texts[k], sizes[k], sheets_[k], resolved.ranges_);
+        tidyRanges(resolved.ranges_, first);
+      }
+      resolved.counts_.push_back(resolved.ranges_.size() - first);
+    }
+  });
+
+  reference_offsets_.push_back(0);
+  for (size_t b = 0; b < n_blocks; ++b) {
+    block& resolved = blocks[b];
+    references_.insert(references_.end(),
+                       resolved.ranges_.begin(), resolved.ranges_.end());
+    for (size_t k = 0; k < resolved.counts_.size(); ++k) {
+      int cell = reference_offsets_.size() - 1;
+      reference_cells_.insert(reference_cells_.end(), resolved.counts_[k], cell);
+      reference_offsets_.push_back(reference_offsets_.back() + resolved.counts_[k]);
+    }
+    resolved = block();
+  }
+}
+
+void xlsxdependencies::linkFormulas(int threads) {
+  index_.build(references_);
+
+  size_t n_cells = sheets_.size();
+  for (size_t k = 0; k < n_cells; ++k) {
+    position p = {sheets_[k], packAddress(rows_[k], cols_[k]), (int)k};
+    positions_.push_back(p);
+  }
+  std::sort(positions_.begin(), positions_.end(),
+            [](const position& a, const position& b) {
+              return std::tie(a.sheet_, a.address_, a.cell_)
+                < std::tie(b.sheet_, b.address_, b.cell_);
+            });
+
+  // The dependents of each formula cell are the cells of the references that
+  // include it
+  struct block {
+    std::vector<int> cells_;
+    std::vector<int> counts_;
+  };
+  size_t n_blocks = parallel::blockCount(n_cells);
+  std::vector<block> blocks(n_blocks);
+  parallel pool(threads);
+  pool.runBlocks(n_cells, [&](size_t b, size_t begin, size_t end) {
+    block& linked = blocks[b];
+    std::vector<int> found;
+    for (size_t k = begin; k < end; ++k) {
+      found.clear();
+      cellrange cell = {sheets_[k], rows_[k], cols_[k], rows_[k], cols_[k]};
+      index_.find(cell, found);
+      for (size_t i = 0; i < found.size(); ++i)
+        found[i] = reference_cells_[found[i]];
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+      linked.cells_.insert(linked.cells_.end(), found.begin(), found.end());
+      linked.counts_.push_back(found.size());
+    }
+  });
+
+  dependent_offsets_.push_back(0);
+  for (size_t b = 0; b < n_blocks; ++b) {
+    block& linked = blocks[b];
+    dependents_.insert(dependents_.end(),
+                       linked.cells_.begin(), linked.cells_.end());
+    for (size_t k = 0; k < linked.counts_.size(); ++k)
+      dependent_offsets_.push_back(dependent_offsets_.back() + linked.counts_[k]);
+    linked = block();
+  }
+
+  // The precedents are the same edges the other way round.  Filling them in
+  // the order of the dependents keeps the precedents of each cell in order.
+  precedent_offsets_.assign(n_cells + 1, 0);
+  for (size_t i = 0; i < dependents_.size(); ++i)
+    ++precedent_offsets_[dependents_[i] + 1];
+  for (size_t k = 0; k < n_cells; ++k)
+    precedent_offsets_[k + 1] += precedent_offsets_[k];
+  precedents_.resize(dependents_.size());
+  std::vector<int> filled(precedent_offsets_.begin(), precedent_offsets_.end() - 1);
+  for (size_t k = 0; k < n_cells; ++k) {
+    for (int i = dependent_offsets_[k]; i < dependent_offsets_[k + 1]; ++i)
+      precedents_[filled[dependents_[i]]++] = k;
+  }
+}
+
+// Cell ids are one-based in R
+static IntegerVector oneBased(const std::vector<int>& x) {
+  IntegerVector out(x.size());
+  for (size_t i = 0; i < x.size(); ++i)
+    out[i] = x[i] + 1;
+  return out;
+}
+
+List xlsxdependencies::information() const {
+  size_t n = references_.size();
+  CharacterVector sheet(n);
+  IntegerVector first_row(n);
+  IntegerVector first_col(n);
+  IntegerVector last_row(n);
+  IntegerVector last_col(n);
+  for (size_t i = 0; i < n; ++i) {
+    const cellrange& range = references_[i];
+    sheet[i] = sheet_names_[range.sheet_];
+    first_row[i] = range.first_row_;
+    first_col[i] = range.first_col_;
+    last_row[i] = range.last_row_;
+    last_col[i] = range.last_col_;
+  }
+
+  return List::create(
+      _["references"] = dataFrame(List::create(
+          _["sheet"] = sheet,
+          _["first_row"] = first_row,
+          _["first_col"] = first_col,
+          _["last_row"] = last_row,
+          _["last_col"] = last_col)),
+      _["reference_offsets"] = wrap(reference_offsets_),
+      _["precedents"] = oneBased(precedents_),
+      _["precedent_offsets"] = wrap(precedent_offsets_),
+      _["dependents"] = oneBased(dependents_),
+      _["dependent_offsets"] = wrap(dependent_offsets_));
+}
+
+void xlsxdependencies::findDependents(const cellrange& range,
+                                      std::vector<int>& out) const {
+  size_t first = out.size();
+  index_.find(range, out);
+  for (size_t i = first; i < out.size(); ++i)
+    out[i] = reference_cells_[out[i]];
+}
+
+std::vector<cellrange> xlsxdependencies::queryRanges(
+    CharacterVector sheets, CharacterVector refs) const {
+  std::vector<cellrange> out;
+  for (R_xlen_t k = 0; k < refs.size(); ++k) {
+    SEXP sheet = sheets[k];
+    SEXP ref = refs[k];
+    std::unordered_map<std::string, int>::const_iterator it =
+      sheet_index_.find(upper(CHAR(sheet), LENGTH(sheet)));
+    if (sheet == NA_STRING || it == sheet_index_.end())
+      stop("Sheet not found: '%s'", CHAR(sheet));
+    std::string text = upper(CHAR(ref), LENGTH(ref));
+    cellrange range;
+    if (ref == NA_STRING || !parseRange(text.data(), text.size(), range))
+      stop("Invalid reference: '%s'", CHAR(ref));
+    range.sheet_ = it->second;
+    out.push_back(range);
+  }
+  return out;
+}
+
+IntegerVector xlsxdependencies::dependents(CharacterVector sheets,
+                                           CharacterVector refs,
+                                           bool recursive) const {
+  std::vector<cellrange> ranges = queryRanges(sheets, refs);
+  std::vector<unsigned char> seen(sheets_.size());
+  std::deque<int> queue;
+  std::vector<int> found;
+  for (size_t k = 0; k < ranges.size(); ++k) {
+    found.clear();
+    index_.find(ranges[k], found);
+    for (size_t i = 0; i < found.size(); ++i) {
+      int cell = reference_cells_[found[i]];
+      if (!seen[cell]) {
+        seen[cell] = 1;
+        queue.push_back(cell);
+      }
+    }
+  }
+  while (recursive && !queue.empty()) {
+    int cell = queue.front();
+    queue.pop_front();
+    for (int i = dependent_offsets_[cell]; i < dependent_offsets_[cell + 1]; ++i) {
+      if (!seen[dependents_[i]]) {
+        seen[dependents_[i]] = 1;
+        queue.push_back(dependents_[i]);
+      }
+    }
+  }
+
+  std::vector<int> out;
+  for (size_t k = 0; k < seen.size(); ++k) {
+    if (seen[k])
+      out.push_back(k);
+  }
+  return oneBased(out);
+}
+
+IntegerVector xlsxdependencies::precedents(CharacterVector sheets,
+                                           CharacterVector refs,
+                                           bool recursive) const {
+  std::vector<cellrange> ranges = queryRanges(sheets, refs);
+  std::vector<unsigned char> seen(sheets_.size());
+  std::deque<int> queue;
+  for (size_t k = 0; k < ranges.size(); ++k) {
+    const cellrange& range = ranges[k];
+    position first = {range.sheet_, packAddress(range.first_row_, 0), 0};
+    std::vector<position>::const_iterator it =
+      std::lower_bound(positions_.begin(), positions_.end(), first,
+                       [](const position& a, const position& b) {
+                         return std::tie(a.sheet_, a.address_)
+                           < std::tie(b.sheet_, b.address_);
+                       });
+    uint64_t last = packAddress(range.last_row_, MAX_COL);
+    for (; it != positions_.end() && it->sheet_ == range.sheet_
+        && it->address_ <= last; ++it) {
+      int col = cols_[it->cell_];
+      if (col >= range.first_col_ && col <= range.last_col_
+          && !seen[it->cell_]) {
+        seen[it->cell_] = 1;
+        queue.push_back(it->cell_);
+      }
+    }
+  }
+  while (recursive && !queue.empty()) {
+    int cell = queue.front();
+    queue.pop_front();
+    for (int i = precedent_offsets_[cell]; i < precedent_offsets_[cell + 1]; ++i) {
+      if (!seen[precedents_[i]]) {
+        seen[precedents_[i]] = 1;
+        queue.push_back(precedents_[i]);
+      }
+    }
+  }
+
+  std::vector<int> out;
+  for (size_t k = 0; k < seen.size(); ++k) {
+    for (int i = reference_offsets_[k]; seen[k] && i < reference_offsets_[k + 1]; ++i)
+      out.push_back(i);
+  }
+  return oneBased(out);
+}
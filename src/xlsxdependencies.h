@@ -0,0 +1,131 @@
+#ifndef XLSXDEPENDENCIES_
+#define XLSXDEPENDENCIES_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <Rcpp.h>
+#include "rangeindex.h"
+
+// The graph of references between the formulas of a workbook.
+//
+// Each formula is lexed, and its references resolved to ranges of cells:
+// refs, sheet-qualified refs (including three-dimensional ones like
+// Sheet1:Sheet3!A1, which are a range on each sheet), and defined names, which
+// are resolved in turn.  References to other workbooks, structured references
+// to tables, and references that are only known when the formula is
+// calculated, e.g. by INDIRECT(), are left out.
+//
+// The graph is stored in compressed sparse row form: the references of formula
+// cell i are references_[reference_offsets_[i], reference_offsets_[i + 1]),
+// and likewise the formula cells that it refers to (precedents_) and the
+// formula cells that refer to it (dependents_).  The references are indexed
+// by rangeindex, so the dependents of any cell, formula or not, can be found
+// without looking at every formula.
+
+class xlsxdependencies {
+
+  public:
+
+    xlsxdependencies(
+        Rcpp::CharacterVector sheet_names,   // in the order of the workbook
+        Rcpp::IntegerVector sheets,          // one-based, of each formula cell
+        Rcpp::IntegerVector rows,
+        Rcpp::IntegerVector cols,
+        Rcpp::CharacterVector formulas,
+        Rcpp::IntegerVector name_sheets,     // one-based scope, NA if global
+        Rcpp::CharacterVector names,
+        Rcpp::CharacterVector name_formulas,
+        int threads);
+
+    Rcpp::List information() const;
+
+    // The formula cells (one-based) that refer to any of the ranges, e.g.
+    // sheet "Inputs" and ref "B7", and if recursive, the ones that refer to
+    // those, and so on.
+    Rcpp::IntegerVector dependents(Rcpp::CharacterVector sheets,
+                                   Rcpp::CharacterVector refs,
+                                   bool recursive) const;
+
+    // The references (one-based) of the formula cells in any of the ranges,
+    // and if recursive, of the formula cells that they refer to, and so on.
+    Rcpp::IntegerVector precedents(Rcpp::CharacterVector sheets,
+                                   Rcpp::CharacterVector refs,
+                                   bool recursive) const;
+
+    // Appends the formula cells (zero-based) that refer to any cell of range,
+    // in no particular order, and perhaps more than once
+    void findDependents(const cellrange& range, std::vector<int>& out) const;
+
+    // The sheets (zero-based) of a sheet token such as "Sheet1!",
+    // "'My sheet'!" or "Sheet1:Sheet3!".  Returns false if the sheets aren't
+    // in this workbook.
+    bool parseSheets(const char* x, size_t n, int& first, int& last) const;
+
+    // A defined name in the scope of a sheet, or else a global one.  Returns
+    // its position among the names, or -1.
+    int findName(int sheet, const char* x, size_t n) const;
+
+    size_t nameCount() const { return names_.size(); }
+    const std::string& nameFormula(int k) const { return names_[k].formula_; }
+    int nameScope(int k) const { return names_[k].scope_; }
+
+  private:
+
+    struct definedname {
+      std::string formula_;
+      int scope_;                        // zero-based sheet, -1 if global
+      int state_;                        // 0 unresolved, 1 resolving, 2 done
+      std::vector<cellrange> ranges_;    // sheet -1 for the sheet of the user
+    };
+
+    struct position {
+      int sheet_;
+      uint64_t address_;                 // packAddress(row, col)
+      int cell_;
+    };
+
+    Rcpp::CharacterVector sheet_names_;
+    std::unordered_map<std::string, int> sheet_index_; // by upper-case name
+    std::vector<definedname> names_;
+    std::unordered_map<std::string, int> name_index_;  // by scope and name
+
+    std::vector<int> sheets_;            // of each formula cell, zero-based
+    std::vector<int> rows_;
+    std::vector<int> cols_;
+    std::vector<position> positions_;    // of the formula cells, in order
+
+    std::vector<cellrange> references_;
+    std::vector<int> reference_offsets_;
+    std::vector<int> reference_cells_;   // the formula cell of each reference
+    std::vector<int> precedents_;
+    std::vector<int> precedent_offsets_;
+    std::vector<int> dependents_;
+    std::vector<int> dependent_offsets_;
+    rangeindex index_;
+
+    void resolveNames();
+    void resolveName(int k);
+
+    // Appends the ranges that the formula refers to.  Modifies names_ while
+    // names are being resolved, but not afterwards, so formulas can then be
+    // resolved on several threads at once.
+    void resolve(const char* formula, size_t size, int sheet,
+                 std::vector<cellrange>& out);
+
+    void resolveFormulas(Rcpp::CharacterVector formulas, int threads);
+    void linkFormulas(int threads);
+
+    std::vector<cellrange> queryRanges(Rcpp::CharacterVector sheets,
+                                       Rcpp::CharacterVector refs) const;
+
+};
+
+// The xlsxdependencies behind an external pointer
+inline xlsxdependencies& as_xlsxdependencies(SEXP graph) {
+  Rcpp::XPtr<xlsxdependencies> ptr(graph);
+  return *ptr;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "xlsxdimensions.h"
+#include "xlsxfile.h"
+#include "sheetreader.h"
+#include "celllexer.h"
+#include "number.h"
+#include "dataframe.h"
+
+using namespace Rcpp;
+
+xlsxdimensions::xlsxdimensions(
+    xlsxfile& file,
+    CharacterVector sheet_paths,
+    CharacterVector sheet_names) {
+  for (R_xlen_t k = 0; k < sheet_paths.size(); ++k) {
+    sheets_.push_back(std::string(sheet_names[k]));
+    heights_.push_back(dimensions(15));
+    widths_.push_back(dimensions(8.47));
+    dimensions& heights = heights_.back();
+    dimensions& widths = widths_.back();
+
+    // Defaults and column widths are before <sheetData>, but row heights are
+    // on each <row>, so the rows are streamed too, lexing only their start
+    // tags.
+    sheetreader reader(file.archive_, std::string(sheet_paths[k]));
+    rapidxml::xml_document<> xml;
+    xml.parse<rapidxml::parse_strip_xml_namespaces>(&reader.head()[0]);
+    rapidxml::xml_node<>* worksheet = xml.first_node("worksheet");
+    cacheDefaultDims(worksheet, heights.default_, widths.default_);
+    cacheColWidths(worksheet, widths);
+
+    celllexer lexer;
+    char* text;
+    unsigned long long int n(0);
+    while ((text = reader.nextRow()) != NULL) {
+      char* end = text + reader.rowSize();
+      if (!lexer.lexRow(text, end)) {
+        xml.clear();
+        lexer.parse(text, end, xml);
+      }
+      if (lexer.row_ > 0 && lexer.ht_ != NULL) {
+        heights.add(lexer.row_, lexer.row_,
+                    parseNumber(lexer.ht_, lexer.ht_size_));
+      }
+      if (++n % 1000 == 0)
+        checkUserInterrupt();
+    }
+    heights.index();
+  }
+}
+
+// One row per run of rows or columns of a custom size
+static List runs(const std::vector<std::string>& sheets,
+                 const std::vector<dimensions>& sizes,
+                 const char* first, const char* last, const char* size) {
+  size_t n(0);
+  for (size_t k = 0; k < sizes.size(); ++k)
+    n += sizes[k].runs_.size();
+
+  CharacterVector sheet_(n);
+  IntegerVector   first_(n);
+  IntegerVector   last_(n);
+  NumericVector   size_(n);
+  size_t i(0);
+  for (size_t k = 0; k < sizes.size(); ++k) {
+    SEXP name = Rf_mkCharCE(sheets[k].c_str(), CE_UTF8);
+    const std::vector<dimensions::run>& runs = sizes[k].runs_;
+    for (size_t j = 0; j < runs.size(); ++j, ++i) {
+      SET_STRING_ELT(sheet_, i, name);
+      first_[i] = runs[j].first_;
+      last_[i] = runs[j].last_;
+      size_[i] = runs[j].size_;
+    }
+  }
+
+  List out = List::create(sheet_, first_, last_, size_);
+  out.attr("names") = CharacterVector::create("sheet", first, last, size);
+  return dataFrame(out);
+}
+
+List xlsxdimensions::information() {
+  size_t n = sheets_.size();
+  CharacterVector sheet_(n);
+  NumericVector   height_(n);
+  NumericVector   width_(n);
+  for (size_t k = 0; k < n; ++k) {
+    SET_STRING_ELT(sheet_, k, Rf_mkCharCE(sheets_[k].c_str(), CE_UTF8));
+    height_[k] = heights_[k].default_;
+    width_[k] = widths_[k].default_;
+  }
+  List defaults = List::create(
+      _["sheet"] = sheet_,
+      _["height"] = height_,
+      _["width"] = width_);
+
+  return List::create(
+      _["default"] = dataFrame(defaults),
+      _["rows"] = runs(sheets_, heights_, "first_row", "last_row", "height"),
+      _["cols"] = runs(sheets_, widths_, "first_col", "last_col", "width"));
+}
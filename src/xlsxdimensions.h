@@ -0,0 +1,29 @@
+#ifndef XLSXDIMENSIONS_
+#define XLSXDIMENSIONS_
+
+#include <Rcpp.h>
+#include "xlsxfile.h"
+#include "dimensions.h"
+
+// The default and custom heights of rows and widths of columns of each sheet,
+// as tables of runs, so that they don't have to be repeated for every cell as
+// in the height and width columns of xlsx_cells().
+
+class xlsxdimensions {
+
+  public:
+
+    std::vector<std::string> sheets_;
+    std::vector<dimensions> heights_; // of each sheet
+    std::vector<dimensions> widths_;
+
+    xlsxdimensions(
+      xlsxfile& file,
+      Rcpp::CharacterVector sheet_paths,
+      Rcpp::CharacterVector sheet_names);
+
+    Rcpp::List information(); // list of data frames: default, rows, cols
+
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include <Rcpp.h>
+#include "zip.h"
+#include "rapidxml.h"
+#include "xlsxfile.h"
+#include "xlsxstyles.h"
+#include "string.h"
+#include "dataframe.h"
+
+using namespace Rcpp;
+
+xlsxfile::xlsxfile(const std::string& path):
+  path_(path),
+  archive_(path_),
+  workbook_(NULL),
+  has_theme_(false),
+  has_strings_(false),
+  has_sheet_files_(false) {}
+
+rapidxml::xml_node<>* xlsxfile::workbook() {
+  if (workbook_ == NULL) {
+    workbook_xml_ = archive_.buffer("xl/workbook.xml");
+    workbook_doc_.parse<rapidxml::parse_strip_xml_namespaces>(&workbook_xml_[0]);
+    workbook_ = workbook_doc_.first_node("workbook");
+    cacheDateOffset();
+  }
+  return workbook_;
+}
+
+int xlsxfile::dateSystem() {
+  workbook();
+  return dateSystem_;
+}
+
+int xlsxfile::dateOffset() {
+  workbook();
+  return dateOffset_;
+}
+
+Rcpp::CharacterVector& xlsxfile::theme() {
+  if (!has_theme_) {
+    cacheThemeRgb();
+    has_theme_ = true;
+  }
+  return theme_;
+}
+
+xlsxstyles& xlsxfile::styles() {
+  if (!styles_) {
+    styles_.reset(new xlsxstyles(archive_, theme()));
+  }
+  return *styles_;
+}
+
+std::vector<std::string>& xlsxfile::strings() {
+  if (!has_strings_) {
+    cacheStrings();
+    has_strings_ = true;
+  }
+  return strings_;
+}
+
+richtext& xlsxfile::stringsFormatted() {
+  strings();
+  return strings_formatted_;
+}
+
+SEXP xlsxfile::stringChar(size_t i) {
+  // Making a CHARSXP means looking it up in R's global cache of strings, so
+  // it is done only once per string, and only for strings that are used.
+  if (has_string_char_.size() != strings().size()) {
+    string_chars_ = CharacterVector(strings_.size());
+    has_string_char_.assign(strings_.size(), false);
+  }
+  if (!has_string_char_[i]) {
+    SET_STRING_ELT(string_chars_, i, Rf_mkCharCE(strings_[i].c_str(), CE_UTF8));
+    has_string_char_[i] = true;
+  }
+  return STRING_ELT(string_chars_, i);
+}
+
+Rcpp::List& xlsxfile::sheetFiles() {
+  if (!has_sheet_files_) {
+    cacheSheetFiles();
+    has_sheet_files_ = true;
+  }
+  return sheet_files_;
+}
+
+void xlsxfile::cacheDateOffset() {
+  rapidxml::xml_node<>* workbookPr = workbook_->first_node("workbookPr");
+  if (workbookPr != NULL) {
+    rapidxml::xml_attribute<>* date1904 = workbookPr->first_attribute("date1904");
+    if (date1904 != NULL) {
+      std::string is1904 = date1904->value();
+      if ((is1904 == "1") || (is1904 == "true")) {
+        dateSystem_ = 1904;
+        dateOffset_ = 24107;
+        return;
+      }
+    }
+  }
+
+  dateSystem_ = 1900;
+  dateOffset_ = 25569;
+}
+
+void xlsxfile::cacheThemeRgb() {
+  theme_ = CharacterVector(12, NA_STRING);
+  std::string FF = "FF";
+  if (archive_.hasFile("xl/theme/theme1.xml")) {
+    std::string theme1 = archive_.buffer("xl/theme/theme1.xml");
+    rapidxml::xml_document<> theme1_xml;
+    theme1_xml.parse<0>(&theme1[0]);
+    rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
+    rapidxml::xml_node<>* themeElements = theme->first_node("a:themeElements");
+    rapidxml::xml_node<>* clrScheme = themeElements->first_node("a:clrScheme");
+
+    // First, two sysClr nodes in the wrong order
+    rapidxml::xml_node<>* color = clrScheme->first_node();
+    theme_[1] = FF + color->first_node()->first_attribute("lastClr")->value();
+    color = color->next_sibling();
+    theme_[0] = FF + color->first_node()->first_attribute("lastClr")->value();
+
+    // Then, two srgbClr nodes in the wrong order
+    color = color->next_sibling();
+    theme_[3] = FF + color->first_node()->first_attribute("val")->value();
+    color = color->next_sibling();
+    theme_[2] = FF + color->first_node()->first_attribute("val")->value();
+
+    // Finally, eight more srgbClr nodes in the correct order
+    // Can't reuse 'color' here, so use 'nextcolor'
+    int i = 4;
+    for (rapidxml::xml_node<>* nextcolor = color->next_sibling();
+        nextcolor; nextcolor = nextcolor->next_sibling()) {
+      theme_[i] = FF + nextcolor->first_node()->first_attribute("val")->value();
+      i++;
+    }
+  }
+}
+
+// Based on hadley/readxl
+void xlsxfile::cacheStrings() {
+  if (!archive_.hasFile("xl/sharedStrings.xml"))
+    return;
+
+  // Inline formatting refers to fonts and colors in the styles
+  xlsxstyles& styles = this->styles();
+
+  std::string xml = archive_.buffer("xl/sharedStrings.xml");
+  rapidxml::xml_document<> sharedStrings;
+  sharedStrings.parse<rapidxml::parse_strip_xml_namespaces>(&xml[0]);
+
+  rapidxml::xml_node<>* sst = sharedStrings.first_node("sst");
+  rapidxml::xml_attribute<>* uniqueCount = sst->first_attribute("uniqueCount");
+  if (uniqueCount != NULL) {
+    unsigned long int n = strtol(uniqueCount->value(), NULL, 10);
+    strings_.reserve(n);
+  }
+
+  // 18.4.8 si (String Item) [p1725]
+  for (rapidxml::xml_node<>* string = sst->first_node();
+      string; string = string->next_sibling()) {
+    std::string out;
+    parseString(string, out);    // missing strings are treated as empty ""
+    strings_.push_back(out);
+
+    strings_formatted_.add(string, styles);
+  }
+}
+
+inline String comments_path_(const zip_archive& archive, std::string sheet_target) {
+  // Given a sheet id, return the path to the comments file, should one exist
+  std::string sheet_rels = "xl/worksheets/_rels/" + sheet_target.replace(0, 11, "") + ".rels";
+  if (archive.hasFile(sheet_rels)) {
+    std::string targets_text = archive.buffer(sheet_rels);
+    rapidxml::xml_document<> targets_xml;
+    targets_xml.parse<rapidxml::parse_strip_xml_namespaces>(&targets_text[0]);
+    rapidxml::xml_node<>* relationships = targets_xml.first_node("Relationships");
+    for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
+        relationship; relationship = relationship->next_sibling()) {
+      std::string target = relationship->first_attribute("Target")->value();
+      if (target.substr(0, 11) == "../comments") {
+        // Return the comments file path
+        return(target.replace(0, 2, "xl"));
+      }
+    }
+  }
+  return NA_STRING;
+}
+
+void xlsxfile::cacheSheetFiles() {
+  // Return a list of worksheets,  their index numbers, names, and comments
+  // paths.
+
+  // primary key of two 'tables' of worksheets and other objects
+  // e.g. workbook.xml.rels Id="rId1" target = "worksheets/sheet1.xml"
+  std::string id;
+  std::vector<std::string> ids;
+
+  // Get the filenames of worksheets, indexed by rId, and the same of any
+  // comments files
+  std::map<std::string, std::string> sheet_paths;
+  std::map<std::string, String> comments_paths;
+  std::string rels_text = archive_.buffer("xl/_rels/workbook.xml.rels");
+  rapidxml::xml_document<> rels_xml;
+  rels_xml.parse<rapidxml::parse_strip_xml_namespaces>(&rels_text[0]);
+  rapidxml::xml_node<>* relationships = rels_xml.first_node("Relationships");
+  for (rapidxml::xml_node<>* relationship = relationships->first_node("Relationship");
+      relationship; relationship = relationship->next_sibling()) {
+    std::string target = relationship->first_attribute("Target")->value();
+    std::string target_type = target.substr(0, 10);
+    if (target_type == "worksheets" || target_type == "chartsheet") {
+       // Only store worksheets and chartsheets -- requests for chartsheets are
+       // handled in the R wrapper
+      id = relationship->first_attribute("Id")->value();
+      ids.push_back(id);
+      sheet_paths.insert({id, "xl/" + target}) ;
+      comments_paths.insert({id, comments_path_(archive_, target)});
+    }
+  }
+
+  // Get the name and sheetId (display order) of all sheets/charts/etc, indexed
+  // by rId
+  std::map<std::string, std::string> names;
+  std::map<std::string, int> sheetIds;
+  rapidxml::xml_node<>* sheets = workbook()->first_node("sheets");
+  for (rapidxml::xml_node<>* sheet = sheets->first_node("sheet");
+      sheet; sheet = sheet->next_sibling()) {
+    rapidxml::xml_attribute<>* r_id = sheet->first_attribute("id");
+    if (r_id != NULL) {
+      id = r_id->value();
+    } else {
+      stop("Invalid xl/workbook.xml: sheet element lacks id attribute"); // # nocov
+    }
+    names[id] = sheet->first_attribute("name")->value();
+    sheetIds[id] = strtol(sheet->first_attribute("sheetId")->value(), NULL, 10);
+  }
+
+  // Join by id
+  std::vector<std::string> out_name;
+  std::vector<int> out_rId;
+  std::vector<int> out_sheetId;
+  std::vector<std::string> out_sheet_path;
+  CharacterVector out_comments_path;
+  for(std::vector<std::string>::iterator it = ids.begin(); it != ids.end(); ++it) {
+    std::string key(*it);
+    out_name.push_back(names[key]);
+    out_rId.push_back(std::strtol(key.substr(3, std::string::npos).c_str(), NULL, 10));
+    out_sheetId.push_back(sheetIds[key]);
+    out_sheet_path.push_back(sheet_paths[key]);
+    out_comments_path.push_back(comments_paths[key]);
+  }
+
+  // Return a data frame
+  sheet_files_ = List::create(
+      _["name"] = out_name,
+      _["rId"] = out_rId,
+      _["sheetId"] = out_sheetId,
+      _["sheet_path"] = out_sheet_path,
+      _["comments_path"] = out_comments_path);
+
+  dataFrame(sheet_files_);
+}
@@ -0,0 +1,73 @@
+#ifndef XLSXFILE_
+#define XLSXFILE_
+
+#include <memory>
+#include <Rcpp.h>
+#include "rapidxml.h"
+#include "zip_archive.h"
+#include "xlsxstyles.h"
+#include "richtext.h"
+
+// An open xlsx file, shared by xlsx_cells(), xlsx_formats(), xlsx_names(),
+// xlsx_validation() etc. so that the archive is indexed, and the book-level
+// parts are parsed, only once however many of them are called.
+//
+// It is returned to R as an external pointer by xlsx_file_().  Each part is
+// parsed the first time it is needed.
+
+class xlsxfile {
+
+  public:
+
+    std::string path_;                 // workbook path
+    zip_archive archive_;              // index of the files in path_
+
+    xlsxfile(const std::string& path);
+
+    rapidxml::xml_node<>* workbook();  // root node of xl/workbook.xml
+    int dateSystem();                  // 1900 or 1904
+    int dateOffset();                  // for converting Excel datetimes to R
+    Rcpp::CharacterVector& theme();    // rgb of each theme color
+    xlsxstyles& styles();
+    std::vector<std::string>& strings();        // strings table
+    richtext& stringsFormatted();      // inline formatting of strings
+    SEXP stringChar(size_t i);         // strings()[i], made into a CHARSXP once
+    Rcpp::List& sheetFiles();          // worksheet paths, names, comments
+
+  private:
+
+    std::string workbook_xml_;         // owns the text of workbook_doc_
+    rapidxml::xml_document<> workbook_doc_;
+    rapidxml::xml_node<>* workbook_;
+
+    int dateSystem_;
+    int dateOffset_;
+
+    bool has_theme_;
+    Rcpp::CharacterVector theme_;
+
+    std::unique_ptr<xlsxstyles> styles_;
+
+    bool has_strings_;
+    std::vector<std::string> strings_;
+    richtext strings_formatted_;
+    Rcpp::CharacterVector string_chars_;   // CHARSXPs made so far
+    std::vector<unsigned char> has_string_char_;
+
+    bool has_sheet_files_;
+    Rcpp::List sheet_files_;
+
+    void cacheDateOffset();
+    void cacheThemeRgb();
+    void cacheStrings();
+    void cacheSheetFiles();
+
+};
+
+// The xlsxfile behind an external pointer returned by xlsx_file_()
+inline xlsxfile& as_xlsxfile(SEXP file) {
+  Rcpp::XPtr<xlsxfile> ptr(file);
+  return *ptr;
+}
+
+#endif
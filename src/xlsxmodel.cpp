@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <utility>
+#include <Rcpp.h>
+#include "xlsxmodel.h"
+#include "xlsxfile.h"
+#include "address.h"
+#include "date.h"
+#include "parallel.h"
+#include "string.h"
+#include "dataframe.h"
+
+using namespace Rcpp;
+
+// The value of row i of the columns of xlsx_cells()
+static cellvalue cellValue(const std::string& data_type, R_xlen_t i,
+                           NumericVector numeric, LogicalVector logical,
+                           CharacterVector character, CharacterVector error) {
+  if (data_type == "numeric" && !ISNA(numeric[i]))
+    return numberValue(numeric[i]);
+  if (data_type == "logical" && logical[i] != NA_LOGICAL)
+    return boolValue(logical[i]);
+  if ((data_type == "character" || data_type == "date (ISO8601)")
+      && character[i] != NA_STRING)
+    return textValue(std::string(character[i]));
+  if (data_type == "error" && error[i] != NA_STRING)
+    return errorValue(std::string(error[i]));
+  return blankValue();
+}
+
+xlsxmodel::xlsxmodel(
+    SEXP file,
+    CharacterVector sheet_names,
+    List cells,
+    List names,
+    int threads): sheet_names_(sheet_names) {
+  xlsxfile& workbook = as_xlsxfile(file);
+  date_system_ = workbook.dateSystem();
+  date_offset_ = workbook.dateOffset();
+
+  size_t n_sheets = sheet_names.size();
+  for (size_t k = 0; k < n_sheets; ++k) {
+    SEXP name = sheet_names[k];
+    sheet_index_[upper(CHAR(name), LENGTH(name))] = k;
+  }
+  addresses_.resize(n_sheets);
+  last_rows_.assign(n_sheets, 0);
+  last_cols_.assign(n_sheets, 0);
+
+  CharacterVector sheets = cells["sheet"];
+  IntegerVector rows = cells["row"];
+  IntegerVector cols = cells["col"];
+  CharacterVector data_types = cells["data_type"];
+  NumericVector numeric = cells["numeric"];
+  NumericVector date = cells["date"];
+  LogicalVector logical = cells["logical"];
+  CharacterVector character = cells["character"];
+  CharacterVector error = cells["error"];
+  CharacterVector formulas = cells["formula"];
+  LogicalVector is_array = cells["is_array"];
+  CharacterVector formula_ref = cells["formula_ref"];
+
+  // The cells are in the order of cells, so that positions in cells_ are rows
+  // of cells.  The rest of the cells of array formulas are added after them.
+  std::vector<R_xlen_t> formula_rows;
+  for (R_xlen_t i = 0; i < sheets.size(); ++i) {
+    int sheet = findSheet(sheets[i]);
+    int k = addCell(sheet, rows[i], cols[i]);
+    std::string data_type(data_types[i]);
+    if (data_type == "date") {
+      cells_[k].is_date_ = true;
+      if (!ISNA(date[i]))
+        cells_[k].value_ = numberValue(fromDate(date[i]));
+    } else {
+      cells_[k].value_ = cellValue(data_type, i, numeric, logical, character,
+                                   error);
+    }
+    if (formulas[i] != NA_STRING) {
+      cells_[k].formula_ = formula_rows.size();
+      formula_rows.push_back(i);
+    }
+  }
+
+  // The dependency graph of the formula cells, in the same order as formulas_
+  size_t n_formulas = formula_rows.size();
+  IntegerVector formula_sheets(n_formulas);
+  IntegerVector formula_rows_(n_formulas);
+  IntegerVector formula_cols(n_formulas);
+  CharacterVector formula_texts(n_formulas);
+  for (size_t f = 0; f < n_formulas; ++f) {
+    R_xlen_t i = formula_rows[f];
+    formula_sheets[f] = findSheet(sheets[i]) + 1;
+    formula_rows_[f] = rows[i];
+    formula_cols[f] = cols[i];
+    formula_texts[f] = formulas[i];
+  }
+  CharacterVector name_sheet_names = names["sheet"];
+  IntegerVector name_sheets(name_sheet_names.size());
+  for (R_xlen_t i = 0; i < name_sheet_names.size(); ++i) {
+    name_sheets[i] = name_sheet_names[i] == NA_STRING
+      ? NA_INTEGER : findSheet(name_sheet_names[i]) + 1;
+  }
+  graph_.reset(new xlsxdependencies(sheet_names, formula_sheets,
+                                    formula_rows_, formula_cols,
+                                    formula_texts, name_sheets,
+                                    names["name"], names["formula"], threads));
+
+  names_.resize(graph_->nameCount());
+  for (size_t k = 0; k < names_.size(); ++k) {
+    const std::string& formula = graph_->nameFormula(k);
+    names_[k].compile(formula.data(), formula.size(), graph_->nameScope(k),
+                      *graph_);
+  }
+
+  formulas_.resize(n_formulas);
+  for (size_t f = 0; f < n_formulas; ++f) {
+    R_xlen_t i = formula_rows[f];
+    modelformula& formula = formulas_[f];
+    formula.cell_ = i;
+    formula.array_ = is_array[i] == TRUE;
+    formula.active_ = true;
+    const modelcell& cell = cells_[i];
+    cellrange output = {cell.sheet_, cell.row_, cell.col_, cell.row_, cell.col_};
+    if (formula.array_ && formula_ref[i] != NA_STRING) {
+      SEXP ref = formula_ref[i];
+      std::string text = upper(CHAR(ref), LENGTH(ref));
+      if (parseRange(text.data(), text.size(), output))
+        output.sheet_ = cell.sheet_;
+    }
+    formula.output_ = output;
+    for (int row = output.first_row_; row <= output.last_row_; ++row) {
+      for (int col = output.first_col_; col <= output.last_col_; ++col) {
+        if (findCell(output.sheet_, row, col) < 0)
+          addCell(output.sheet_, row, col);
+      }
+    }
+  }
+
+  // Compile the formulas on several threads
+  std::vector<const char*> texts(n_formulas);
+  std::vector<size_t> sizes(n_formulas);
+  for (size_t f = 0; f < n_formulas; ++f) {
+    SEXP formula = formula_texts[f];
+    texts[f] = CHAR(formula);
+    sizes[f] = LENGTH(formula);
+  }
+  parallel pool(threads);
+  pool.runBlocks(n_formulas, [&](size_t, size_t begin, size_t end) {
+    for (size_t f = begin; f < end; ++f) {
+      formulas_[f].formula_.compile(texts[f], sizes[f],
+                                    cells_[formulas_[f].cell_].sheet_, *graph_);
+    }
+  });
+
+  dirty_.assign(n_formulas, 0);
+  waiting_.assign(n_formulas, 0);
+}
+
+int xlsxmodel::findSheet(SEXP name) const {
+  if (name != NA_STRING) {
+    std::unordered_map<std::string, int>::const_iterator it =
+      sheet_index_.find(upper(CHAR(name), LENGTH(name)));
+    if (it != sheet_index_.end())
+      return it->second;
+  }
+  stop("Sheet not found: '%s'", CHAR(name));
+}
+
+int xlsxmodel::findCell(int sheet, int row, int col) const {
+  const std::unordered_map<uint64_t, int>& addresses = addresses_[sheet];
+  std::unordered_map<uint64_t, int>::const_iterator it =
+    addresses.find(packAddress(row, col));
+  return it == addresses.end() ? -1 : it->second;
+}
+
+int xlsxmodel::addCell(int sheet, int row, int col) {
+  int k = cells_.size();
+  modelcell cell = {sheet, row, col, false, -1, blankValue()};
+  cells_.push_back(cell);
+  addresses_[sheet][packAddress(row, col)] = k;
+  last_rows_[sheet] = std::max(last_rows_[sheet], row);
+  last_cols_[sheet] = std::max(last_cols_[sheet], col);
+  return k;
+}
+
+const cellvalue& xlsxmodel::value(int sheet, int row, int col) const {
+  static const cellvalue blank = blankValue();
+  if (sheet < 0 || (size_t)sheet >= addresses_.size())
+    return blank;
+  int k = findCell(sheet, row, col);
+  return k < 0 ? blank : cells_[k].value_;
+}
+
+void xlsxmodel::values(const cellrange& range,
+                       std::vector<const cellvalue*>& out) const {
+  int sheet = range.sheet_;
+  if (sheet < 0 || (size_t)sheet >= addresses_.size())
+    return;
+  int last_row = std::min(range.last_row_, last_rows_[sheet]);
+  int last_col = std::min(range.last_col_, last_cols_[sheet]);
+  if (last_row < range.first_row_ || last_col < range.first_col_)
+    return;
+
+  // Look up each address of a small range, but go through every cell of the
+  // sheet rather than the addresses of a big one, e.g. a whole column
+  const std::unordered_map<uint64_t, int>& addresses = addresses_[sheet];
+  double area = (double)(last_row - range.first_row_ + 1)
+    * (last_col - range.first_col_ + 1);
+  if (area <= addresses.size()) {
+    for (int row = range.first_row_; row <= last_row; ++row) {
+      for (int col = range.first_col_; col <= last_col; ++col) {
+        std::unordered_map<uint64_t, int>::const_iterator it =
+          addresses.find(packAddress(row, col));
+        if (it != addresses.end()
+            && cells_[it->second].value_.type_ != value_type::BLANK)
+          out.push_back(&cells_[it->second].value_);
+      }
+    }
+    return;
+  }
+  for (std::unordered_map<uint64_t, int>::const_iterator it = addresses.begin();
+      it != addresses.end(); ++it) {
+    const modelcell& cell = cells_[it->second];
+    if (cell.row_ >= range.first_row_ && cell.row_ <= last_row
+        && cell.col_ >= range.first_col_ && cell.col_ <= last_col
+        && cell.value_.type_ != value_type::BLANK)
+      out.push_back(&cell.value_);
+  }
+}
+
+const xlformula* xlsxmodel::name(int k) const {
+  if (k < 0 || (size_t)k >= names_.size())
+    return NULL;
+  return &names_[k];
+}
+
+IntegerVector xlsxmodel::unsupported() const {
+  std::vector<int> out;
+  for (size_t f = 0; f < formulas_.size(); ++f) {
+    if (!formulas_[f].formula_.supported())
+      out.push_back(formulas_[f].cell_ + 1);
+  }
+  return wrap(out);
+}
+
+// Serial numbers of dates, from the POSIXct of xlsx_cells(), and back again.
+// The inverse of checkDate() in date.h.
+double xlsxmodel::fromDate(double date) const {
+  double serial = date / 86400 + date_offset_;
+  if (date_system_ == 1900 && serial < 61)
+    serial -= 1;
+  return serial;
+}
+
+double xlsxmodel::toDate(double serial) const {
+  int date_system = date_system_;
+  int date_offset = date_offset_;
+  return checkDate(serial, date_system, date_offset, "");
+}
+
+// Marks the formulas that depend on any of the changed ranges as dirty, and
+// the ones that depend on those, and so on
+void xlsxmodel::markDirty(const std::vector<cellrange>& changed) {
+  std::vector<int> found;
+  size_t first = dirty_list_.size();
+  for (size_t k = 0; k < changed.size(); ++k)
+    graph_->findDependents(changed[k], found);
+  for (size_t q = first; ; ++q) {
+    for (size_t i = 0; i < found.size(); ++i) {
+      int f = found[i];
+      if (!dirty_[f]) {
+        dirty_[f] = 1;
+        dirty_list_.push_back(f);
+      }
+    }
+    if (q >= dirty_list_.size())
+      break;
+    found.clear();
+    graph_->findDependents(formulas_[dirty_list_[q]].output_, found);
+  }
+}
+
+void xlsxmodel::setValues(CharacterVector sheets,
+                          CharacterVector addresses,
+                          SEXP values) {
+  bool is_date = Rf_inherits(values, "POSIXct") || Rf_inherits(values, "Date");
+  double date_scale = Rf_inherits(values, "Date") ? 86400 : 1;
+  std::vector<cellrange> changed;
+  for (R_xlen_t i = 0; i < addresses.size(); ++i) {
+    int sheet = findSheet(sheets[i]);
+    SEXP address = addresses[i];
+    std::string text = upper(CHAR(address), LENGTH(address));
+    cellrange range;
+    if (address == NA_STRING || !parseRange(text.data(), text.size(), range)
+        || range.first_row_ != range.last_row_
+        || range.first_col_ != range.last_col_)
+      stop("Invalid address: '%s'", CHAR(address));
+    range.sheet_ = sheet;
+
+    cellvalue x = blankValue();
+    switch (TYPEOF(values)) {
+      case REALSXP:
+        if (!ISNA(REAL(values)[i]))
+          x = numberValue(is_date ? fromDate(REAL(values)[i] * date_scale)
+                                  : REAL(values)[i]);
+        break;
+      case INTSXP:
+        if (INTEGER(values)[i] != NA_INTEGER)
+          x = numberValue(INTEGER(values)[i]);
+        break;
+      case LGLSXP:
+        if (LOGICAL(values)[i] != NA_LOGICAL)
+          x = boolValue(LOGICAL(values)[i]);
+        break;
+      case STRSXP:
+        if (STRING_ELT(values, i) != NA_STRING)
+          x = textValue(CHAR(STRING_ELT(values, i)));
+        break;
+      default:
+        stop("Values must be numbers, text or logicals.");
+    }
+
+    int k = findCell(sheet, range.first_row_, range.first_col_);
+    if (k < 0)
+      k = addCell(sheet, range.first_row_, range.first_col_);
+    modelcell& cell = cells_[k];
+    if (cell.formula_ >= 0) {
+      formulas_[cell.formula_].active_ = false;
+      cell.formula_ = -1;
+    }
+    if (is_date)
+      cell.is_date_ = true;
+    cell.value_ = x;
+    changed.push_back(range);
+  }
+  markDirty(changed);
+}
+
+void xlsxmodel::calculate(int f) {
+  const modelformula& formula = formulas_[f];
+  const modelcell& cell = cells_[formula.cell_];
+  cellposition at = {cell.sheet_, cell.row_, cell.col_, formula.array_};
+  operand result = formula.formula_.evaluate(*this, at);
+  const cellrange& output = formula.output_;
+  std::vector<cellvalue> values;
+  for (int row = output.first_row_; row <= output.last_row_; ++row) {
+    for (int col = output.first_col_; col <= output.last_col_; ++col) {
+      values.push_back(resultValue(result, *this, at,
+                                   row - output.first_row_,
+                                   col - output.first_col_));
+    }
+  }
+  // Only now that the whole result has been read can it be written
+  size_t i = 0;
+  for (int row = output.first_row_; row <= output.last_row_; ++row) {
+    for (int col = output.first_col_; col <= output.last_col_; ++col)
+      cells_[findCell(output.sheet_, row, col)].value_ = std::move(values[i++]);
+  }
+}
+
+List xlsxmodel::recalculate(bool all) {
+  if (all) {
+    for (size_t f = 0; f < formulas_.size(); ++f) {
+      if (!dirty_[f]) {
+        dirty_[f] = 1;
+        dirty_list_.push_back(f);
+      }
+    }
+  }
+
+  // If this is interrupted, the formulas stay dirty to be calculated again
+  // by the next call, but waiting_ must be zero again
+  std::vector<int> found;
+  std::vector<cellrange> calculated;
+  try {
+    // Each dirty formula waits for the dirty formulas that it depends on
+    for (size_t i = 0; i < dirty_list_.size(); ++i) {
+      found.clear();
+      graph_->findDependents(formulas_[dirty_list_[i]].output_, found);
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+      for (size_t j = 0; j < found.size(); ++j) {
+        if (dirty_[found[j]])
+          ++waiting_[found[j]];
+      }
+    }
+    std::vector<int> ready;
+    for (size_t i = 0; i < dirty_list_.size(); ++i) {
+      if (waiting_[dirty_list_[i]] == 0)
+        ready.push_back(dirty_list_[i]);
+    }
+
+    for (size_t q = 0; q < ready.size(); ++q) {
+      int f = ready[q];
+      if (formulas_[f].active_) {
+        calculate(f);
+        calculated.push_back(formulas_[f].output_);
+      }
+      found.clear();
+      graph_->findDependents(formulas_[f].output_, found);
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+      for (size_t j = 0; j < found.size(); ++j) {
+        if (dirty_[found[j]] && --waiting_[found[j]] == 0)
+          ready.push_back(found[j]);
+      }
+      if (q % 1000 == 999)
+        checkUserInterrupt();
+    }
+  } catch (...) {
+    for (size_t i = 0; i < dirty_list_.size(); ++i)
+      waiting_[dirty_list_[i]] = 0;
+    throw;
+  }
+
+  // Formulas in circular references never become ready, so keep their values
+  for (size_t i = 0; i < dirty_list_.size(); ++i) {
+    dirty_[dirty_list_[i]] = 0;
+    waiting_[dirty_list_[i]] = 0;
+  }
+  dirty_list_.clear();
+
+  std::vector<cellrange> cells;
+  for (size_t k = 0; k < calculated.size(); ++k) {
+    const cellrange& output = calculated[k];
+    for (int row = output.first_row_; row <= output.last_row_; ++row) {
+      for (int col = output.first_col_; col <= output.last_col_; ++col) {
+        cellrange cell = {output.sheet_, row, col, row, col};
+        cells.push_back(cell);
+      }
+    }
+  }
+  return cellValues(cells);
+}
+
+List xlsxmodel::values(CharacterVector sheets, CharacterVector addresses) {
+  if (!dirty_list_.empty())
+    recalculate(false);
+  std::vector<cellrange> cells;
+  for (R_xlen_t i = 0; i < addresses.size(); ++i) {
+    SEXP address = addresses[i];
+    std::string text = upper(CHAR(address), LENGTH(address));
+    cellrange range;
+    if (address == NA_STRING || !parseRange(text.data(), text.size(), range)
+        || range.first_row_ != range.last_row_
+        || range.first_col_ != range.last_col_)
+      stop("Invalid address: '%s'", CHAR(address));
+    range.sheet_ = findSheet(sheets[i]);
+    cells.push_back(range);
+  }
+  return cellValues(cells);
+}
+
+// The values of cells, as the columns of xlsx_cells() that hold them
+List xlsxmodel::cellValues(const std::vector<cellrange>& cells) const {
+  size_t n = cells.size();
+  CharacterVector sheet(n);
+  CharacterVector address(n);
+  IntegerVector row(n);
+  IntegerVector col(n);
+  CharacterVector data_type(n);
+  CharacterVector error(n, NA_STRING);
+  LogicalVector logical(n, NA_LOGICAL);
+  NumericVector numeric(n, NA_REAL);
+  NumericVector date(n, NA_REAL);
+  CharacterVector character(n, NA_STRING);
+  date.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+  date.attr("tzone") = "UTC";
+
+  for (size_t i = 0; i < n; ++i) {
+    const cellrange& cell = cells[i];
+    sheet[i] = sheet_names_[cell.sheet_];
+    address[i] = formatAddress(cell.first_row_, cell.first_col_);
+    row[i] = cell.first_row_;
+    col[i] = cell.first_col_;
+    int k = findCell(cell.sheet_, cell.first_row_, cell.first_col_);
+    const cellvalue& x = value(cell.sheet_, cell.first_row_, cell.first_col_);
+    switch (x.type_) {
+      case value_type::NUMBER:
+        if (k >= 0 && cells_[k].is_date_) {
+          data_type[i] = "date";
+          date[i] = toDate(x.number_);
+        } else {
+          data_type[i] = "numeric";
+          numeric[i] = x.number_;
+        }
+        break;
+      case value_type::TEXT:
+        data_type[i] = "character";
+        character[i] = Rf_mkCharCE(x.text_.c_str(), CE_UTF8);
+        break;
+      case value_type::BOOL:
+        data_type[i] = "logical";
+        logical[i] = x.number_ != 0;
+        break;
+      case value_type::ERROR_VALUE:
+        data_type[i] = "error";
+        error[i] = x.text_;
+        break;
+      default:
+        data_type[i] = "blank";
+        break;
+    }
+  }
+
+  List out = List::create(
+      _["sheet"] = sheet,
+      _["address"] = address,
+      _["row"] = row,
+      _["col"] = col,
+      _["data_type"] = data_type,
+      _["error"] = error,
+      _["logical"] = logical,
+      _["numeric"] = numeric,
+      _["date"] = date,
+      _["character"] = character);
+  return dataFrame(out, n);
+}
@@ -0,0 +1,114 @@
+#ifndef XLSXMODEL_
+#define XLSXMODEL_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <Rcpp.h>
+#include "rangeindex.h"
+#include "xlformula.h"
+#include "xlsxdependencies.h"
+#include "xlvalue.h"
+
+// The cells of a workbook, with their formulas compiled, to be calculated
+// again as their inputs are changed.
+//
+// Changing a cell marks the formulas that depend on it as dirty, found by the
+// dependency graph, and the formulas that depend on those, and so on.  Only
+// the dirty formulas are calculated again, each after any dirty formulas that
+// it depends on.  Formulas in a circular reference keep their values.
+
+class xlsxmodel : public xlcontext {
+
+  public:
+
+    xlsxmodel(
+        SEXP file,
+        Rcpp::CharacterVector sheet_names, // in the order of the workbook
+        Rcpp::List cells,                  // from xlsx_cells()
+        Rcpp::List names,                  // from xlsx_names()
+        int threads);
+
+    // The formula cells that can't be calculated, by their position in cells
+    Rcpp::IntegerVector unsupported() const;
+
+    // Sets the values of cells, replacing any formulas, and marks the formulas
+    // that depend on them as dirty.  NA values make cells blank.
+    void setValues(Rcpp::CharacterVector sheets,
+                   Rcpp::CharacterVector addresses,
+                   SEXP values);
+
+    // Calculates the dirty formulas, or every formula, and returns the values
+    // of the cells that they fill
+    Rcpp::List recalculate(bool all);
+
+    // The values of cells, calculating any dirty formulas first
+    Rcpp::List values(Rcpp::CharacterVector sheets,
+                      Rcpp::CharacterVector addresses);
+
+    // xlcontext
+    const cellvalue& value(int sheet, int row, int col) const;
+    void values(const cellrange& range,
+                std::vector<const cellvalue*>& out) const;
+    int lastRow(int sheet) const { return last_rows_[sheet]; }
+    int lastCol(int sheet) const { return last_cols_[sheet]; }
+    const xlformula* name(int k) const;
+
+  private:
+
+    struct modelcell {
+      int sheet_;             // zero-based
+      int row_;
+      int col_;
+      bool is_date_;          // to return numbers as dates
+      int formula_;           // position in formulas_, or -1
+      cellvalue value_;
+    };
+
+    struct modelformula {
+      int cell_;              // position in cells_
+      cellrange output_;      // the cells that it fills
+      bool array_;
+      bool active_;           // false once its cell has been set
+      xlformula formula_;
+    };
+
+    Rcpp::CharacterVector sheet_names_;
+    std::unordered_map<std::string, int> sheet_index_; // by upper-case name
+    int date_system_;
+    int date_offset_;
+    std::unique_ptr<xlsxdependencies> graph_; // formula cells as formulas_
+
+    std::vector<modelcell> cells_;
+    std::vector<std::unordered_map<uint64_t, int> > addresses_; // by sheet
+    std::vector<int> last_rows_;
+    std::vector<int> last_cols_;
+    std::vector<modelformula> formulas_;
+    std::vector<xlformula> names_;
+    std::vector<unsigned char> dirty_; // by formula
+    std::vector<int> dirty_list_;      // the dirty formulas
+    std::vector<int> waiting_;         // by formula, dirty precedents not yet
+                                       // calculated; zero between calls
+
+    int findCell(int sheet, int row, int col) const;
+    int addCell(int sheet, int row, int col);
+    int findSheet(SEXP name) const;
+
+    void markDirty(const std::vector<cellrange>& changed);
+    void calculate(int k);
+
+    double toDate(double serial) const;
+    double fromDate(double date) const;
+    Rcpp::List cellValues(const std::vector<cellrange>& cells) const;
+
+};
+
+// The xlsxmodel behind an external pointer
+inline xlsxmodel& as_xlsxmodel(SEXP model) {
+  Rcpp::XPtr<xlsxmodel> ptr(model);
+  return *ptr;
+}
+
+#endif
@@ -2,17 +2,14 @@
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxnames.h"
+#include "xlsxfile.h"
+#include "dataframe.h"
 
 using namespace Rcpp;
 
-xlsxnames::xlsxnames(const std::string& path) {
+xlsxnames::xlsxnames(xlsxfile& file) {
   // Names are stored at the workbook level, even if scoped to sheets
-  std::string book = zip_buffer(path, "xl/workbook.xml");
-
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_strip_xml_namespaces>(&book[0]);
-
-  rapidxml::xml_node<>* workbook = xml.first_node("workbook");
+  rapidxml::xml_node<>* workbook = file.workbook();
   rapidxml::xml_node<>* definedNames = workbook->first_node("definedNames");
 
   int n(0);
@@ -79,10 +76,7 @@ List& xlsxnames::information() {
       _["comment"] =  comment_,
       _["hidden"] =   hidden_);
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(information_[0]);
-  information_.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  information_.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
+  dataFrame(information_);
 
   return information_;
 }
@@ -3,6 +3,7 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
+#include "xlsxfile.h"
 
 class xlsxnames {
 
@@ -16,7 +17,7 @@ class xlsxnames {
     Rcpp::CharacterVector comment_;
     Rcpp::LogicalVector   hidden_;
 
-    xlsxnames(const std::string& path);
+    xlsxnames(xlsxfile& file);
 
     Rcpp::List& information();       // Validation rules DF wrapped in list
 
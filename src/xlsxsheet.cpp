@@ -1,125 +1,71 @@
+#include <iterator>
+#include <stdexcept>
 #include <Rcpp.h>
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxcell.h"
 #include "xlsxsheet.h"
 #include "xlsxbook.h"
+#include "sheetreader.h"
 #include "string.h"
+#include "address.h"
+#include "number.h"
 
 using namespace Rcpp;
 
+// Amount of xml of rows for each thread to parse at a time
+static const size_t ROWS_CHUNK = 1048576;
+
+sheetchunk::sheetchunk(xlsxsheet& sheet):
+  sheet_(sheet),
+  data_(sheet.data_.shared_count_) {}
+
 xlsxsheet::xlsxsheet(
     const std::string& name,
-    std::string& sheet_xml,
+    const std::string& sheet_path,
     xlsxbook& book,
-    String comments_path):
+    const std::string& comments_path):
   name_(name),
-  book_(book) {
-  rapidxml::xml_document<> xml;
-  xml.parse<rapidxml::parse_non_destructive>(&sheet_xml[0]);
-
-  rapidxml::xml_node<>* worksheet = xml.first_node("worksheet");
-  rapidxml::xml_node<>* sheetData = worksheet->first_node("sheetData");
-
-  defaultRowHeight_ = 15;
-  defaultColWidth_ = 8.47;
-
-  cacheDefaultRowColDims(worksheet);
-  cacheColWidths(worksheet);
-  cacheComments(comments_path);
-  cacheCellcount(sheetData);
-}
-
-void xlsxsheet::cacheDefaultRowColDims(rapidxml::xml_node<>* worksheet) {
-  rapidxml::xml_node<>* sheetFormatPr_ = worksheet->first_node("sheetFormatPr");
-
-  if (sheetFormatPr_ != NULL) {
-    // Don't use utils::getAttributeValueDouble because it might overwrite the
-    // default value with NA_REAL.
-    rapidxml::xml_attribute<>* defaultRowHeight =
-      sheetFormatPr_->first_attribute("defaultRowHeight");
-    if (defaultRowHeight != NULL)
-      defaultRowHeight_ = strtod(defaultRowHeight->value(), NULL);
-
-    rapidxml::xml_attribute<>*defaultColWidth =
-      sheetFormatPr_->first_attribute("defaultColWidth");
-    if (defaultColWidth != NULL) {
-      defaultColWidth_ = strtod(defaultColWidth->value(), NULL);
-    } else {
-      // If defaultColWidth not given, ECMA says you can work it out based on
-      // baseColWidth, but that isn't necessarily given either, and the formula
-      // is wrong because the reality is so complicated, see
-      // https://support.microsoft.com/en-gb/kb/214123.
-      defaultColWidth_ = 8.38;
-    }
-  }
-}
+  sheet_path_(sheet_path),
+  comments_path_(comments_path),
+  colWidths_(8.47),
+  rowHeights_(15),
+  book_(book),
+  data_(book.strings_.size()),
+  threads_(1) {}
 
-void xlsxsheet::cacheColWidths(rapidxml::xml_node<>* worksheet) {
-  // Having done cacheDefaultRowColDims(), initilize vector to default width,
-  // then update with custom widths.  The number of columns might be available
-  // by parsing <dimension><ref>, but if not then only by parsing the address of
-  // all the cells.  I think it's better just to use the maximum possible number
-  // of columns, 16834.
+void xlsxsheet::parse(parallel& pool, int threads) {
+  // The xml is streamed rather than read into memory all at once.  First the
+  // elements before <sheetData> are parsed, then the rows, into the columns of
+  // data_.
+  threads_ = threads;
+  sheetreader reader(book_.archive_, sheet_path_);
 
-  colWidths_.assign(16384, defaultColWidth_);
-
-  rapidxml::xml_node<>* cols = worksheet->first_node("cols");
-  if (cols == NULL)
-    return; // No custom widths
-
-  for (rapidxml::xml_node<>* col = cols->first_node("col");
-      col; col = col->next_sibling("col")) {
-
-    // <col> applies to columns from a min to a max, which must be iterated over
-    unsigned int min  = strtol(col->first_attribute("min")->value(), NULL, 10);
-    unsigned int max  = strtol(col->first_attribute("max")->value(), NULL, 10);
-    double width = strtod(col->first_attribute("width")->value(), NULL);
+  rapidxml::xml_document<> xml;
+  xml.parse<rapidxml::parse_strip_xml_namespaces>(&reader.head()[0]);
 
-    for (unsigned int column = min; column <= max; ++column)
-      colWidths_[column - 1] = width;
-  }
-}
+  rapidxml::xml_node<>* worksheet = xml.first_node("worksheet");
 
-unsigned long long int xlsxsheet::cacheCellcount(rapidxml::xml_node<>* sheetData) {
-  // Iterate over all rows and cells to count.  The 'dimension' tag is no use
-  // here because it describes a rectangle of cells, many of which may be blank.
-  unsigned long long int cellcount = 0;
-  unsigned long long int commentcount = 0; // no. of matching comments
-  rapidxml::xml_attribute<>* r;
-  std::map<std::string, std::string>::iterator comment;
-  for (rapidxml::xml_node<>* row = sheetData->first_node("row");
-      row; row = row->next_sibling("row")) {
-    for (rapidxml::xml_node<>* c = row->first_node("c");
-      c; c = c->next_sibling("c")) {
-      // Check for a matching comment.
-      // Comments on blank cells don't have a matching cell, so a blank cell
-      // must be created for them.  Such additional cells must be added to the
-      // actual cellcount, to initialize the returned vectors to the correct
-      // length.
-      r = c->first_attribute("r");
-      if (r == NULL) // check once in whole program
-        stop("Invalid row or cell: lacks 'r' attribute");
-      comment = comments_.find(std::string(r->value(), r->value_size()));
-      if(comment != comments_.end()) {
-        ++commentcount;
-      }
-      ++cellcount;
-      if ((cellcount + 1) % 1000 == 0) {
-        checkUserInterrupt();
-      }
-    }
-  }
-  cellcount_ = cellcount + (comments_.size() - commentcount);
-  return(cellcount_);
+  // Only custom widths and heights are stored, as runs of columns and rows
+  cacheDefaultDims(worksheet, rowHeights_.default_, colWidths_.default_);
+  if (book_.columns_.width)
+    cacheColWidths(worksheet, colWidths_);
+  cacheComments();
+  // Rows outside the window are skipped, except those before it that might
+  // define shared formulas for the cells in it
+  reader.setRows(book_.window_.first_row_, book_.window_.last_row_,
+                 book_.columns_.formula);
+  parseSheetData(reader, pool);
+  rowHeights_.index();
+  appendComments();
 }
 
-void xlsxsheet::cacheComments(String comments_path) {
-  // Having constructed the map, they will each be deleted when they are matched
-  // to a cell.  That will leave only those comments that are on empty cells.
-  // Those are then appended as empty cells with comments.
-  if (comments_path != NA_STRING) {
-    std::string comments_file = zip_buffer(book_.path_, comments_path);
+void xlsxsheet::cacheComments() {
+  // Having constructed the table, they will each be marked when they are
+  // matched to a cell.  That will leave only those comments that are on empty
+  // cells.  Those are then appended as empty cells with comments.
+  if (!comments_path_.empty()) {
+    std::string comments_file = book_.archive_.buffer(comments_path_);
     rapidxml::xml_document<> xml;
     xml.parse<rapidxml::parse_strip_xml_namespaces>(&comments_file[0]);
 
@@ -129,97 +75,203 @@ void xlsxsheet::cacheComments(String comments_path) {
     for (rapidxml::xml_node<>* comment = commentList->first_node();
         comment; comment = comment->next_sibling()) {
       rapidxml::xml_attribute<>* ref = comment->first_attribute("ref");
-      std::string ref_string(ref->value(), ref->value_size());
+      int row, col;
+      if (!parseAddress(ref->value(), ref->value_size(), row, col)) {
+        throw std::runtime_error("Invalid comment address: '" + name_ + "'!"
+                                 + std::string(ref->value(), ref->value_size()));
+      }
       rapidxml::xml_node<>* r = comment->first_node();
       // Get the inline string
       std::string inlineString;
       parseString(r, inlineString); // value is modified in place
-      comments_[ref_string] = inlineString;
+      comments_.add(row, col, inlineString);
     }
+    comments_.index();
+    comments_matched_.assign(comments_.size(), false);
   }
 }
 
-void xlsxsheet::parseSheetData(
-    rapidxml::xml_node<>* sheetData,
-    unsigned long long int& i) {
+void xlsxsheet::parseSheetData(sheetreader& reader, parallel& pool) {
   // Iterate through rows and cells in sheetData.  Cell elements are children
   // of row elements.  Columns are described elswhere in cols->col.
-  rowHeights_.assign(1048576, defaultRowHeight_); // cache rowHeight while here
-  unsigned long int rowNumber;
-  for (rapidxml::xml_node<>* row = sheetData->first_node();
-      row; row = row->next_sibling()) {
-    rapidxml::xml_attribute<>* r = row->first_attribute("r");
-    if (r == NULL)
-      stop("Invalid row or cell: lacks 'r' attribute"); // # nocov
-    rowNumber = strtod(r->value(), NULL);
-    // Check for custom row height
-    double rowHeight = defaultRowHeight_;
-    rapidxml::xml_attribute<>* ht = row->first_attribute("ht");
-    if (ht != NULL) {
-      rowHeight = strtod(ht->value(), NULL);
-      rowHeights_[rowNumber - 1] = rowHeight;
-    }
 
-    for (rapidxml::xml_node<>* c = row->first_node();
-        c; c = c->next_sibling()) {
-      xlsxcell cell(c, this, book_, i);
+  if (threads_ <= 1) {
+    // Parse each row in turn, into a single chunk
+    sheetchunk chunk(*this);
+    char* text;
+    while ((text = reader.nextRow()) != NULL)
+      parseRow(text, text + reader.rowSize(), chunk, pool);
+    appendChunk(chunk);
+    return;
+  }
+
+  // Split the rows into chunks of about ROWS_CHUNK bytes of xml, one chunk per
+  // thread, and parse them in parallel.  Then join them in order, and repeat
+  // until there are no more rows.  Only threads_ chunks of xml are in memory
+  // at once.
+  parallel chunk_pool(threads_, &pool);
+  char* text = reader.nextRow();
+  while (text != NULL) {
+    std::vector<sheetchunk> chunks;
+    chunks.reserve(threads_);
+    while (text != NULL && chunks.size() < (size_t)threads_) {
+      chunks.emplace_back(*this);
+      std::string& xml = chunks.back().xml_;
+      std::vector<size_t>& rows = chunks.back().rows_;
+      while (text != NULL && xml.size() < ROWS_CHUNK) {
+        rows.push_back(xml.size());
+        xml += text;
+        text = reader.nextRow();
+      }
+    }
+    chunk_pool.run(chunks.size(), [&](size_t k) {
+      sheetchunk& chunk = chunks[k];
+      char* xml = &chunk.xml_[0];
+      for (size_t j = 0; j < chunk.rows_.size(); ++j) {
+        size_t end = j + 1 < chunk.rows_.size() ? chunk.rows_[j + 1]
+                                                : chunk.xml_.size();
+        parseRow(xml + chunk.rows_[j], xml + end, chunk, chunk_pool);
+      }
+    });
+    for (size_t k = 0; k < chunks.size(); ++k)
+      appendChunk(chunks[k]);
+  }
+}
 
-      // Sheet name, row height and col width aren't really determined by the
-      // cell, so they're done in this sheet instance
-      book_.sheet_[i] = name_;
-      book_.height_[i] = rowHeight;
-      book_.width_[i] = colWidths_[book_.col_[i] - 1];
+// The row is lexed into chunk.lexer_, or parsed by rapidxml if it uses
+// anything that the lexer doesn't, and then each cell is cached
+void xlsxsheet::parseRow(
+    char* begin,
+    char* end,
+    sheetchunk& chunk,
+    parallel& pool) {
+  celllexer& lexer = chunk.lexer_;
+  rapidxml::xml_document<> xml; // only used if the lexer gives up
+  if (!lexer.lex(begin, end))
+    lexer.parse(begin, end, xml);
+  if (lexer.row_ == 0)
+    throw std::runtime_error("Invalid row or cell: lacks 'r' attribute");
+  unsigned long int rowNumber = lexer.row_;
+  const cellrange& window = book_.window_;
+  bool whole = (long)rowNumber >= window.first_row_
+    && (long)rowNumber <= window.last_row_
+    && window.first_col_ == 1 && window.last_col_ == MAX_COL;
+  // Check for custom row height.  Chunks keep their own, which are appended
+  // to the sheet's in order.
+  if (lexer.ht_ != NULL && book_.columns_.height) {
+    chunk.rowHeights_.add(rowNumber, rowNumber,
+                          parseNumber(lexer.ht_, lexer.ht_size_));
+  }
 
-      ++i;
-      if ((i + 1) % 1000 == 0)
-        checkUserInterrupt();
+  for (size_t k = 0; k < lexer.size_; ++k) {
+    const cellxml& c = lexer.cells_[k];
+    int cell_row, cell_col;
+    if (!whole && !inWindow(c, cell_row, cell_col)) {
+      keepSharedFormula(c, cell_row, cell_col, chunk);
+      continue;
     }
+    unsigned long long int i = chunk.data_.size(); // position in the chunk
+    xlsxcell cell(c, chunk, book_, i);
+
+    if ((i + 1) % 1000 == 0)
+      pool.checkInterrupt();
   }
 }
 
-void xlsxsheet::appendComments(unsigned long long int& i) {
-  // Having constructed the comments_ map, they are each be deleted when they
-  // are matched to a cell.  That leaves only those comments that are on empty
-  // cells.  This code appends those remaining comments as empty cells.
-  int col;
-  int row;
-  for(std::map<std::string, std::string>::iterator it = comments_.begin();
-      it != comments_.end(); ++it) {
-    // TODO: move address parsing to utils
-    std::string address = it->first.c_str(); // we need this std::string in a moment
-    // Iterate though the A1-style address string character by character
-    col = 0;
-    row = 0;
-    for(std::string::const_iterator iter = address.begin();
-        iter != address.end(); ++iter) {
-      if (*iter >= '0' && *iter <= '9') { // If it's a number
-        row = row * 10 + (*iter - '0'); // Then multiply existing row by 10 and add new number
-      } else if (*iter >= 'A' && *iter <= 'Z') { // If it's a character
-        col = 26 * col + (*iter - 'A' + 1); // Then do similarly with columns
-      }
+// Whether a cell is in the window of cells to return.  Cells without a valid
+// address are, so that xlsxcell can complain about them.
+bool xlsxsheet::inWindow(const cellxml& c, int& row, int& col) const {
+  if (c.r_ == NULL || !parseAddress(c.r_, c.r_size_, row, col))
+    return true;
+  const cellrange& window = book_.window_;
+  return row >= window.first_row_ && row <= window.last_row_
+    && col >= window.first_col_ && col <= window.last_col_;
+}
+
+// A cell outside the window might be the master of a shared formula that
+// cells in the window inherit, so it is kept in the same way as if it were in
+// the window
+void xlsxsheet::keepSharedFormula(
+    const cellxml& c,
+    int row,
+    int col,
+    sheetchunk& chunk) {
+  if (!book_.columns_.formula)
+    return;
+  if (!c.has_f_ || c.f_size_ == 0 || c.si_ == -1)
+    return;
+  std::string formula(c.f_, c.f_size_);
+  if (book_.lazy_formulas_) {
+    shared_master master = {c.si_, row, col, formula};
+    chunk.masters_.push_back(master);
+  } else {
+    chunk.shared_formulas_.insert(c.si_, formula, row, col);
+  }
+}
+
+void xlsxsheet::appendChunk(sheetchunk& chunk) {
+  // Fill in the formulas of cells whose shared formula was defined in an
+  // earlier chunk.  A shared formula is only defined once in a sheet, so there
+  // is no need to worry about which chunk's definition comes first.
+  sheetdata& data = chunk.data_;
+  for (std::vector<unresolved_formula>::iterator it = chunk.unresolved_.begin();
+      it != chunk.unresolved_.end(); ++it) {
+    const shared_formula* master = shared_formulas_.find(it->si);
+    if (master != NULL) {
+      master->render(it->row, it->col, chunk.formula_);
+      data.formula_[it->i] = data.addString(chunk.formula_);
     }
-    book_.sheet_[i] = name_;
-    book_.address_[i] = address;
-    book_.row_[i] = row;
-    book_.col_[i] = col;
-    book_.is_blank_[i] = true;
-    book_.data_type_[i] = "blank";
-    book_.error_[i] = NA_STRING;
-    book_.logical_[i] = NA_LOGICAL;
-    book_.numeric_[i] = NA_REAL;
-    book_.date_[i] = NA_REAL;
-    book_.character_[i] = NA_STRING;
-    book_.formula_[i] = NA_STRING;
-    book_.is_array_[i] = false;
-    book_.formula_ref_[i] = NA_STRING;
-    book_.formula_group_[i] = NA_INTEGER;
-    book_.comment_[i] = it->second.c_str();
-    book_.height_[i] = rowHeights_[row - 1];
-    book_.width_[i] = colWidths_[col - 1];
-    book_.style_format_[i] = "Normal";
-    book_.local_format_id_[i] = 1;
-    ++i;
   }
-  // Iterate though the A1-style address string character by character
+  shared_formulas_.merge(chunk.shared_formulas_);
+  masters_.insert(masters_.end(),
+                  std::make_move_iterator(chunk.masters_.begin()),
+                  std::make_move_iterator(chunk.masters_.end()));
+
+  // Comments that have been matched to a cell are marked, leaving only those
+  // that are on empty cells
+  for (std::vector<int>::iterator it = chunk.comments_found_.begin();
+      it != chunk.comments_found_.end(); ++it) {
+    comments_matched_[*it] = true;
+  }
+
+  rowHeights_.append(chunk.rowHeights_);
+  warnings_.insert(warnings_.end(), chunk.warnings_.begin(),
+                   chunk.warnings_.end());
+  data_.append(data);
 }
 
+void xlsxsheet::appendComments() {
+  // Having constructed the comments_ table, they are each marked when they are
+  // matched to a cell.  That leaves only those comments that are on empty
+  // cells.  This code appends those remaining comments as empty cells, in
+  // address order.
+  //
+  // If the comment column wasn't asked for, then the comments weren't matched
+  // to cells while parsing, so that is done here instead.
+  if (comments_.empty())
+    return;
+  bool matched = book_.columns_.comment;
+  if (!matched) {
+    for (size_t j = 0; j < data_.size(); ++j) {
+      int k = comments_.find(data_.row_[j], data_.col_[j]);
+      if (k != -1)
+        comments_matched_[k] = true;
+    }
+  }
+
+  const cellrange& window = book_.window_;
+  for(size_t k = 0; k < comments_.size(); ++k) {
+    if (comments_matched_[k])
+      continue; // on a cell that exists
+    int row = comments_.row(k);
+    int col = comments_.col(k);
+    if (row < window.first_row_ || row > window.last_row_
+        || col < window.first_col_ || col > window.last_col_)
+      continue;
+    data_.push_back(row, col);
+    data_.is_blank_.back() = true;
+    if (matched)
+      data_.comment_.back() = data_.addString(comments_.text(k));
+    data_.format_.back() = -1; // the Normal style
+  }
+}
@@ -5,38 +5,97 @@
 #include "rapidxml.h"
 #include "xlsxbook.h"
 #include "shared_formula.h"
+#include "sheetdata.h"
+#include "sheetreader.h"
+#include "celllexer.h"
+#include "commenttable.h"
+#include "dimensions.h"
+#include "parallel.h"
 
 class xlsxbook;
+class xlsxsheet;
+
+// A dependent cell of a shared formula whose master cell wasn't in the same
+// chunk, so that its formula can only be filled in when the chunks are joined
+struct unresolved_formula {
+  size_t i;   // position of the cell in the chunk
+  int si;     // the shared formula
+  int row;
+  int col;
+};
+
+// The master of a shared formula outside the window of cells to return, kept
+// for xlsxbook::sharedFormulas() when the formulas are left to
+// expand_formulas()
+struct shared_master {
+  int si;
+  int row;
+  int col;
+  std::string formula;
+};
+
+// The cells of some consecutive rows of a sheet, parsed by one thread.  Each
+// chunk has its own shared formulas, and doesn't modify the sheet (except for
+// the heights of its own rows), so that chunks can be parsed in parallel and
+// then joined in order by xlsxsheet::appendChunk().
+class sheetchunk {
+
+  public:
+
+    xlsxsheet& sheet_;
+    std::string xml_;  // the <row> elements, when parsed in parallel
+    std::vector<size_t> rows_;        // where each row starts in xml_
+    celllexer lexer_;                 // reused by every row in the chunk
+    sheetdata data_;
+    shared_formulas shared_formulas_; // masters in this chunk
+    std::string formula_;             // buffer for rendering shared formulas
+    std::vector<unresolved_formula> unresolved_;
+    std::vector<shared_master> masters_; // outside the window, when lazy
+    std::vector<int> comments_found_; // positions of matched comments
+    dimensions rowHeights_;           // custom heights of rows in this chunk
+    std::vector<std::string> warnings_;
+
+    sheetchunk(xlsxsheet& sheet);
+
+};
 
 class xlsxsheet {
 
   public:
 
     std::string name_;
+    std::string sheet_path_;
+    std::string comments_path_;      // empty if the sheet has no comments
 
-    unsigned long long int cellcount_; // allowing for comments on blank cells
-    double defaultRowHeight_;
-    double defaultColWidth_;
-    std::vector<double> colWidths_;
-    std::vector<double> rowHeights_;
-    std::map<int, shared_formula> shared_formulas_;
+    dimensions colWidths_;
+    dimensions rowHeights_;
+    shared_formulas shared_formulas_;
     xlsxbook& book_; // reference to parent workbook
-    std::map<std::string, std::string> comments_; // lookup table of comments
+    commenttable comments_;          // lookup table of comments
+    std::vector<unsigned char> comments_matched_; // whether on a cell
+    sheetdata data_;                 // the cells, parsed into columns
+    std::vector<shared_master> masters_; // outside the window, when lazy
+    std::vector<std::string> warnings_; // given by the main thread after parsing
+    int threads_;                    // number of chunks to parse at once
 
     xlsxsheet(
         const std::string& name,
-        std::string& sheet_xml,
+        const std::string& sheet_path,
         xlsxbook& book,
-        Rcpp::String comments_path);
-
-    void cacheDefaultRowColDims(rapidxml::xml_node<>* worksheet);
-    void cacheColWidths(rapidxml::xml_node<>* worksheet);
-    unsigned long long int cacheCellcount(rapidxml::xml_node<>* sheetData);
-    void cacheComments(Rcpp::String comments_path);
-    void parseSheetData(
-        rapidxml::xml_node<>* sheetData,
-        unsigned long long int& i);
-    void appendComments(unsigned long long int& i);
+        const std::string& comments_path);
+
+    // Doesn't call R, so that sheets can be parsed in parallel.  Each sheet
+    // can itself be parsed by several threads, a chunk of rows each.
+    void parse(parallel& pool, int threads);
+
+    void cacheComments();
+    void parseSheetData(sheetreader& reader, parallel& pool);
+    void parseRow(char* begin, char* end, sheetchunk& chunk, parallel& pool);
+    bool inWindow(const cellxml& c, int& row, int& col) const;
+    void keepSharedFormula(const cellxml& c, int row, int col,
+                           sheetchunk& chunk);
+    void appendChunk(sheetchunk& chunk);
+    void appendComments();
 
 };
 
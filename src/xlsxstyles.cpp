@@ -26,45 +26,56 @@ inline std::string unescape_numFmt(const std::string& s) {
   return out;
 }
 
-xlsxstyles::xlsxstyles(const std::string& path) {
-  cacheThemeRgb(path);
+xlsxstyles::xlsxstyles(
+    const zip_archive& archive,
+    const CharacterVector& theme):
+  has_formats_(false) {
+  cacheThemeRgb(theme);
   cacheIndexedRgb();
 
   // Try the styles.xml in the file.  If it doesn't define what is needed,
   // then use a default file
-  std::string styles1 = zip_buffer(path, "xl/styles.xml");
-  rapidxml::xml_document<> styles_xml1;
-  styles_xml1.parse<0>(&styles1[0]);
-  rapidxml::xml_node<>* styleSheet1 = styles_xml1.first_node("styleSheet");
-  rapidxml::xml_node<>* cellStyleXfs = styleSheet1->first_node("cellStyleXfs");
-  if (cellStyleXfs != NULL) {
-    rapidxml::xml_node<>* styleSheet1 = styles_xml1.first_node("styleSheet");
-    cacheNumFmts(styleSheet1);
-    cacheCellXfs(styleSheet1);
-    cacheCellStyleXfs(styleSheet1);
-    cacheFonts(styleSheet1);
-    cacheFills(styleSheet1);
-    cacheBorders(styleSheet1);
-  } else {
+  xml_ = archive.buffer("xl/styles.xml");
+  std::string styles = xml_; // parsed in place, so xml_ is kept for later
+  rapidxml::xml_document<> styles_xml;
+  styles_xml.parse<0>(&styles[0]);
+  rapidxml::xml_node<>* styleSheet = styles_xml.first_node("styleSheet");
+  if (styleSheet->first_node("cellStyleXfs") == NULL) {
     warning("Default styles used (cellStyleXfs is not defined)");
-    std::string styles2 = zip_buffer(extdata() + "/default.xlsx", "xl/styles.xml");
-    rapidxml::xml_document<> styles_xml2;
-    styles_xml2.parse<0>(&styles2[0]);
-    rapidxml::xml_node<>* styleSheet2 = styles_xml2.first_node("styleSheet");
-    cacheNumFmts(styleSheet2);
-    cacheCellXfs(styleSheet2);
-    cacheCellStyleXfs(styleSheet2);
-    cacheFonts(styleSheet2);
-    cacheFills(styleSheet2);
-    cacheBorders(styleSheet2);
+    xml_ = zip_buffer(extdata() + "/default.xlsx", "xl/styles.xml");
+    styles = xml_;
+    styles_xml.clear();
+    styles_xml.parse<0>(&styles[0]);
+    styleSheet = styles_xml.first_node("styleSheet");
   }
 
+  // Only what the cells need.  The fonts, fills, borders and so on are only
+  // parsed if xlsx_formats() asks for them, by cacheFormats().
+  cacheNumFmts(styleSheet);
+  cacheCellStyles(styleSheet);
+  cacheCellFormats(styleSheet);
+}
+
+void xlsxstyles::cacheFormats() {
+  if (has_formats_)
+    return;
+  rapidxml::xml_document<> styles_xml;
+  styles_xml.parse<0>(&xml_[0]);
+  rapidxml::xml_node<>* styleSheet = styles_xml.first_node("styleSheet");
+  cacheCellXfs(styleSheet);
+  cacheCellStyleXfs(styleSheet);
+  cacheFonts(styleSheet);
+  cacheFills(styleSheet);
+  cacheBorders(styleSheet);
+
   applyFormats();
   style_ = zipFormats(style_formats_, true);
   local_ = zipFormats(local_formats_, false);
+  has_formats_ = true;
+  std::string().swap(xml_); // not needed again
 }
 
-void xlsxstyles::cacheThemeRgb(const std::string& path) {
+void xlsxstyles::cacheThemeRgb(const CharacterVector& theme) {
   theme_name_ =
     CharacterVector::create("background1",
                             "text1",
@@ -78,37 +89,7 @@ void xlsxstyles::cacheThemeRgb(const std::string& path) {
                             "accent6",
                             "hyperlink",
                             "followed-hyperlink");
-  theme_ = CharacterVector(12, NA_STRING);
-  std::string FF = "FF";
-  if (zip_has_file(path, "xl/theme/theme1.xml")) {
-    std::string theme1 = zip_buffer(path, "xl/theme/theme1.xml");
-    rapidxml::xml_document<> theme1_xml;
-    theme1_xml.parse<0>(&theme1[0]);
-    rapidxml::xml_node<>* theme = theme1_xml.first_node("a:theme");
-    rapidxml::xml_node<>* themeElements = theme->first_node("a:themeElements");
-    rapidxml::xml_node<>* clrScheme = themeElements->first_node("a:clrScheme");
-
-    // First, two sysClr nodes in the wrong order
-    rapidxml::xml_node<>* color = clrScheme->first_node();
-    theme_[1] = FF + color->first_node()->first_attribute("lastClr")->value();
-    color = color->next_sibling();
-    theme_[0] = FF + color->first_node()->first_attribute("lastClr")->value();
-
-    // Then, two srgbClr nodes in the wrong order
-    color = color->next_sibling();
-    theme_[3] = FF + color->first_node()->first_attribute("val")->value();
-    color = color->next_sibling();
-    theme_[2] = FF + color->first_node()->first_attribute("val")->value();
-
-    // Finally, eight more srgbClr nodes in the correct order
-    // Can't reuse 'color' here, so use 'nextcolor'
-    int i = 4;
-    for (rapidxml::xml_node<>* nextcolor = color->next_sibling();
-        nextcolor; nextcolor = nextcolor->next_sibling()) {
-      theme_[i] = FF + nextcolor->first_node()->first_attribute("val")->value();
-      i++;
-    }
-  }
+  theme_ = theme; // parsed by xlsxfile::cacheThemeRgb()
 }
 
 void xlsxstyles::cacheIndexedRgb() {
@@ -320,27 +301,23 @@ void xlsxstyles::cacheCellXfs(rapidxml::xml_node<>* styleSheet) {
 
 void xlsxstyles::cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet) {
   rapidxml::xml_node<>* cellStyleXfs = styleSheet->first_node("cellStyleXfs");
-  int i(0);
   for (rapidxml::xml_node<>* xf_node = cellStyleXfs->first_node("xf");
       xf_node; xf_node = xf_node->next_sibling()) {
     xf xf(xf_node);
     cellStyleXfs_.push_back(xf);
-    ++i;
   }
+}
 
+void xlsxstyles::cacheCellStyles(rapidxml::xml_node<>* styleSheet) {
   // Get the names of the styles, if available
   rapidxml::xml_node<>* cellStyles = styleSheet->first_node("cellStyles");
   if (cellStyles != NULL) {
     // Get the names, which aren't necessarily in xf order
     int index;
-    int max_index = 0;
     for (rapidxml::xml_node<>* cellStyle = cellStyles->first_node("cellStyle");
         cellStyle; cellStyle = cellStyle->next_sibling()) {
       index = strtol(cellStyle->first_attribute("xfId")->value(), NULL, 10);
       cellStyles_map_.insert({index, cellStyle->first_attribute("name")->value()});
-      if (index > max_index) {
-        max_index = index;
-      }
     }
     // Sort them
     for (std::map<int, std::string>::iterator i = cellStyles_map_.begin();
@@ -353,6 +330,66 @@ void xlsxstyles::cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet) {
   }
 }
 
+// The attributes of an <xf> that say which number format applies, with the
+// same defaults as xf has.  Constructing a whole xf makes several R strings,
+// which is slow for the tens of thousands of formats in some files.
+static void numberFormat(rapidxml::xml_node<>* xf_node, int& numFmtId,
+                         int& xfId, bool& applyNumberFormat) {
+  rapidxml::xml_attribute<>* attribute = xf_node->first_attribute("numFmtId");
+  numFmtId = attribute == NULL
+    ? NA_INTEGER : strtol(attribute->value(), NULL, 10);
+  attribute = xf_node->first_attribute("xfId");
+  xfId = attribute == NULL ? 0 : strtol(attribute->value(), NULL, 10);
+  attribute = xf_node->first_attribute("applyNumberFormat");
+  if (attribute == NULL) {
+    applyNumberFormat = true;
+  } else {
+    std::string value = attribute->value();
+    applyNumberFormat = !(value == "0" || value == "false");
+  }
+}
+
+void xlsxstyles::cacheCellFormats(rapidxml::xml_node<>* styleSheet) {
+  // The number formats of the cell styles
+  std::vector<int> styleNumFmtIds;
+  int numFmtId, xfId;
+  bool applyNumberFormat;
+  rapidxml::xml_node<>* cellStyleXfs = styleSheet->first_node("cellStyleXfs");
+  for (rapidxml::xml_node<>* xf_node = cellStyleXfs->first_node("xf");
+      xf_node; xf_node = xf_node->next_sibling()) {
+    numberFormat(xf_node, numFmtId, xfId, applyNumberFormat);
+    styleNumFmtIds.push_back(numFmtId);
+  }
+
+  // The number format of the cell style applies unless the cell's own does.
+  // Undefined formats are NA in isDate_, which has always counted as a date.
+  std::vector<int> xfIds;
+  rapidxml::xml_node<>* cellXfs = styleSheet->first_node("cellXfs");
+  for (rapidxml::xml_node<>* xf_node = cellXfs->first_node("xf");
+      xf_node; xf_node = xf_node->next_sibling()) {
+    numberFormat(xf_node, numFmtId, xfId, applyNumberFormat);
+    if (!applyNumberFormat && xfId >= 0
+        && (size_t)xfId < styleNumFmtIds.size())
+      numFmtId = styleNumFmtIds[xfId];
+    cellformat format;
+    format.numFmtId_ = numFmtId;
+    format.isDate_ = numFmtId >= 0 && numFmtId < isDate_.size()
+      && isDate_[numFmtId] != 0;
+    cellFormats_.push_back(format);
+    xfIds.push_back(xfId);
+  }
+
+  styleNames_ = CharacterVector(cellFormats_.size());
+  for (size_t k = 0; k < cellFormats_.size(); ++k) {
+    std::map<int, std::string>::const_iterator name =
+      cellStyles_map_.find(xfIds[k]);
+    SET_STRING_ELT(styleNames_, k,
+        Rf_mkCharCE(name == cellStyles_map_.end() ? "" : name->second.c_str(),
+                    CE_UTF8));
+    cellFormats_[k].styleName_ = STRING_ELT(styleNames_, k);
+  }
+}
+
 void xlsxstyles::clone_color(color& from, colors& to, int& i) {
     to.rgb[i] = from.rgb_;
     to.theme[i] = from.theme_;
@@ -3,6 +3,7 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
+#include "zip_archive.h"
 #include "xf.h"
 #include "font.h"
 #include "fill.h"
@@ -22,6 +23,21 @@ struct colors {
   {}
 };
 
+// What the cells of one of cellXfs need, worked out once by
+// cacheCellFormats() rather than for every cell, so that a cell only has to
+// index cellFormats_ by its s attribute.  Read by the threads that parse
+// sheets, so nothing here may call R.
+struct cellformat {
+  int numFmtId_;     // the number format that applies, local or else style
+  bool isDate_;      // whether numbers with that format are dates
+  SEXP styleName_;   // CHARSXP of the name of the cell style, or ""
+};
+
+// The styles of a workbook.  What xlsx_cells() needs is parsed when they are
+// constructed: the number formats, the names of cell styles, and
+// cellFormats_.  The fonts, fills, borders and whole xfs, which become the
+// large R lists of xlsx_formats(), are only parsed by cacheFormats().
+
 class xlsxstyles {
 
   public:
@@ -30,15 +46,17 @@ class xlsxstyles {
     Rcpp::CharacterVector theme_;      // rgb equivalent of theme no.
     Rcpp::CharacterVector indexed_;    // rgb equivalent of index no.
 
-    std::vector<xf> cellXfs_;
-
-    std::vector<xf> cellStyleXfs_;
+    std::vector<xf> cellXfs_;          // by cacheFormats()
+    std::vector<xf> cellStyleXfs_;     // by cacheFormats()
     Rcpp::CharacterVector cellStyles_; // names of cell styles, ordered by xfId
     std::map<int, std::string> cellStyles_map_; // map of cell style names, for lookup by xfId
 
     Rcpp::CharacterVector numFmts_;
     Rcpp::LogicalVector isDate_;
 
+    std::vector<cellformat> cellFormats_; // one per xf in cellXfs
+    Rcpp::CharacterVector styleNames_;    // protects each styleName_
+
     std::vector<font> fonts_;
     std::vector<fill> fills_;
     std::vector<border> borders_;
@@ -49,17 +67,22 @@ class xlsxstyles {
     Rcpp::List style_; // inside-out List version of style_formats_
     Rcpp::List local_; // inside-out List version of local_formats_
 
-    xlsxstyles(const std::string& path);
+    xlsxstyles(const zip_archive& archive, const Rcpp::CharacterVector& theme);
+
+    // Parses everything else and builds style_ and local_, the first time
+    void cacheFormats();
 
-    void cacheThemeRgb(const std::string& path);
+    void cacheThemeRgb(const Rcpp::CharacterVector& theme);
     void cacheIndexedRgb();
 
     void cacheCellXfs(rapidxml::xml_node<>* styleSheet);
-    void cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet); // also cellStyles, if available
+    void cacheCellStyleXfs(rapidxml::xml_node<>* styleSheet);
+    void cacheCellStyles(rapidxml::xml_node<>* styleSheet); // names, if available
     void cacheNumFmts(rapidxml::xml_node<>* styleSheet);
     void cacheFonts(rapidxml::xml_node<>* styleSheet);
     void cacheFills(rapidxml::xml_node<>* styleSheet);
     void cacheBorders(rapidxml::xml_node<>* styleSheet);
+    void cacheCellFormats(rapidxml::xml_node<>* styleSheet); // after numFmts and cellStyles
 
     // Insert values of one color object into vectors in another
     void clone_color(color& from, colors& to, int& i);
@@ -68,6 +91,11 @@ class xlsxstyles {
     void applyFormats(); // Build each style on top of the normal style
     Rcpp::List zipFormats(std::vector<xf> styles, bool is_style); // Turn the formats inside-out to return to R
 
+  private:
+
+    std::string xml_;  // styles.xml, or the default, until cacheFormats()
+    bool has_formats_;
+
 };
 
 #endif
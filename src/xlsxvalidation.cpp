@@ -2,8 +2,9 @@
 #include "zip.h"
 #include "rapidxml.h"
 #include "xlsxvalidation.h"
-#include "xlsxbook.h"
+#include "xlsxfile.h"
 #include "date.h"
+#include "dataframe.h"
 
 using namespace Rcpp;
 
@@ -38,10 +39,13 @@ int count_validations(std::string& xml) {
 
 void parseValidations(
     xlsxvalidation& validation,
-    xlsxbook& book,
+    xlsxfile& file,
     std::string& sheet_name,
     std::string& xml,
     int& i) {
+  int dateSystem = file.dateSystem(); // 1900 or 1904
+  int dateOffset = file.dateOffset();
+
   rapidxml::xml_document<> doc;
   doc.parse<0>(&xml[0]);
   rapidxml::xml_node<>* worksheet = doc.first_node("worksheet");
@@ -86,7 +90,7 @@ void parseValidations(
       if (type_string == "date" || type_string == "time") {
         double date_double = strtod(formula1->value(), NULL);
         validation.formula1_[i] =
-          formatDate(date_double, book.dateSystem_, book.dateOffset_);
+          formatDate(date_double, dateSystem, dateOffset);
       } else {
         validation.formula1_[i] = formula1->value();
       }
@@ -97,7 +101,7 @@ void parseValidations(
       if (type_string == "date" || type_string == "time") {
         double date_double = strtod(formula2->value(), NULL);
         validation.formula2_[i] =
-          formatDate(date_double, book.dateSystem_, book.dateOffset_);
+          formatDate(date_double, dateSystem, dateOffset);
       } else {
         validation.formula2_[i] = formula2->value();
       }
@@ -149,12 +153,9 @@ void parseValidations(
 }
 
 xlsxvalidation::xlsxvalidation(
-    std::string path,
+    xlsxfile& file,
     CharacterVector sheet_paths,
     CharacterVector sheet_names) {
-  // Parse book-level information for the date system (1900/1904)
-  xlsxbook book(path);
-
   // Loop through sheets
   List out(sheet_paths.size());
 
@@ -173,7 +174,7 @@ xlsxvalidation::xlsxvalidation(
       sheet_path != sheet_paths.end();
       ++sheet_path) {
     std::string path(*sheet_path);
-    std::string xml = zip_buffer(book.path_, path);
+    std::string xml = file.archive_.buffer(path);
     sheets_xml.push_back(xml);
     int count = count_validations(xml);
     rules_count.push_back(count);
@@ -204,7 +205,7 @@ xlsxvalidation::xlsxvalidation(
       ++sheet_xml, ++rule_count, ++sheet_name) {
     if (*rule_count != 0) {
       std::string name(*sheet_name);
-      parseValidations(*this, book, name, *sheet_xml, i);
+      parseValidations(*this, file, name, *sheet_xml, i);
     }
   }
 }
@@ -228,10 +229,5 @@ List xlsxvalidation::information() {
       _["error_body"] = error_,
       _["error_symbol"] = error_style_);
 
-  // Turn list of vectors into a data frame without checking anything
-  int n = Rf_length(out[0]);
-  out.attr("class") = CharacterVector::create("tbl_df", "tbl", "data.frame");
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -n); // Dunno how this works (the -n part)
-
-  return out;
+  return dataFrame(out);
 }
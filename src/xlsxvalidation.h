@@ -3,7 +3,7 @@
 
 #include <Rcpp.h>
 #include "rapidxml.h"
-#include "xlsxbook.h"
+#include "xlsxfile.h"
 
 class xlsxvalidation {
 
@@ -25,7 +25,7 @@ class xlsxvalidation {
     Rcpp::CharacterVector error_style_;
 
     xlsxvalidation(
-      std::string path,
+      xlsxfile& file,
       Rcpp::CharacterVector sheet_paths,
       Rcpp::CharacterVector sheet_names);
 
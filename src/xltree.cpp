@@ -0,0 +1,227 @@
+#include "xltree.h"
+
+const int PREFIX_PRECEDENCE = 7;
+const int PERCENT_PRECEDENCE = 6;
+
+// A precedence-climbing parser of a formula's tokens
+class treebuilder {
+
+  public:
+
+    treebuilder(const char* formula, const token* tokens, size_t n,
+                treenode* nodes):
+      formula_(formula), tokens_(tokens), n_(n), nodes_(nodes), k_(0) {}
+
+    void grow() {
+      int roots = 0;
+      while (k_ < n_) {
+        int root = expression(0);
+        if (root >= 0) {
+          attach(root, -1, ++roots);
+        } else if (k_ < n_) {
+          // A separator or closing parenthesis without an opening one
+          set(k_++, node_kind::PUNCTUATION);
+        }
+      }
+    }
+
+  private:
+
+    const char* formula_;
+    const token* tokens_;
+    size_t n_;
+    treenode* nodes_;
+    size_t k_; // the next token
+
+    void set(size_t k, node_kind kind, int precedence = 0) {
+      treenode node = {0, 0, precedence, kind};
+      nodes_[k] = node;
+    }
+
+    void attach(size_t k, int parent, int child) {
+      nodes_[k].parent_ = parent + 1;
+      nodes_[k].child_ = child;
+    }
+
+    void punctuation(size_t k, size_t owner) {
+      set(k, node_kind::PUNCTUATION);
+      attach(k, owner, 0);
+    }
+
+    char first(size_t k) const { return formula_[tokens_[k].offset_]; }
+
+    bool isSpace(size_t k) const {
+      return tokens_[k].type_ == token_type::OPERATOR && first(k) == ' ';
+    }
+
+    // Whether a space before token k would be the intersection operator
+    bool beginsReference(size_t k) const {
+      switch (tokens_[k].type_) {
+        case token_type::REF:
+        case token_type::SHEET:
+        case token_type::NAME:
+        case token_type::FUNCTION:
+        case token_type::STRUCTURED_REF:
+        case token_type::PAREN_OPEN:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    void skipSpaces() {
+      while (k_ < n_ && isSpace(k_))
+        set(k_++, node_kind::SPACE);
+    }
+
+    // After an operand, the last of a run of spaces is the intersection
+    // operator if a reference follows it.  Otherwise the spaces mean nothing.
+    void skipSpacesAfterOperand() {
+      size_t end = k_;
+      while (end < n_ && isSpace(end))
+        ++end;
+      if (end == k_)
+        return;
+      if (end < n_ && beginsReference(end))
+        --end;
+      while (k_ < end)
+        set(k_++, node_kind::SPACE);
+    }
+
+    // Precedence of an infix operator, or 0 if token k isn't one
+    int infixPrecedence(size_t k) const {
+      if (tokens_[k].type_ != token_type::OPERATOR)
+        return 0;
+      switch (first(k)) {
+        case ':': return 10;
+        case ' ': return 9;
+        case ',': return 8;
+        case '^': return 5;
+        case '*': case '/': return 4;
+        case '+': case '-': return 3;
+        case '&': return 2;
+        case '=': case '<': case '>': return 1;
+        default: return 0;
+      }
+    }
+
+    int expression(int min_precedence) {
+      int lhs = primary();
+      if (lhs < 0)
+        return lhs;
+      for (;;) {
+        skipSpacesAfterOperand();
+        if (k_ >= n_)
+          break;
+        size_t op = k_;
+        if (tokens_[op].type_ == token_type::OPERATOR && first(op) == '%') {
+          if (PERCENT_PRECEDENCE < min_precedence)
+            break;
+          ++k_;
+          set(op, node_kind::POSTFIX, PERCENT_PRECEDENCE);
+          attach(lhs, op, 1);
+          lhs = op;
+          continue;
+        }
+        int precedence = infixPrecedence(op);
+        if (precedence == 0 || precedence < min_precedence)
+          break;
+        ++k_;
+        set(op, node_kind::INFIX, precedence);
+        attach(lhs, op, 1);
+        int rhs = expression(precedence + 1); // left-associative
+        if (rhs >= 0)
+          attach(rhs, op, 2);
+        lhs = op;
+      }
+      return lhs;
+    }
+
+    // An operand, possibly with prefix operators, or -1 if there isn't one
+    // before the end of the enclosing function, parentheses or array
+    int primary() {
+      skipSpaces();
+      if (k_ >= n_)
+        return -1;
+      size_t k = k_;
+      switch (tokens_[k].type_) {
+        case token_type::OPERATOR: {
+          // Any operator where an operand should be, e.g. the '=' of "=A1"
+          int precedence = infixPrecedence(k);
+          if (first(k) == '+' || first(k) == '-' || precedence == 0)
+            precedence = PREFIX_PRECEDENCE;
+          ++k_;
+          set(k, node_kind::PREFIX, precedence);
+          int operand = expression(precedence);
+          if (operand >= 0)
+            attach(operand, k, 1);
+          return k;
+        }
+        case token_type::FUNCTION:
+          ++k_;
+          set(k, node_kind::FUNCTION);
+          if (k_ < n_ && tokens_[k_].type_ == token_type::FUN_OPEN)
+            punctuation(k_++, k);
+          arguments(k, token_type::FUN_CLOSE);
+          return k;
+        case token_type::PAREN_OPEN:
+          ++k_;
+          set(k, node_kind::GROUP);
+          arguments(k, token_type::PAREN_CLOSE);
+          return k;
+        case token_type::OPEN_ARRAY:
+          ++k_;
+          set(k, node_kind::ARRAY);
+          arguments(k, token_type::CLOSE_ARRAY);
+          return k;
+        case token_type::SHEET: {
+          ++k_;
+          set(k, node_kind::SHEET);
+          int operand = primary();
+          if (operand >= 0)
+            attach(operand, k, 1);
+          return k;
+        }
+        case token_type::SEPARATOR:
+        case token_type::FUN_CLOSE:
+        case token_type::PAREN_CLOSE:
+        case token_type::CLOSE_ARRAY:
+          return -1;
+        default:
+          ++k_;
+          set(k, node_kind::OPERAND);
+          return k;
+      }
+    }
+
+    // The contents of a function, parentheses or array, up to its closing
+    // token, numbered by the separators before them
+    void arguments(size_t owner, token_type closer) {
+      int position = 1;
+      for (;;) {
+        int argument = expression(0);
+        if (argument >= 0) {
+          attach(argument, owner, position);
+          continue;
+        }
+        if (k_ >= n_)
+          return; // never closed
+        token_type type = tokens_[k_].type_;
+        if (type == token_type::SEPARATOR) {
+          punctuation(k_++, owner);
+          ++position;
+        } else if (type == closer) {
+          punctuation(k_++, owner);
+          return;
+        } else {
+          return; // closes something else, so leave it to that
+        }
+      }
+    }
+
+};
+
+void growTree(const char* formula, const token* tokens, size_t n,
+              treenode* nodes) {
+  treebuilder(formula, tokens, n, nodes).grow();
+}
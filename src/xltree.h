@@ -0,0 +1,68 @@
+#ifndef XLTREE_
+#define XLTREE_
+
+#include <cstddef>
+#include "token_type.h"
+
+// The abstract syntax tree of a formula, built from its tokens.  Every token
+// is a node of the tree, identified by its one-based position in the formula.
+// Punctuation (the parentheses of functions, separators, and so on) is
+// attached to the node that it belongs to, but isn't a child of it.
+// Meaningless spaces belong to nothing.
+//
+// Operators bind as they do in Excel, from tightest to loosest:
+//
+//   :   range
+//   ' ' intersection
+//   ,   union (inside parentheses that aren't a function's)
+//   - + negation and unary plus
+//   %   percent
+//   ^   exponentiation
+//   * / multiplication and division
+//   + - addition and subtraction
+//   &   concatenation
+//   = < > <= >= <> comparison
+//
+// Binary operators of the same precedence associate to the left, even ^.
+
+// In the order of the levels of the factor that xlex_all() can return
+enum class node_kind : unsigned char {
+  OPERAND,     // refs, names, numbers, text, etc.
+  FUNCTION,    // children are the arguments
+  INFIX,       // children are the left and right operands
+  PREFIX,
+  POSTFIX,
+  GROUP,       // parentheses around an expression
+  ARRAY,       // children are the elements
+  SHEET,       // child is the ref or name on the sheet
+  PUNCTUATION,
+  SPACE
+};
+
+const int N_NODE_KINDS = 10;
+
+inline const char* nodeKindName(node_kind kind) {
+  static const char* names[N_NODE_KINDS] = {
+    "operand", "function", "infix", "prefix", "postfix", "group", "array",
+    "sheet", "punctuation", "space"
+  };
+  return names[static_cast<int>(kind)];
+}
+
+struct treenode {
+  int parent_;      // one-based node id, 0 for the roots and spaces
+  int child_;       // one-based order among the children of the parent, or of
+                    // the roots; 0 for punctuation and spaces.  The arguments of
+                    // a function and the elements of an array are numbered by
+                    // their position, so an empty argument leaves a gap.
+  int precedence_;  // of operators, higher binds tighter; 0 for other nodes
+  node_kind kind_;
+};
+
+// Fills nodes[0], ..., nodes[n - 1] with the nodes of the tokens of a
+// formula.  Never fails: invalid formulas give trees of whatever makes sense,
+// and any tokens left over become further roots.
+void growTree(const char* formula, const token* tokens, size_t n,
+              treenode* nodes);
+
+#endif
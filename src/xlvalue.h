@@ -0,0 +1,47 @@
+#ifndef XLVALUE_
+#define XLVALUE_
+
+#include <string>
+
+// The value of a cell, or of part of a formula, as Excel calculates it.
+// Dates are numbers, as Excel stores them.
+
+// Not ERROR, which is a macro on some platforms
+enum class value_type : unsigned char {
+  BLANK, NUMBER, TEXT, BOOL, ERROR_VALUE
+};
+
+struct cellvalue {
+  value_type type_;
+  double number_;     // NUMBER, or BOOL as 0 or 1
+  std::string text_;  // TEXT, or the error, such as "#N/A"
+
+  bool isError() const { return type_ == value_type::ERROR_VALUE; }
+};
+
+inline cellvalue blankValue() {
+  cellvalue out = {value_type::BLANK, 0, std::string()};
+  return out;
+}
+
+inline cellvalue numberValue(double x) {
+  cellvalue out = {value_type::NUMBER, x, std::string()};
+  return out;
+}
+
+inline cellvalue textValue(const std::string& x) {
+  cellvalue out = {value_type::TEXT, 0, x};
+  return out;
+}
+
+inline cellvalue boolValue(bool x) {
+  cellvalue out = {value_type::BOOL, x ? 1.0 : 0.0, std::string()};
+  return out;
+}
+
+inline cellvalue errorValue(const std::string& x) {
+  cellvalue out = {value_type::ERROR_VALUE, 0, x};
+  return out;
+}
+
+#endif
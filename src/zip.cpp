@@ -8,34 +8,26 @@
 #include <Rcpp.h>
 
 #include "zip.h"
+#include "zip_archive.h"
 #include "rapidxml_print.h"
 
 using namespace Rcpp;
 
-Function tidyxl(const std::string& fun){
-  Environment env = Environment::namespace_env("tidyxl");
-  return env[fun];
-}
+// These open the archive afresh each time.  To read several files from one
+// archive, construct a zip_archive once and use its methods instead.
 
 std::string zip_buffer(
     const std::string& zip_path,
     const std::string& file_path) {
-  Function zip_buffer = tidyxl("zip_buffer");
-
-  RawVector xml = as<RawVector>(zip_buffer(zip_path, file_path));
-  std::string buffer(RAW(xml), RAW(xml) + xml.size());
-  buffer.push_back('\0');
-
-  return buffer;
+  zip_archive archive(zip_path);
+  return archive.buffer(file_path);
 }
 
 bool zip_has_file(
     const std::string& zip_path,
     const std::string& file_path) {
-  Function zip_has_file = tidyxl("zip_has_file");
-
-  LogicalVector res = wrap<LogicalVector>(zip_has_file(zip_path, file_path));
-  return res[0];
+  zip_archive archive(zip_path);
+  return archive.hasFile(file_path);
 }
 
 std::string extdata() {
@@ -44,3 +36,14 @@ std::string extdata() {
     system_file("extdata", Named("package") = "tidyxl");
   return as<std::string>(out);
 }
+
+// [[Rcpp::export]]
+RawVector zip_buffer_(std::string zip_path, std::string file_path) {
+  std::string buffer = zip_buffer(zip_path, file_path);
+  return RawVector(buffer.begin(), buffer.end() - 1); // omit the '\0'
+}
+
+// [[Rcpp::export]]
+bool zip_has_file_(std::string zip_path, std::string file_path) {
+  return zip_has_file(zip_path, file_path);
+}
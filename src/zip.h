@@ -9,10 +9,10 @@
 #define TIDYXL_ZIP_
 
 #include "rapidxml.h"
+#include "zip_archive.h"
 
 std::string zip_buffer(const std::string& zip_path, const std::string& file_path);
 bool zip_has_file(const std::string& zip_path, const std::string& file_path);
 std::string extdata();
 
 #endif
-
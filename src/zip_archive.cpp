@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "zip_archive.h"
+#include "inflater.h"
+
+// Based on the description of the format in PKWARE's APPNOTE.TXT, version
+// 6.3.4, sections 4.3 (structure) and 4.5 (Zip64 extra field).
+
+namespace {
+
+const uint32_t local_header_signature = 0x04034b50;
+const uint32_t central_header_signature = 0x02014b50;
+const uint32_t end_signature = 0x06054b50;
+const uint32_t end64_signature = 0x06064b50;
+const uint32_t end64_locator_signature = 0x07064b50;
+
+const size_t end_size = 22;          // end of central directory record
+const size_t end64_locator_size = 20;
+const size_t central_header_size = 46;
+const size_t local_header_size = 30;
+
+// Little-endian integers at a position in a buffer
+inline uint16_t le16(const unsigned char* p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+inline uint32_t le32(const unsigned char* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline uint64_t le64(const unsigned char* p) {
+  return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+void open_archive(std::ifstream& file, const std::string& path) {
+  file.open(path.c_str(), std::ios::in | std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Couldn't open '" + path + "'");
+}
+
+void read_at(std::ifstream& file, uint64_t offset, unsigned char* out,
+    size_t n, const std::string& path) {
+  file.seekg((std::streamoff)offset, std::ios::beg);
+  file.read((char*)out, n);
+  if ((size_t)file.gcount() != n)
+    throw std::runtime_error("Invalid zip archive '" + path + "': truncated");
+}
+
+} // namespace
+
+zip_archive::zip_archive(const std::string& path): path_(path) {
+  readCentralDirectory();
+}
+
+const std::string& zip_archive::path() const {
+  return path_;
+}
+
+bool zip_archive::hasFile(const std::string& file_path) const {
+  return entries_.find(file_path) != entries_.end();
+}
+
+const zip_entry& zip_archive::entry(const std::string& file_path) const {
+  std::unordered_map<std::string, zip_entry>::const_iterator it =
+    entries_.find(file_path);
+  if (it == entries_.end()) {
+    throw std::runtime_error(
+        "Couldn't find '" + file_path + "' in '" + path_ + "'");
+  }
+  return it->second;
+}
+
+void zip_archive::readCentralDirectory() {
+  std::ifstream file;
+  open_archive(file, path_);
+  file.seekg(0, std::ios::end);
+  uint64_t file_size = (uint64_t)file.tellg();
+  if (file_size < end_size)
+    throw std::runtime_error("Invalid zip archive '" + path_ + "': too small");
+
+  // The end of central directory record is followed only by a comment of up
+  // to 65535 bytes, so search backwards for its signature in the tail.
+  size_t tail_size = (size_t)std::min<uint64_t>(file_size, end_size + 65535);
+  std::vector<unsigned char> tail(tail_size);
+  read_at(file, file_size - tail_size, &tail[0], tail_size, path_);
+  size_t end_pos = tail_size;
+  for (size_t i = tail_size - end_size + 1; i-- > 0; ) {
+    if (le32(&tail[i]) == end_signature) {
+      end_pos = i;
+      break;
+    }
+  }
+  if (end_pos == tail_size) {
+    throw std::runtime_error("Invalid zip archive '" + path_
+        + "': no end of central directory");
+  }
+
+  const unsigned char* end = &tail[end_pos];
+  uint64_t count = le16(end + 10);
+  uint64_t directory_size = le32(end + 12);
+  uint64_t directory_offset = le32(end + 16);
+
+  // Zip64 archives have another record, found by a locator that immediately
+  // precedes the ordinary one.
+  uint64_t end_offset = file_size - tail_size + end_pos;
+  if (end_offset >= end64_locator_size) {
+    unsigned char locator[end64_locator_size];
+    read_at(file, end_offset - end64_locator_size, locator,
+        end64_locator_size, path_);
+    if (le32(locator) == end64_locator_signature) {
+      unsigned char end64[56];
+      read_at(file, le64(locator + 8), end64, 56, path_);
+      if (le32(end64) != end64_signature) {
+        throw std::runtime_error("Invalid zip archive '" + path_
+            + "': bad zip64 end of central directory");
+      }
+      count = le64(end64 + 32);
+      directory_size = le64(end64 + 40);
+      directory_offset = le64(end64 + 48);
+    }
+  }
+
+  if (directory_offset + directory_size > file_size) {
+    throw std::runtime_error("Invalid zip archive '" + path_
+        + "': central directory out of bounds");
+  }
+
+  std::vector<unsigned char> directory(directory_size + 1);
+  if (directory_size > 0)
+    read_at(file, directory_offset, &directory[0], directory_size, path_);
+
+  entries_.reserve(count);
+  size_t pos = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (pos + central_header_size > directory_size
+        || le32(&directory[pos]) != central_header_signature) {
+      throw std::runtime_error("Invalid zip archive '" + path_
+          + "': bad central directory entry");
+    }
+    const unsigned char* header = &directory[pos];
+    zip_entry entry;
+    entry.flags = le16(header + 8);
+    entry.method = le16(header + 10);
+    entry.crc32 = le32(header + 16);
+    entry.compressed_size = le32(header + 20);
+    entry.size = le32(header + 24);
+    uint16_t name_length = le16(header + 28);
+    uint16_t extra_length = le16(header + 30);
+    uint16_t comment_length = le16(header + 32);
+    entry.local_offset = le32(header + 42);
+    if (pos + central_header_size + name_length + extra_length > directory_size) {
+      throw std::runtime_error("Invalid zip archive '" + path_
+          + "': bad central directory entry");
+    }
+    std::string name((const char*)header + central_header_size, name_length);
+
+    // Sizes and offsets too big for 32 bits are given in the zip64 extra
+    // field, in a fixed order, but only the ones that overflowed.
+    const unsigned char* extra = header + central_header_size + name_length;
+    const unsigned char* extra_end = extra + extra_length;
+    while (extra + 4 <= extra_end) {
+      uint16_t id = le16(extra);
+      uint16_t size = le16(extra + 2);
+      const unsigned char* field = extra + 4;
+      const unsigned char* field_end = field + size;
+      if (field_end > extra_end)
+        break;
+      if (id == 0x0001) {
+        if (entry.size == 0xFFFFFFFF && field + 8 <= field_end) {
+          entry.size = le64(field);
+          field += 8;
+        }
+        if (entry.compressed_size == 0xFFFFFFFF && field + 8 <= field_end) {
+          entry.compressed_size = le64(field);
+          field += 8;
+        }
+        if (entry.local_offset == 0xFFFFFFFF && field + 8 <= field_end) {
+          entry.local_offset = le64(field);
+        }
+      }
+      extra = field_end;
+    }
+
+    entries_[name] = entry;
+    pos += central_header_size + name_length + extra_length + comment_length;
+  }
+}
+
+uint64_t zip_archive::dataOffset(
+    std::ifstream& file,
+    const zip_entry& entry) const {
+  if (entry.flags & 1) {
+    throw std::runtime_error("Encrypted members of '" + path_
+        + "' are not supported");
+  }
+
+  // The local header repeats the name, but its extra field can differ in
+  // length from the one in the central directory.
+  unsigned char header[local_header_size];
+  read_at(file, entry.local_offset, header, local_header_size, path_);
+  if (le32(header) != local_header_signature) {
+    throw std::runtime_error("Invalid zip archive '" + path_
+        + "': bad local file header");
+  }
+  return entry.local_offset + local_header_size
+    + le16(header + 26) + le16(header + 28);
+}
+
+std::string zip_archive::compressed(const zip_entry& entry) const {
+  std::ifstream file;
+  open_archive(file, path_);
+  uint64_t data_offset = dataOffset(file, entry);
+
+  std::string out(entry.compressed_size, '\0');
+  if (entry.compressed_size > 0) {
+    read_at(file, data_offset, (unsigned char*)&out[0],
+        entry.compressed_size, path_);
+  }
+  return out;
+}
+
+std::string zip_archive::buffer(const std::string& file_path) const {
+  const zip_entry& member = entry(file_path);
+  std::string data = compressed(member);
+
+  std::string out;
+  uint32_t crc;
+  if (member.method == 0) {
+    out.swap(data);
+    crc = crc32_update(0, (const unsigned char*)out.data(), out.size());
+  } else if (member.method == 8) {
+    out.resize(member.size);
+    inflater inflate((const unsigned char*)data.data(), data.size());
+    size_t n = member.size > 0 ? inflate.read(&out[0], member.size) : 0;
+    if (n != member.size) {
+      throw std::runtime_error("Invalid zip archive '" + path_ + "': '"
+          + file_path + "' is shorter than its recorded size");
+    }
+    crc = inflate.crc32();
+  } else {
+    throw std::runtime_error("Unsupported compression method in '" + path_
+        + "' for '" + file_path + "'");
+  }
+
+  if (crc != member.crc32) {
+    throw std::runtime_error("Invalid zip archive '" + path_ + "': '"
+        + file_path + "' fails its CRC check");
+  }
+
+  out.push_back('\0');
+  return out;
+}
+
+namespace {
+
+const size_t stream_block_size = 65536; // compressed bytes read at a time
+
+} // namespace
+
+zip_stream::zip_stream(const zip_archive& archive, const std::string& file_path):
+  path_(archive.path()),
+  file_path_(file_path),
+  entry_(archive.entry(file_path)),
+  remaining_(entry_.compressed_size),
+  total_out_(0),
+  crc_(0),
+  inflater_(*this) {
+  if (entry_.method != 0 && entry_.method != 8) {
+    throw std::runtime_error("Unsupported compression method in '" + path_
+        + "' for '" + file_path_ + "'");
+  }
+  open_archive(file_, path_);
+  file_.seekg((std::streamoff)archive.dataOffset(file_, entry_), std::ios::beg);
+  in_.resize(stream_block_size);
+}
+
+size_t zip_stream::next(const unsigned char*& data) {
+  size_t n = (size_t)std::min<uint64_t>(remaining_, in_.size());
+  if (n == 0)
+    return 0;
+  file_.read((char*)&in_[0], n);
+  if ((size_t)file_.gcount() != n)
+    throw std::runtime_error("Invalid zip archive '" + path_ + "': truncated");
+  remaining_ -= n;
+  data = &in_[0];
+  return n;
+}
+
+size_t zip_stream::read(char* out, size_t n) {
+  if (total_out_ + n > entry_.size)
+    n = (size_t)(entry_.size - total_out_);
+  size_t produced;
+  if (entry_.method == 0) {
+    // Stored members are read straight into out
+    file_.read(out, n);
+    if ((size_t)file_.gcount() != n)
+      throw std::runtime_error("Invalid zip archive '" + path_ + "': truncated");
+    remaining_ -= n;
+    produced = n;
+    crc_ = crc32_update(crc_, (const unsigned char*)out, produced);
+  } else {
+    produced = n > 0 ? inflater_.read(out, n) : 0;
+  }
+  total_out_ += produced;
+  if (produced < n || total_out_ == entry_.size)
+    check();
+  return produced;
+}
+
+void zip_stream::check() {
+  if (total_out_ != entry_.size) {
+    throw std::runtime_error("Invalid zip archive '" + path_ + "': '"
+        + file_path_ + "' is shorter than its recorded size");
+  }
+  uint32_t crc = entry_.method == 0 ? crc_ : inflater_.crc32();
+  if (crc != entry_.crc32) {
+    throw std::runtime_error("Invalid zip archive '" + path_ + "': '"
+        + file_path_ + "' fails its CRC check");
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef ZIP_ARCHIVE_
+#define ZIP_ARCHIVE_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "inflater.h"
+
+// An xlsx file is a zip archive of xml files.  zip_archive reads the central
+// directory once, when it is constructed, and then inflates members on demand,
+// without going through R.
+//
+// It doesn't touch R, so errors are thrown as std::runtime_error.
+
+struct zip_entry {
+  uint64_t local_offset;    // offset of the local file header
+  uint64_t compressed_size;
+  uint64_t size;            // uncompressed size
+  uint32_t crc32;
+  uint16_t method;          // 0 = stored, 8 = deflated
+  uint16_t flags;
+};
+
+class zip_archive {
+
+  std::string path_;
+  std::unordered_map<std::string, zip_entry> entries_; // indexed by file path
+
+  public:
+
+    zip_archive(const std::string& path);
+
+    const std::string& path() const;
+    bool hasFile(const std::string& file_path) const;
+    const zip_entry& entry(const std::string& file_path) const;
+
+    // Compressed bytes of a member, as stored in the archive
+    std::string compressed(const zip_entry& entry) const;
+
+    // Uncompressed contents of a member, with a terminating '\0' for rapidxml
+    std::string buffer(const std::string& file_path) const;
+
+    // Offset of the data of a member, after its local header
+    uint64_t dataOffset(std::ifstream& file, const zip_entry& entry) const;
+
+  private:
+
+    void readCentralDirectory();
+};
+
+// Reads one member of an archive a chunk at a time, so that neither the
+// compressed nor the uncompressed member is ever wholly in memory.  The CRC is
+// checked if the member is read to the end.
+
+class zip_stream : private inflater_source {
+
+  std::string path_;                 // path of the archive, for errors
+  std::string file_path_;            // path of the member, for errors
+  zip_entry entry_;
+  std::ifstream file_;
+  std::vector<unsigned char> in_;    // a block of compressed data
+  uint64_t remaining_;               // compressed bytes not yet read
+  uint64_t total_out_;
+  uint32_t crc_;                     // of stored members
+  inflater inflater_;                // of deflated members
+
+  public:
+
+    zip_stream(const zip_archive& archive, const std::string& file_path);
+
+    // Read up to n bytes into out, returning the number of bytes read, which
+    // is less than n only at the end of the member.
+    size_t read(char* out, size_t n);
+
+  private:
+
+    size_t next(const unsigned char*& data);
+    void check();
+};
+
+#endif